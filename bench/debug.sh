@@ -0,0 +1,60 @@
+#!/bin/bash
+# ##########################################################################################
+# # Checks that -debug runs quietly between stops in all three simulators. Each one runs a #
+# # generated program with taken branches, loads and stores under a fixed list of          #
+# # debugger commands that print nothing themselves, so once the prompts are taken out    #
+# # every line left has to be a stop message: where it stopped and why.                   #
+# #                                                                                        #
+# #   bench/debug.sh                                                                       #
+# #                                                                                        #
+# # Prints one line per simulator, and the first stray lines of any that fail, and exits   #
+# # non-zero if any of them does.                                                          #
+# ##########################################################################################
+
+set -e
+
+root="$(cd "$(dirname "$0")/.." && pwd)"
+work="$(mktemp -d "${TMPDIR:-/tmp}/lc2k-debug.XXXXXX")"
+trap 'rm -rf "$work"' EXIT
+
+gcc -O2 -o "$work/binarydecoder" "$root/proj1/binarydecoder.c"
+g++ -O2 -o "$work/memory" "$root/proj2/memory.cpp"
+g++ -O2 -pthread -o "$work/lrucache" "$root/proj3/Project 3 Colton Winfield-1/lrucache.cpp"
+g++ -O2 -o "$work/workloadgen" "$root/bench/workloadgen.cpp"
+
+"$work/workloadgen" -seed=1 -iterations=200 -mix=2,1,2,1,4 -body=16 -branches=data -taken=50 > "$work/branchy.mc"
+
+# stops at the loop head a few times, steps across it, and quits while still stopped
+commands="break 5
+continue
+continue
+step 50
+delete 5
+until 2000
+continue
+quit"
+
+failures=0
+
+# passes when nothing but prompts and stop messages came out of the run
+check() {
+    local name="$1"
+    shift
+    local stray
+    stray=$(printf '%s\n' "$commands" | "$@" | sed 's/(debug) //g' | grep -Ev \
+        '^(stopped at pc -?[0-9]+ after [0-9]+ [a-z]+|breakpoint at pc -?[0-9]+|reached [0-9]+ [a-z]+|)$' || true)
+
+    if [ -z "$stray" ]; then
+        echo "ok: $name prints only stop messages under -debug"
+    else
+        echo "failed: $name prints more than stop messages under -debug:"
+        printf '%s\n' "$stray" | head -5
+        failures=$((failures + 1))
+    fi
+}
+
+check binarydecoder "$work/binarydecoder" "$work/branchy.mc" -debug
+check memory "$work/memory" "$work/branchy.mc" -debug
+check lrucache "$work/lrucache" "$work/branchy.mc" 4 8 2 -debug
+
+[ "$failures" -eq 0 ]
@@ -0,0 +1,86 @@
+#!/bin/bash
+# ##########################################################################################
+# # Times the three simulators on a fixed set of generated programs and prints how fast    #
+# # each one runs on this host: instructions per second for the functional simulator,     #
+# # cycles per second for the pipeline, and accesses per second for the cache, both       #
+# # running the program and replaying its recorded trace. The programs come from fixed     #
+# # seeds, so the numbers only move when the simulators (or the host) do.                  #
+# #                                                                                        #
+# #   bench/run.sh [-repeat=<n>] [-quick]                                                  #
+# #                                                                                        #
+# # Each run is timed -repeat times (3) and the fastest is kept. -quick cuts every         #
+# # program to a quarter of its iterations. The pipeline copies its whole state every      #
+# # cycle, so it runs the same programs with 1/25 of the iterations. Output is CSV.        #
+# ##########################################################################################
+
+set -e
+
+repeat=3
+scale=1
+for arg in "$@"; do
+    case "$arg" in
+        -repeat=*) repeat="${arg#-repeat=}" ;;
+        -quick) scale=4 ;;
+        *) echo "error: unknown option $arg"; exit 1 ;;
+    esac
+done
+
+root="$(cd "$(dirname "$0")/.." && pwd)"
+work="$(mktemp -d "${TMPDIR:-/tmp}/lc2k-bench.XXXXXX")"
+trap 'rm -rf "$work"' EXIT
+
+gcc -O2 -o "$work/binarydecoder" "$root/proj1/binarydecoder.c"
+g++ -O2 -o "$work/memory" "$root/proj2/memory.cpp"
+g++ -O2 -pthread -o "$work/lrucache" "$root/proj3/Project 3 Colton Winfield-1/lrucache.cpp"
+g++ -O2 -o "$work/workloadgen" "$root/bench/workloadgen.cpp"
+
+# name, then the generator options; iterations are given separately so they can be scaled
+corpus=(
+    "alu 100000 -mix=6,3,0,0,1 -body=16"
+    "stream 100000 -mix=1,0,4,2,0 -body=16 -workingset=4096"
+    "strided 100000 -mix=1,0,4,2,0 -body=16 -workingset=8192 -stride=16"
+    "random 100000 -mix=1,0,4,2,0 -body=16 -workingset=8192 -random=100"
+    "branchy 100000 -mix=2,1,2,0,4 -body=16 -branches=data -taken=50"
+)
+pipelineScale=25
+
+# the fastest of $repeat runs of the command, in seconds
+timeCommand() {
+    local best=""
+    for ((run = 0; run < repeat; run++)); do
+        local start end
+        start=$(date +%s%N)
+        "$@" > /dev/null
+        end=$(date +%s%N)
+        if [ -z "$best" ] || [ $((end - start)) -lt "$best" ]; then
+            best=$((end - start))
+        fi
+    done
+    echo "$best" | awk '{ printf "%.4f", $1 / 1e9 }'
+}
+
+report() {
+    echo "$1,$2,$3,$4,$5" | awk -F, '{ printf "%s,%s,%s,%s,%.0f\n", $1, $2, $3, $4, $3 / ($4 > 0 ? $4 : 1e-9) }'
+}
+
+echo "workload,simulator,work,seconds,perSecond"
+
+for entry in "${corpus[@]}"; do
+    read -r name iterations options <<< "$entry"
+    program="$work/$name.mc"
+    pipelineProgram="$work/$name-pipeline.mc"
+    trace="$work/$name.tr"
+
+    "$work/workloadgen" -seed=1 -iterations=$((iterations / scale)) $options > "$program"
+    "$work/workloadgen" -seed=1 -iterations=$((iterations / scale / pipelineScale)) $options > "$pipelineProgram"
+
+    instructions=$("$work/binarydecoder" "$program" -quiet | awk '/instructions executed/ { print $3 }')
+    cycles=$("$work/memory" "$pipelineProgram" -quiet | awk '/cycles executed/ { print $3 }')
+    "$work/lrucache" "$program" 8 64 4 -quiet -record="$trace" > /dev/null
+    accesses=$(wc -l < "$trace")
+
+    report "$name" binarydecoder "$instructions" "$(timeCommand "$work/binarydecoder" "$program" -quiet)"
+    report "$name" memory "$cycles" "$(timeCommand "$work/memory" "$pipelineProgram" -quiet)"
+    report "$name" lrucache "$accesses" "$(timeCommand "$work/lrucache" "$program" 8 64 4 -quiet)"
+    report "$name" lrucache-trace "$accesses" "$(timeCommand "$work/lrucache" "$trace" 8 64 4 -trace -quiet)"
+done
@@ -0,0 +1,49 @@
+#!/bin/bash
+# ##########################################################################################
+# # Checks the cache simulator's timing model against what a generated streaming program  #
+# # should cost. Every block of the stream is missed once without a prefetcher, while a    #
+# # stream buffer that keeps ahead of it turns those misses into buffer hits, so its AMAT  #
+# # has to stay near the hit latency instead of paying the memory latency per block.       #
+# #                                                                                        #
+# #   bench/timing.sh                                                                      #
+# #                                                                                        #
+# # Prints one line per check and exits non-zero if any of them fails.                     #
+# ##########################################################################################
+
+set -e
+
+root="$(cd "$(dirname "$0")/.." && pwd)"
+work="$(mktemp -d "${TMPDIR:-/tmp}/lc2k-timing.XXXXXX")"
+trap 'rm -rf "$work"' EXIT
+
+g++ -O2 -pthread -o "$work/lrucache" "$root/proj3/Project 3 Colton Winfield-1/lrucache.cpp"
+g++ -O2 -o "$work/workloadgen" "$root/bench/workloadgen.cpp"
+
+"$work/workloadgen" -seed=1 -iterations=2000 -mix=1,0,4,2,0 -body=16 -workingset=4096 > "$work/stream.mc"
+
+# the AMAT the run prints, for an 8-word block, 16-set, 2-way cache
+amat() {
+    "$work/lrucache" "$work/stream.mc" 8 16 2 -quiet -timing "$@" | awk '/AMAT/ { print $(NF - 1) }'
+}
+
+failures=0
+
+# passes when awk finds the condition true of the two numbers
+check() {
+    if awk -v a="$2" -v b="$4" "BEGIN { exit !(a $3 b) }"; then
+        echo "ok: $1 ($2 $3 $4)"
+    else
+        echo "failed: $1 ($2 $3 $4)"
+        failures=$((failures + 1))
+    fi
+}
+
+none=$(amat)
+stream=$(amat -prefetch=stream)
+nextline=$(amat -prefetch=nextline -prefetchbuffer=8)
+
+check "stream buffer hits cost the buffer latency, not memory" "$stream" "<" 1.1
+check "stream buffer beats no prefetching" "$stream" "<" "$none"
+check "next-line buffer hits cost the buffer latency, not memory" "$nextline" "<" 1.1
+
+[ "$failures" -eq 0 ]
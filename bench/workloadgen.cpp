@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "../common/isa.h"
+
+// Writes an LC-2K machine-code program to stdout that all three simulators can run: a loop whose body is drawn
+// from an instruction mix, walking a data array with a given stride, working set and amount of randomness.
+
+#define NUMMEMORY 65536 /* maximum number of words in memory */
+#define MAXOFFSET 32767 /* largest offset a lw, sw or beq can hold */
+
+typedef struct optionsStruct {
+    unsigned int seed;
+    int iterations;
+    int bodyLength;
+    int weights[5];           // add, nand, lw, sw, beq
+    int workingSet;           // words the loop index sweeps, a power of two
+    int stride;
+    int randomPercent;        // loads and stores anywhere in the working set instead of at the index
+    int takenPercent;
+    bool isDataBranch;        // branches test the word last loaded instead of a fixed outcome
+} optionsType;
+
+void parseOptions(int argc, char *argv[], optionsType &options);
+
+unsigned int nextRandom(unsigned int &state);
+
+int chooseOpCode(optionsType &options, unsigned int &randomState);
+
+void generateProgram(optionsType &options, std::vector<int> &program);
+
+int main(int argc, char *argv[]) {
+    optionsType options;
+    std::vector<int> program;
+
+    parseOptions(argc, argv, options);
+    generateProgram(options, program);
+
+    for (size_t i = 0; i < program.size(); i++) {
+        printf("%d\n", program[i]);
+    }
+
+    return (0);
+}
+
+// ##########################################################################################
+// # Options:                                                                               #
+// #   -seed=<n>         seeds everything random, so a seed always gives the same program.  #
+// #   -iterations=<n>   times the loop runs (1000).                                        #
+// #   -body=<n>         instructions in the loop body drawn from the mix (16).             #
+// #   -mix=<add>,<nand>,<lw>,<sw>,<beq>  relative weights of each (4,2,4,2,1).             #
+// #   -workingset=<n>   words the loop index sweeps, a power of two (1024).                #
+// #   -stride=<n>       words the index moves each iteration (1).                          #
+// #   -random=<n>       percent of loads and stores that go to a random word up to a       #
+// #                     working set past the index rather than to the next few (0).        #
+// #   -taken=<n>        percent of branches taken (50).                                    #
+// #   -branches=<kind>  static: each branch always or never goes; data: each one tests the #
+// #                     last word loaded, and the array holds taken% zeros (static).       #
+// ##########################################################################################
+
+void parseOptions(int argc, char *argv[], optionsType &options) {
+    int defaultWeights[5] = {4, 2, 4, 2, 1};
+
+    options.seed = 1;
+    options.iterations = 1000;
+    options.bodyLength = 16;
+    memcpy(options.weights, defaultWeights, sizeof(defaultWeights));
+    options.workingSet = 1024;
+    options.stride = 1;
+    options.randomPercent = 0;
+    options.takenPercent = 50;
+    options.isDataBranch = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "-seed=", 6) == 0) {
+            options.seed = (unsigned int) strtoul(argv[i] + 6, NULL, 10);
+        } else if (strncmp(argv[i], "-iterations=", 12) == 0) {
+            options.iterations = atoi(argv[i] + 12);
+        } else if (strncmp(argv[i], "-body=", 6) == 0) {
+            options.bodyLength = atoi(argv[i] + 6);
+        } else if (strncmp(argv[i], "-mix=", 5) == 0) {
+            int *weights = options.weights;
+            if (sscanf(argv[i] + 5, "%d,%d,%d,%d,%d", &weights[0], &weights[1], &weights[2], &weights[3],
+                       &weights[4]) != 5) {
+                printf("error: bad mix %s\n", argv[i] + 5);
+                exit(1);
+            }
+        } else if (strncmp(argv[i], "-workingset=", 12) == 0) {
+            options.workingSet = atoi(argv[i] + 12);
+        } else if (strncmp(argv[i], "-stride=", 8) == 0) {
+            options.stride = atoi(argv[i] + 8);
+        } else if (strncmp(argv[i], "-random=", 8) == 0) {
+            options.randomPercent = atoi(argv[i] + 8);
+        } else if (strncmp(argv[i], "-taken=", 7) == 0) {
+            options.takenPercent = atoi(argv[i] + 7);
+        } else if (strcmp(argv[i], "-branches=static") == 0) {
+            options.isDataBranch = false;
+        } else if (strcmp(argv[i], "-branches=data") == 0) {
+            options.isDataBranch = true;
+        } else {
+            printf("error: unknown option %s\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    int totalWeight = 0;
+    for (int i = 0; i < 5; i++) {
+        if (options.weights[i] < 0) {
+            totalWeight = 0;
+            break;
+        }
+        totalWeight += options.weights[i];
+    }
+
+    if (totalWeight == 0 || options.iterations < 1 || options.bodyLength < 1 || options.workingSet < 1
+        || (options.workingSet & (options.workingSet - 1)) != 0 || options.stride < 0
+        || options.randomPercent < 0 || options.randomPercent > 100 || options.takenPercent < 0
+        || options.takenPercent > 100) {
+        printf("error: bad workload settings\n");
+        exit(1);
+    }
+}
+
+// xorshift, the same generator the cache simulator uses for random replacement
+unsigned int nextRandom(unsigned int &state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+int chooseOpCode(optionsType &options, unsigned int &randomState) {
+    int opCodes[5] = {ADD, NAND, LW, SW, BEQ};
+    int totalWeight = 0;
+
+    for (int i = 0; i < 5; i++) {
+        totalWeight += options.weights[i];
+    }
+
+    int pick = (int) (nextRandom(randomState) % totalWeight);
+    for (int i = 0; i < 5; i++) {
+        if (pick < options.weights[i]) {
+            return opCodes[i];
+        }
+        pick -= options.weights[i];
+    }
+
+    return ADD;
+}
+
+// ##########################################################################################
+// # Registers: 1 counts the iterations down, 2 holds -1, 3 is the index into the array, 4  #
+// # the stride and 5 the working-set mask. Loads go to 6, which stores write back out (so  #
+// # the array keeps its mix of zeros and ones), and add and nand fold 6 into 7. After the  #
+// # body the index moves on and wraps: 3 = (3 + 4) & 5, with the and made of two nands.    #
+// # The constants and then the array (two working sets long) follow the halt.             #
+// ##########################################################################################
+
+void generateProgram(optionsType &options, std::vector<int> &program) {
+    unsigned int randomState = options.seed == 0 ? 1 : options.seed;
+    std::vector<int> body;
+
+    // warm the generator up so nearby seeds don't start out alike
+    for (int i = 0; i < 8; i++) {
+        nextRandom(randomState);
+    }
+
+    int constants = 4 + options.bodyLength + 6 + 1;
+    int arrayBase = constants + 4;
+
+    if (arrayBase + options.workingSet > MAXOFFSET || arrayBase + 2 * options.workingSet > NUMMEMORY) {
+        printf("error: a working set of %d words doesn't fit\n", options.workingSet);
+        exit(1);
+    }
+
+    for (int i = 0; i < options.bodyLength; i++) {
+        int opCode = chooseOpCode(options, randomState);
+        int offset = (int) (nextRandom(randomState) % 4);
+
+        if ((int) (nextRandom(randomState) % 100) < options.randomPercent) {
+            offset = (int) (nextRandom(randomState) % options.workingSet);
+        }
+
+        // a branch skips the instruction after it, so it can't come last
+        if (opCode == BEQ && i == options.bodyLength - 1) {
+            opCode = ADD;
+        }
+
+        if (opCode == ADD || opCode == NAND) {
+            body.push_back(isaEncode(opCode, 6, 7, 7));
+        } else if (opCode == LW || opCode == SW) {
+            body.push_back(isaEncode(opCode, 3, 6, arrayBase + offset));
+        } else if (options.isDataBranch) {
+            body.push_back(isaEncode(BEQ, 0, 6, 1));
+        } else {
+            bool isTaken = (int) (nextRandom(randomState) % 100) < options.takenPercent;
+            body.push_back(isaEncode(BEQ, 0, isTaken ? 0 : 2, 1));
+        }
+    }
+
+    program.push_back(isaEncode(LW, 0, 1, constants));
+    program.push_back(isaEncode(LW, 0, 2, constants + 1));
+    program.push_back(isaEncode(LW, 0, 4, constants + 2));
+    program.push_back(isaEncode(LW, 0, 5, constants + 3));
+
+    int loop = (int) program.size();
+    program.insert(program.end(), body.begin(), body.end());
+    program.push_back(isaEncode(ADD, 3, 4, 3));
+    program.push_back(isaEncode(NAND, 3, 5, 3));
+    program.push_back(isaEncode(NAND, 3, 3, 3));
+    program.push_back(isaEncode(ADD, 1, 2, 1));
+    program.push_back(isaEncode(BEQ, 1, 0, 1));
+    program.push_back(isaEncode(BEQ, 0, 0, loop - ((int) program.size() + 1)));
+    program.push_back(isaEncode(HALT, 0, 0, 0));
+
+    program.push_back(options.iterations);
+    program.push_back(-1);
+    program.push_back(options.stride);
+    program.push_back(options.workingSet - 1);
+
+    for (int i = 0; i < 2 * options.workingSet; i++) {
+        program.push_back((int) (nextRandom(randomState) % 100) < options.takenPercent ? 0 : 1);
+    }
+}
@@ -0,0 +1,417 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "history.h"
+
+// ##########################################################################################
+// # The -debug mode all three simulators share. The simulator runs at full speed, printing #
+// # nothing, and asks checkDebugger before each instruction (or cycle) whether to stop:    #
+// # a breakpoint on the pc, a store to a watched address, the instruction (cycle) count    #
+// # reaching a target, the end of a step, or a register condition turning true. Then it    #
+// # hands over to runDebuggerPrompt, which reads commands from stdin until one resumes.    #
+// # Breakpoints and watchpoints are a byte per address, so a pc or a store only costs one  #
+// # lookup whether anything is set or not. With a history (common/history.h) it can also   #
+// # step and continue backwards, by rewinding and replaying forward through the same loop. #
+// # Include after NUMMEMORY and NUMREGS.                                                   #
+// ##########################################################################################
+
+#define MAXCONDITIONS 8
+
+typedef struct conditionStruct {
+    int reg;
+    char op;                  // '=' (==), '!' (!=), '<' or '>'
+    int value;
+    int wasTrue;              // conditions stop when they become true, not for as long as they stay true
+} conditionType;
+
+typedef struct debuggerStruct {
+    unsigned char breakpoints[NUMMEMORY];
+    unsigned char watchpoints[NUMMEMORY];
+    conditionType conditions[MAXCONDITIONS];
+    int numOfConditions;
+    long long stopCount;      // -1 when there's no count to stop at
+    long long stepsLeft;      // 0 when not stepping
+    int watchHit;             // set by a store to a watched address, reported at the next check
+    int watchAddress;
+    const char *countName;    // "instructions" or "cycles"
+    int *pc;                  // the simulator's, read at every check
+    int *count;
+    int *reg;
+    int *mem;
+    historyType *history;     // NULL when it can't go backwards
+    int replayTo;             // after a rewind, run forward without stopping up to here (-1 when not replaying)
+    int isSearching;          // replaying for reverse-continue: note the last stop from searchStart up to replayTo
+    int searchStart;
+    int searchFound;
+} debuggerType;
+
+// Handles the commands only one simulator has (and "help", to list them); returns 0 for anything it doesn't know.
+typedef int (*inspectFunction)(void *context, const char *command, const char *argument);
+
+static inline void initializeDebugger(debuggerType *debugger, const char *countName) {
+    memset(debugger->breakpoints, 0, sizeof(debugger->breakpoints));
+    memset(debugger->watchpoints, 0, sizeof(debugger->watchpoints));
+    debugger->numOfConditions = 0;
+    debugger->stopCount = -1;
+    debugger->stepsLeft = 0;
+    debugger->watchHit = 0;
+    debugger->watchAddress = 0;
+    debugger->countName = countName;
+    debugger->history = NULL;
+    debugger->replayTo = -1;
+    debugger->isSearching = 0;
+}
+
+static inline void attachMachine(debuggerType *debugger, int *pc, int *count, int *reg, int *mem) {
+    debugger->pc = pc;
+    debugger->count = count;
+    debugger->reg = reg;
+    debugger->mem = mem;
+}
+
+// -debug, or -debug=<interval>,<kilobytes> to set the history (0 for none); returns 0 for anything else.
+static inline int parseDebugOption(const char *argument, int *interval, int *kilobytes) {
+    *interval = 10000;
+    *kilobytes = 65536;
+
+    if (strcmp(argument, "-debug") == 0) {
+        return 1;
+    } else if (strncmp(argument, "-debug=", 7) != 0) {
+        return 0;
+    }
+    if (sscanf(argument + 7, "%d,%d", interval, kilobytes) < 1 || *interval < 0 || *kilobytes < 0) {
+        printf("error: bad history %s\n", argument + 7);
+        exit(1);
+    }
+    return 1;
+}
+
+// Called by every store while debugging; an unwatched address costs the one lookup.
+static inline void noteStore(debuggerType *debugger, int address) {
+    if (address >= 0 && address < NUMMEMORY && debugger->watchpoints[address]) {
+        debugger->watchHit = 1;
+        debugger->watchAddress = address;
+    }
+}
+
+static inline int isConditionTrue(conditionType *condition, const int *reg) {
+    int value = reg[condition->reg];
+
+    if (condition->op == '=') {
+        return value == condition->value;
+    } else if (condition->op == '!') {
+        return value != condition->value;
+    } else if (condition->op == '<') {
+        return value < condition->value;
+    }
+    return value > condition->value;
+}
+
+// Whether a condition has just turned true; also keeps wasTrue up to date.
+static inline int hasConditionFired(debuggerType *debugger) {
+    int hasFired = 0;
+
+    for (int i = 0; i < debugger->numOfConditions; i++) {
+        conditionType *condition = &debugger->conditions[i];
+        int isTrue = isConditionTrue(condition, debugger->reg);
+
+        hasFired |= isTrue && !condition->wasTrue;
+        condition->wasTrue = isTrue;
+    }
+    return hasFired;
+}
+
+// After a rewind the conditions start over from wherever the registers are now.
+static inline void resetConditions(debuggerType *debugger) {
+    for (int i = 0; i < debugger->numOfConditions; i++) {
+        debugger->conditions[i].wasTrue = isConditionTrue(&debugger->conditions[i], debugger->reg);
+    }
+    debugger->watchHit = 0;
+}
+
+// Rewinds to target and replays the rest; returns 1 if it's there already.
+static inline int goBackTo(debuggerType *debugger, int target) {
+    int reached = rewindHistory(debugger->history, target);
+
+    resetConditions(debugger);
+    if (reached == target) {
+        return 1;
+    }
+    debugger->replayTo = target;
+    return 0;
+}
+
+// ##########################################################################################
+// # reverse-continue replays one interval at a time, newest first, noting the last stop in #
+// # each: the interval from searchStart up to replayTo. With nothing there it rewinds one  #
+// # checkpoint further; returns 1 when it has to stop right where it is.                   #
+// ##########################################################################################
+
+static inline int continueSearch(debuggerType *debugger) {
+    int searchEnd = debugger->searchStart;
+
+    if (debugger->searchFound >= 0) {
+        debugger->isSearching = 0;
+        return goBackTo(debugger, debugger->searchFound);
+    }
+    if (searchEnd <= getOldestCount(debugger->history)) {
+        debugger->isSearching = 0;
+        printf("reached the start of the history\n");
+        rewindToCheckpoint(debugger->history, searchEnd);
+        resetConditions(debugger);
+        return 1;
+    }
+
+    debugger->searchStart = rewindToCheckpoint(debugger->history, searchEnd - 1);
+    debugger->replayTo = searchEnd;
+    resetConditions(debugger);
+    return 0;
+}
+
+// While replaying nothing stops until replayTo, where the ordinary checks take over.
+static inline int checkReplay(debuggerType *debugger) {
+    if (*debugger->count < debugger->replayTo) {
+        int pc = *debugger->pc;
+        int isStop = debugger->watchHit || (pc >= 0 && pc < NUMMEMORY && debugger->breakpoints[pc]);
+
+        isStop |= hasConditionFired(debugger);
+        debugger->watchHit = 0;
+
+        if (debugger->isSearching && isStop) {
+            debugger->searchFound = *debugger->count;
+        }
+        return 0;
+    }
+
+    debugger->replayTo = -1;
+    if (debugger->isSearching && !continueSearch(debugger)) {
+        return 0;
+    }
+    return 1;
+}
+
+// Returns 1 if the simulator should stop before running the instruction (or cycle) at pc, saying why.
+static inline int checkDebugger(debuggerType *debugger) {
+    int isStopping = 0, pc = *debugger->pc;
+    long long count = *debugger->count;
+
+    if (debugger->replayTo >= 0) {
+        if (!checkReplay(debugger)) {
+            return 0;
+        }
+        isStopping = 1;
+    }
+
+    if (debugger->watchHit) {
+        printf("watchpoint: store to %d\n", debugger->watchAddress);
+        debugger->watchHit = 0;
+        isStopping = 1;
+    }
+    if (pc >= 0 && pc < NUMMEMORY && debugger->breakpoints[pc]) {
+        printf("breakpoint at pc %d\n", pc);
+        isStopping = 1;
+    }
+    if (count == debugger->stopCount) {
+        printf("reached %lld %s\n", count, debugger->countName);
+        debugger->stopCount = -1;
+        isStopping = 1;
+    }
+    if (debugger->stepsLeft > 0 && --debugger->stepsLeft == 0) {
+        isStopping = 1;
+    }
+
+    for (int i = 0; i < debugger->numOfConditions; i++) {
+        conditionType *condition = &debugger->conditions[i];
+        int isTrue = isConditionTrue(condition, debugger->reg);
+
+        if (isTrue && !condition->wasTrue) {
+            printf("condition: reg[ %d ] is %d\n", condition->reg, debugger->reg[condition->reg]);
+            isStopping = 1;
+        }
+        condition->wasTrue = isTrue;
+    }
+
+    return isStopping;
+}
+
+static inline void printDebuggerHelp(inspectFunction inspect, void *context) {
+    printf("break <pc>, delete <pc>       stop before the instruction at pc (is fetched)\n");
+    printf("watch <address>, unwatch <address>  stop after a store to address\n");
+    printf("until <n>                     stop once the count reaches n\n");
+    printf("cond <reg> <==|!=|<|>> <value>  stop when the register comparison becomes true\n");
+    printf("uncond                        drop every condition\n");
+    printf("step [n], continue            run n (1) more, or up to the next stop\n");
+    printf("rstep [n], rcontinue          go back n (1), or to the last stop before this one\n");
+    printf("regs, mem <address> [n]       print the registers, or n (1) words of memory\n");
+    printf("info                          list what's set\n");
+    inspect(context, "help", "");
+    printf("quit\n");
+}
+
+static inline void printDebuggerInfo(debuggerType *debugger) {
+    printf("breakpoints:");
+    for (int i = 0; i < NUMMEMORY; i++) {
+        if (debugger->breakpoints[i]) {
+            printf(" %d", i);
+        }
+    }
+    printf("\nwatchpoints:");
+    for (int i = 0; i < NUMMEMORY; i++) {
+        if (debugger->watchpoints[i]) {
+            printf(" %d", i);
+        }
+    }
+    printf("\n");
+    if (debugger->stopCount >= 0) {
+        printf("until %lld %s\n", debugger->stopCount, debugger->countName);
+    }
+    for (int i = 0; i < debugger->numOfConditions; i++) {
+        conditionType *condition = &debugger->conditions[i];
+        const char *op = condition->op == '=' ? "==" : condition->op == '!' ? "!=" : condition->op == '<' ? "<" : ">";
+        printf("cond reg[ %d ] %s %d\n", condition->reg, op, condition->value);
+    }
+}
+
+static inline void addCondition(debuggerType *debugger, const char *argument) {
+    conditionType condition;
+    char op[3];
+
+    if (sscanf(argument, "%d %2s %d", &condition.reg, op, &condition.value) != 3 || condition.reg < 0
+        || condition.reg >= NUMREGS || (strcmp(op, "==") != 0 && strcmp(op, "!=") != 0 && strcmp(op, "<") != 0
+                                         && strcmp(op, ">") != 0)) {
+        printf("usage: cond <reg> <==|!=|<|>> <value>\n");
+        return;
+    }
+    if (debugger->numOfConditions == MAXCONDITIONS) {
+        printf("at most %d conditions\n", MAXCONDITIONS);
+        return;
+    }
+
+    condition.op = op[0];
+    condition.wasTrue = isConditionTrue(&condition, debugger->reg);
+    debugger->conditions[debugger->numOfConditions++] = condition;
+}
+
+// Reads a number and checks it's an address; prints usage and returns -1 otherwise.
+static inline int parseAddress(const char *argument, const char *usage) {
+    int address;
+
+    if (sscanf(argument, "%d", &address) != 1 || address < 0 || address >= NUMMEMORY) {
+        printf("usage: %s\n", usage);
+        return -1;
+    }
+    return address;
+}
+
+// ##########################################################################################
+// # Takes commands until one resumes the run. mem reads the array the simulator loads and  #
+// # stores through (in lrucache that's memory behind the cache, so see "cache" for a dirty #
+// # copy). Anything else goes to the simulator's inspect function. Quitting, or running    #
+// # out of input, ends the program there.                                                  #
+// ##########################################################################################
+
+static inline void runDebuggerPrompt(debuggerType *debugger, inspectFunction inspect, void *context) {
+    char line[1000], command[32];
+    int *reg = debugger->reg, *mem = debugger->mem;
+
+    debugger->stepsLeft = 0; // a stop part way through a step ends it
+
+    printf("stopped at pc %d after %d %s\n", *debugger->pc, *debugger->count, debugger->countName);
+
+    while (1) {
+        printf("(debug) ");
+        fflush(stdout);
+        if (fgets(line, sizeof(line), stdin) == NULL) {
+            printf("\n");
+            exit(0);
+        }
+
+        int length = 0;
+        if (sscanf(line, "%31s %n", command, &length) != 1) {
+            continue;
+        }
+        const char *argument = line + length;
+        int address, number;
+
+        // rs and rc are short for rstep and rcontinue, as s and c are for step and continue
+        if (strcmp(command, "rs") == 0 || strcmp(command, "rc") == 0) {
+            strcpy(command, command[1] == 's' ? "rstep" : "rcontinue");
+        }
+
+        if (strcmp(command, "continue") == 0 || strcmp(command, "c") == 0) {
+            return;
+        } else if (strcmp(command, "step") == 0 || strcmp(command, "s") == 0) {
+            debugger->stepsLeft = sscanf(argument, "%d", &number) == 1 && number > 0 ? number : 1;
+            return;
+        } else if ((strcmp(command, "rstep") == 0 || strcmp(command, "rcontinue") == 0) && debugger->history == NULL) {
+            printf("no history to go back through\n");
+        } else if (strcmp(command, "rstep") == 0) {
+            int target = *debugger->count - (sscanf(argument, "%d", &number) == 1 && number > 0 ? number : 1);
+
+            if (target < getOldestCount(debugger->history)) {
+                printf("the history only goes back to %d %s\n", getOldestCount(debugger->history),
+                       debugger->countName);
+            } else if (!goBackTo(debugger, target)) {
+                return;
+            } else {
+                printf("stopped at pc %d after %d %s\n", *debugger->pc, *debugger->count, debugger->countName);
+            }
+        } else if (strcmp(command, "rcontinue") == 0) {
+            if (*debugger->count == getOldestCount(debugger->history)) {
+                printf("the history only goes back to %d %s\n", *debugger->count, debugger->countName);
+                continue;
+            }
+            debugger->isSearching = 1;
+            debugger->searchFound = -1;
+            debugger->replayTo = *debugger->count;
+            debugger->searchStart = rewindToCheckpoint(debugger->history, *debugger->count - 1);
+            resetConditions(debugger);
+            return;
+        } else if (strcmp(command, "break") == 0 || strcmp(command, "delete") == 0) {
+            if ((address = parseAddress(argument, "break|delete <pc>")) >= 0) {
+                debugger->breakpoints[address] = command[0] == 'b';
+            }
+        } else if (strcmp(command, "watch") == 0 || strcmp(command, "unwatch") == 0) {
+            if ((address = parseAddress(argument, "watch|unwatch <address>")) >= 0) {
+                debugger->watchpoints[address] = command[0] == 'w';
+            }
+        } else if (strcmp(command, "until") == 0) {
+            long long stopCount;
+            if (sscanf(argument, "%lld", &stopCount) == 1 && stopCount > *debugger->count) {
+                debugger->stopCount = stopCount;
+            } else {
+                printf("usage: until <n>, past %d\n", *debugger->count);
+            }
+        } else if (strcmp(command, "cond") == 0) {
+            addCondition(debugger, argument);
+        } else if (strcmp(command, "uncond") == 0) {
+            debugger->numOfConditions = 0;
+        } else if (strcmp(command, "regs") == 0) {
+            for (int i = 0; i < NUMREGS; i++) {
+                printf("\t\treg[ %d ] %d\n", i, reg[i]);
+            }
+        } else if (strcmp(command, "mem") == 0) {
+            if ((address = parseAddress(argument, "mem <address> [n]")) >= 0) {
+                if (sscanf(argument, "%*d %d", &number) != 1 || number < 1) {
+                    number = 1;
+                }
+                for (int i = address; i < address + number && i < NUMMEMORY; i++) {
+                    printf("\t\tmem[ %d ] %d\n", i, mem[i]);
+                }
+            }
+        } else if (strcmp(command, "info") == 0) {
+            printDebuggerInfo(debugger);
+        } else if (strcmp(command, "quit") == 0 || strcmp(command, "q") == 0) {
+            exit(0);
+        } else if (strcmp(command, "help") == 0) {
+            printDebuggerHelp(inspect, context);
+        } else if (!inspect(context, command, argument)) {
+            printf("unknown command %s (try help)\n", command);
+        }
+    }
+}
+
+#endif
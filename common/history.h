@@ -0,0 +1,270 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ##########################################################################################
+// # What -debug keeps so it can run backwards. Every interval steps it takes a checkpoint: #
+// # the pc, the registers and whatever else the simulator hands it (the pipeline's         #
+// # latches). Between checkpoints each step logs the old value of the pc, register and     #
+// # memory word it's about to overwrite. When the next checkpoint comes, the pages those   #
+// # stores touched are copied and the log undone onto the copies, which leaves the pages   #
+// # as they were at the last checkpoint, and the log starts over. So a store costs a log   #
+// # entry, and going back means restoring pages checkpoint by checkpoint and replaying at  #
+// # most one interval, or with no extra state, just popping the log. Once the pages take   #
+// # more than the budget the oldest checkpoints go. Include after NUMMEMORY and NUMREGS.   #
+// ##########################################################################################
+
+#define HISTORYPAGESIZE 256 /* words per page the checkpoints copy */
+#define NUMHISTORYPAGES (NUMMEMORY / HISTORYPAGESIZE)
+#define UNDOPC (-1 - NUMREGS) /* the index of a pc entry; registers are -1 - reg, memory is the address */
+
+typedef struct undoStruct {
+    int count;                // the step that made the write
+    int index;
+    int oldValue;
+} undoType;
+
+typedef struct checkpointStruct {
+    int count;
+    int pc;
+    int reg[NUMREGS];
+    char *extra;
+    int numOfPages;           // pages stored between this checkpoint and the next, as they were at this one
+    int *pageNumbers;
+    int *pages;
+} checkpointType;
+
+typedef struct historyStruct {
+    int interval;
+    long long budget;         // bytes of checkpoints to keep
+    long long bytes;
+    int *pc;
+    int *count;
+    int *reg;
+    int *mem;
+    void *extra;              // the simulator's own state, restored with the checkpoint
+    int extraSize;
+    checkpointType *checkpoints;
+    int numOfCheckpoints;
+    int maxCheckpoints;
+    undoType *log;
+    int logLength;
+    int logCapacity;
+    int pageSlots[NUMHISTORYPAGES]; // 1 + where the page is in dirtyPages, or 0 while it's untouched
+    int dirtyPages[NUMHISTORYPAGES];
+    int numOfDirtyPages;
+} historyType;
+
+static inline void initializeHistory(historyType *history, int interval, int kilobytes, int *pc, int *count, int *reg,
+                                     int *mem, void *extra, int extraSize) {
+    history->interval = interval;
+    history->budget = (long long) kilobytes * 1024;
+    history->bytes = 0;
+    history->pc = pc;
+    history->count = count;
+    history->reg = reg;
+    history->mem = mem;
+    history->extra = extra;
+    history->extraSize = extraSize;
+    history->numOfCheckpoints = 0;
+    history->maxCheckpoints = 16;
+    history->checkpoints = (checkpointType *) malloc(history->maxCheckpoints * sizeof(checkpointType));
+    history->logLength = 0;
+    history->logCapacity = 3 * interval;
+    history->log = (undoType *) malloc(history->logCapacity * sizeof(undoType));
+    memset(history->pageSlots, 0, sizeof(history->pageSlots));
+    history->numOfDirtyPages = 0;
+}
+
+static inline checkpointType *getLatestCheckpoint(historyType *history) {
+    return &history->checkpoints[history->numOfCheckpoints - 1];
+}
+
+static inline void addUndo(historyType *history, int index, int oldValue) {
+    if (history->logLength == history->logCapacity) {
+        history->logCapacity *= 2;
+        history->log = (undoType *) realloc(history->log, history->logCapacity * sizeof(undoType));
+    }
+
+    undoType *undo = &history->log[history->logLength++];
+    undo->count = *history->count;
+    undo->index = index;
+    undo->oldValue = oldValue;
+}
+
+static inline void recordPc(historyType *history) {
+    addUndo(history, UNDOPC, *history->pc);
+}
+
+static inline void recordRegister(historyType *history, int reg) {
+    addUndo(history, -1 - reg, history->reg[reg]);
+}
+
+static inline void recordMemory(historyType *history, int address) {
+    if (address < 0 || address >= NUMMEMORY) {
+        return;
+    }
+
+    int page = address / HISTORYPAGESIZE;
+    if (history->pageSlots[page] == 0) {
+        history->dirtyPages[history->numOfDirtyPages++] = page;
+        history->pageSlots[page] = history->numOfDirtyPages;
+    }
+    addUndo(history, address, history->mem[address]);
+}
+
+static inline void freeCheckpoint(historyType *history, checkpointType *checkpoint) {
+    history->bytes -= (long long) checkpoint->numOfPages * HISTORYPAGESIZE * sizeof(int) + history->extraSize;
+    free(checkpoint->extra);
+    free(checkpoint->pageNumbers);
+    free(checkpoint->pages);
+}
+
+// Copies the pages stored since the latest checkpoint into it, as they were then, and starts the log over.
+static inline void sealCheckpoint(historyType *history) {
+    checkpointType *latest = getLatestCheckpoint(history);
+    int numOfPages = history->numOfDirtyPages;
+
+    latest->numOfPages = numOfPages;
+    latest->pageNumbers = (int *) malloc(numOfPages * sizeof(int));
+    latest->pages = (int *) malloc((size_t) numOfPages * HISTORYPAGESIZE * sizeof(int));
+
+    for (int i = 0; i < numOfPages; i++) {
+        latest->pageNumbers[i] = history->dirtyPages[i];
+        memcpy(latest->pages + i * HISTORYPAGESIZE, history->mem + history->dirtyPages[i] * HISTORYPAGESIZE,
+               HISTORYPAGESIZE * sizeof(int));
+    }
+    for (int i = history->logLength - 1; i >= 0; i--) {
+        undoType *undo = &history->log[i];
+        if (undo->index >= 0) {
+            int slot = history->pageSlots[undo->index / HISTORYPAGESIZE] - 1;
+            latest->pages[slot * HISTORYPAGESIZE + undo->index % HISTORYPAGESIZE] = undo->oldValue;
+        }
+    }
+
+    history->bytes += (long long) numOfPages * HISTORYPAGESIZE * sizeof(int);
+    for (int i = 0; i < numOfPages; i++) {
+        history->pageSlots[history->dirtyPages[i]] = 0;
+    }
+    history->numOfDirtyPages = 0;
+    history->logLength = 0;
+}
+
+static inline void takeCheckpoint(historyType *history) {
+    if (history->numOfCheckpoints > 0) {
+        sealCheckpoint(history);
+    }
+
+    // the oldest checkpoints go once they're over budget, but the one being started always stays
+    while (history->numOfCheckpoints > 0 && history->bytes > history->budget) {
+        freeCheckpoint(history, &history->checkpoints[0]);
+        history->numOfCheckpoints--;
+        memmove(history->checkpoints, history->checkpoints + 1, history->numOfCheckpoints * sizeof(checkpointType));
+    }
+
+    if (history->numOfCheckpoints == history->maxCheckpoints) {
+        history->maxCheckpoints *= 2;
+        history->checkpoints = (checkpointType *) realloc(history->checkpoints,
+                                                          history->maxCheckpoints * sizeof(checkpointType));
+    }
+
+    checkpointType *checkpoint = &history->checkpoints[history->numOfCheckpoints++];
+    checkpoint->count = *history->count;
+    checkpoint->pc = *history->pc;
+    memcpy(checkpoint->reg, history->reg, sizeof(checkpoint->reg));
+    checkpoint->extra = NULL;
+    if (history->extraSize > 0) {
+        checkpoint->extra = (char *) malloc(history->extraSize);
+        memcpy(checkpoint->extra, history->extra, history->extraSize);
+    }
+    checkpoint->numOfPages = 0;
+    checkpoint->pageNumbers = NULL;
+    checkpoint->pages = NULL;
+    history->bytes += history->extraSize;
+}
+
+// Called at the start of every step, before anything is recorded.
+static inline void keepHistory(historyType *history) {
+    if (history->numOfCheckpoints == 0 || *history->count >= getLatestCheckpoint(history)->count + history->interval) {
+        takeCheckpoint(history);
+    }
+}
+
+// Undoes the writes logged by step target and everything after it.
+static inline void undoLog(historyType *history, int target) {
+    while (history->logLength > 0 && history->log[history->logLength - 1].count >= target) {
+        undoType *undo = &history->log[--history->logLength];
+
+        if (undo->index >= 0) {
+            history->mem[undo->index] = undo->oldValue;
+        } else if (undo->index == UNDOPC) {
+            *history->pc = undo->oldValue;
+        } else {
+            history->reg[-1 - undo->index] = undo->oldValue;
+        }
+    }
+}
+
+static inline int getOldestCount(historyType *history) {
+    return history->numOfCheckpoints == 0 ? *history->count : history->checkpoints[0].count;
+}
+
+// Goes back to the last checkpoint at or before target and returns its count, or -1 when that's gone.
+static inline int rewindToCheckpoint(historyType *history, int target) {
+    if (history->numOfCheckpoints == 0 || target < getOldestCount(history)) {
+        return -1;
+    }
+
+    undoLog(history, getLatestCheckpoint(history)->count);
+    for (int i = 0; i < history->numOfDirtyPages; i++) {
+        history->pageSlots[history->dirtyPages[i]] = 0;
+    }
+    history->numOfDirtyPages = 0;
+    history->logLength = 0;
+
+    while (getLatestCheckpoint(history)->count > target) {
+        freeCheckpoint(history, getLatestCheckpoint(history));
+        history->numOfCheckpoints--;
+
+        checkpointType *latest = getLatestCheckpoint(history);
+        for (int i = 0; i < latest->numOfPages; i++) {
+            memcpy(history->mem + latest->pageNumbers[i] * HISTORYPAGESIZE, latest->pages + i * HISTORYPAGESIZE,
+                   HISTORYPAGESIZE * sizeof(int));
+        }
+        history->bytes -= (long long) latest->numOfPages * HISTORYPAGESIZE * sizeof(int);
+        free(latest->pageNumbers);
+        free(latest->pages);
+        latest->numOfPages = 0;
+        latest->pageNumbers = NULL;
+        latest->pages = NULL;
+    }
+
+    checkpointType *latest = getLatestCheckpoint(history);
+    *history->count = latest->count;
+    *history->pc = latest->pc;
+    memcpy(history->reg, latest->reg, sizeof(latest->reg));
+    if (history->extraSize > 0) {
+        memcpy(history->extra, latest->extra, history->extraSize);
+    }
+    return latest->count;
+}
+
+// ##########################################################################################
+// # Goes back as close to target as it can without running anything and returns where it   #
+// # got to; the caller replays the rest. With no extra state and target since the latest   #
+// # checkpoint, popping the log lands right on it.                                         #
+// ##########################################################################################
+
+static inline int rewindHistory(historyType *history, int target) {
+    if (history->extraSize == 0 && history->numOfCheckpoints > 0 && target >= getLatestCheckpoint(history)->count) {
+        undoLog(history, target);
+        *history->count = target;
+        return target;
+    }
+    return rewindToCheckpoint(history, target);
+}
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef ISA_H
+#define ISA_H
+
+// ##########################################################################################
+// # The LC-2K instruction set, described once for all three simulators. Every instruction #
+// # is a 32-bit word: the opcode in bits 24-22, regA in 21-19 and regB in 18-16, then the  #
+// # destination register in bits 2-0 (add, nand) or a 16-bit offset (lw, sw, beq). The    #
+// # table below says, per opcode, how it's printed, which of regA and regB it reads, and   #
+// # which register it writes, so decoding, hazard checks and disassembly are all lookups.  #
+// # It compiles as C too (proj1), where the constexprs become static inlines.              #
+// ##########################################################################################
+
+#ifdef __cplusplus
+#define ISA_FUNCTION constexpr
+#define ISA_TABLE constexpr
+#else
+#define ISA_FUNCTION static inline
+#define ISA_TABLE static const
+#endif
+
+enum {
+    ADD = 0, NAND = 1, LW = 2, SW = 3, BEQ = 4, JALR = 5, HALT = 6, NOOP = 7
+};
+
+#define ISADATA 8 /* what a word that isn't an instruction decodes to */
+
+// The bits read.
+#define READSREGA 1
+#define READSREGB 2
+
+// The field naming the register written, if any.
+enum {
+    writesNothing, writesDestination, writesRegB
+};
+
+typedef struct isaFieldStruct {
+    int shift;
+    int mask;
+} isaFieldStruct;
+
+typedef struct isaInstructionStruct {
+    const char *name;
+    int reads;
+    int writes;
+} isaInstructionStruct;
+
+ISA_TABLE isaFieldStruct isaOpCodeField = {22, 0x7};
+ISA_TABLE isaFieldStruct isaRegAField = {19, 0x7};
+ISA_TABLE isaFieldStruct isaRegBField = {16, 0x7};
+ISA_TABLE isaFieldStruct isaDestinationField = {0, 0x7};
+ISA_TABLE isaFieldStruct isaOffsetField = {0, 0xFFFF};
+
+ISA_TABLE isaInstructionStruct isaInstructions[ISADATA + 1] = {
+    {"add", READSREGA | READSREGB, writesDestination},
+    {"nand", READSREGA | READSREGB, writesDestination},
+    {"lw", READSREGA, writesRegB},
+    {"sw", READSREGA | READSREGB, writesNothing},
+    {"beq", READSREGA | READSREGB, writesNothing},
+    {"jalr", READSREGA, writesRegB},
+    {"halt", 0, writesNothing},
+    {"noop", 0, writesNothing},
+    {"data", 0, writesNothing}
+};
+
+ISA_FUNCTION int isaGetField(int word, isaFieldStruct field) {
+    return (word >> field.shift) & field.mask;
+}
+
+ISA_FUNCTION int isaOpCode(int word) {
+    return isaGetField(word, isaOpCodeField);
+}
+
+ISA_FUNCTION int isaRegA(int word) {
+    return isaGetField(word, isaRegAField);
+}
+
+ISA_FUNCTION int isaRegB(int word) {
+    return isaGetField(word, isaRegBField);
+}
+
+ISA_FUNCTION int isaDestination(int word) {
+    return isaGetField(word, isaDestinationField);
+}
+
+ISA_FUNCTION int isaOffset(int word) {
+    return isaGetField(word, isaOffsetField);
+}
+
+// Only words with nothing above the opcode are instructions; anything else is data (or garbage).
+ISA_FUNCTION int isaIsInstruction(int word) {
+    return word >= 0 && (word >> isaOpCodeField.shift) <= isaOpCodeField.mask;
+}
+
+// The opcode, or ISADATA for a word that isn't an instruction: the index into isaInstructions.
+ISA_FUNCTION int isaDecode(int word) {
+    return isaIsInstruction(word) ? isaOpCode(word) : ISADATA;
+}
+
+ISA_FUNCTION const char *isaName(int word) {
+    return isaInstructions[isaDecode(word)].name;
+}
+
+ISA_FUNCTION int isaReadsRegister(int word, int reg) {
+    return ((isaInstructions[isaDecode(word)].reads & READSREGA) != 0 && isaRegA(word) == reg)
+           || ((isaInstructions[isaDecode(word)].reads & READSREGB) != 0 && isaRegB(word) == reg);
+}
+
+// The register the instruction writes, or -1.
+ISA_FUNCTION int isaWrittenRegister(int word) {
+    return isaInstructions[isaDecode(word)].writes == writesDestination ? isaDestination(word)
+           : isaInstructions[isaDecode(word)].writes == writesRegB ? isaRegB(word) : -1;
+}
+
+// field is the destination register for add and nand, and the offset for everything else.
+ISA_FUNCTION int isaEncode(int opCode, int regA, int regB, int field) {
+    return (opCode << isaOpCodeField.shift) | (regA << isaRegAField.shift) | (regB << isaRegBField.shift)
+           | (field & isaOffsetField.mask);
+}
+
+#ifdef __cplusplus
+static_assert(isaDecode(isaEncode(LW, 1, 2, -1)) == LW && isaOffset(isaEncode(LW, 1, 2, -1)) == 0xFFFF,
+              "isaEncode and the decoders disagree");
+static_assert(isaWrittenRegister(isaEncode(ADD, 1, 2, 3)) == 3 && isaReadsRegister(isaEncode(SW, 4, 5, 0), 5),
+              "the operand table is off");
+#endif
+
+#endif
@@ -0,0 +1,363 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ##########################################################################################
+// # The -profile mode all three simulators share. The simulator hands over every           #
+// # instruction as it retires, with its weight: 1 in the functional simulators, or the     #
+// # cycles it cost in the pipeline and with -timing. That's counted per pc, and per basic  #
+// # block: a block starts at a beq's target, after a beq or jalr, and wherever execution   #
+// # didn't just fall through from the instruction before. Its weight is only added up when #
+// # it's left, so an instruction costs a couple of array updates. A jalr whose target is   #
+// # the return address of a frame on the stack returns to it; any other jalr calls its     #
+// # target, which stays pushed until something returns past it. Each distinct stack is a   #
+// # node in a tree, so what's written out per stack and block is one hash lookup per       #
+// # block, and the folded-stack file ("func_0;func_12;block_40 <weight>" per line) goes    #
+// # straight into flamegraph.pl. Include after NUMMEMORY and common/isa.h.                 #
+// ##########################################################################################
+
+#define MAXCALLDEPTH 1024 /* deeper calls are charged to the deepest frame kept */
+#define PROFILETOP 10 /* pcs and blocks the summary lists */
+
+// Open addressing from a 64-bit key to a count, for stacks (parent, function) and their blocks (node, leader).
+typedef struct profileMapStruct {
+    long long *keys;          // -1 when the slot is empty
+    long long *values;
+    int capacity;
+    int size;
+} profileMapType;
+
+typedef struct profileStruct {
+    const char *weightName;   // "instructions" or "cycles"
+    long long *executions;    // per pc
+    long long *stallCycles;
+    long long *misses;
+    long long *blockEntries;  // per block, by its first pc
+    long long *blockWeights;
+    char *isLeader;           // beq targets, found before the run, where a block starts even when fallen into
+    int hasStalls;
+    int hasMisses;
+    int nextPc;               // where execution stays in the same block, or -1 after a beq or jalr
+    int leader;               // the current block's first pc
+    long long pending;        // the weight of the current block so far
+    long long total;
+    int *parents;             // the stack tree; node 0 is the program's entry
+    int *functions;
+    int numOfNodes;
+    int maxNodes;
+    profileMapType children;
+    profileMapType stackBlocks;
+    int stack[MAXCALLDEPTH];  // the node of each frame
+    int returnPcs[MAXCALLDEPTH]; // where each frame returns to; the entry's is -1
+    int depth;
+    int deepest;
+    long long numOfTruncatedCalls;
+} profileType;
+
+static inline void initializeProfileMap(profileMapType *map) {
+    map->capacity = 1024;
+    map->size = 0;
+    map->keys = (long long *) malloc(map->capacity * sizeof(long long));
+    map->values = (long long *) calloc(map->capacity, sizeof(long long));
+    memset(map->keys, -1, map->capacity * sizeof(long long));
+}
+
+static inline int getProfileSlot(profileMapType *map, long long key) {
+    unsigned long long hash = (unsigned long long) key * 0x9E3779B97F4A7C15ULL;
+    int slot = (int) (hash >> 40) & (map->capacity - 1);
+
+    while (map->keys[slot] != -1 && map->keys[slot] != key) {
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    return slot;
+}
+
+// The count for key, added as 0 if it isn't there yet. The table doubles once it's half full.
+static inline long long *findProfileEntry(profileMapType *map, long long key) {
+    int slot = getProfileSlot(map, key);
+
+    if (map->keys[slot] == -1) {
+        if (2 * (map->size + 1) > map->capacity) {
+            long long *oldKeys = map->keys, *oldValues = map->values;
+            int oldCapacity = map->capacity;
+
+            map->capacity *= 2;
+            map->keys = (long long *) malloc(map->capacity * sizeof(long long));
+            map->values = (long long *) calloc(map->capacity, sizeof(long long));
+            memset(map->keys, -1, map->capacity * sizeof(long long));
+            for (int i = 0; i < oldCapacity; i++) {
+                if (oldKeys[i] != -1) {
+                    int newSlot = getProfileSlot(map, oldKeys[i]);
+                    map->keys[newSlot] = oldKeys[i];
+                    map->values[newSlot] = oldValues[i];
+                }
+            }
+            free(oldKeys);
+            free(oldValues);
+            slot = getProfileSlot(map, key);
+        }
+        map->keys[slot] = key;
+        map->size++;
+    }
+    return &map->values[slot];
+}
+
+static inline void initializeProfile(profileType *profile, const char *weightName, int *mem, int entryPc) {
+    profile->weightName = weightName;
+    profile->executions = (long long *) calloc(NUMMEMORY, sizeof(long long));
+    profile->stallCycles = (long long *) calloc(NUMMEMORY, sizeof(long long));
+    profile->misses = (long long *) calloc(NUMMEMORY, sizeof(long long));
+    profile->blockEntries = (long long *) calloc(NUMMEMORY, sizeof(long long));
+    profile->blockWeights = (long long *) calloc(NUMMEMORY, sizeof(long long));
+    profile->isLeader = (char *) calloc(NUMMEMORY + 1, 1);
+    for (int pc = 0; pc < NUMMEMORY; pc++) {
+        int target = pc + 1 + (short) isaOffset(mem[pc]);
+        if (isaIsInstruction(mem[pc]) && isaOpCode(mem[pc]) == BEQ && target >= 0 && target < NUMMEMORY) {
+            profile->isLeader[target] = 1;
+        }
+    }
+    profile->hasStalls = 0;
+    profile->hasMisses = 0;
+    profile->nextPc = -1;
+    profile->leader = entryPc;
+    profile->pending = 0;
+    profile->total = 0;
+    profile->maxNodes = 64;
+    profile->parents = (int *) malloc(profile->maxNodes * sizeof(int));
+    profile->functions = (int *) malloc(profile->maxNodes * sizeof(int));
+    profile->parents[0] = -1;
+    profile->functions[0] = entryPc;
+    profile->numOfNodes = 1;
+    initializeProfileMap(&profile->children);
+    initializeProfileMap(&profile->stackBlocks);
+    profile->stack[0] = 0;
+    profile->returnPcs[0] = -1;
+    profile->depth = 1;
+    profile->deepest = 1;
+    profile->numOfTruncatedCalls = 0;
+}
+
+static inline long long getProfileKey(int high, int low) {
+    return ((long long) high << 32) | (unsigned int) low;
+}
+
+// Charges the block being left to the stack it ran on.
+static inline void closeProfileBlock(profileType *profile) {
+    if (profile->pending > 0) {
+        profile->blockWeights[profile->leader] += profile->pending;
+        *findProfileEntry(&profile->stackBlocks, getProfileKey(profile->stack[profile->depth - 1], profile->leader))
+            += profile->pending;
+        profile->pending = 0;
+    }
+}
+
+// Called as each instruction retires, in program order.
+static inline void profileInstruction(profileType *profile, int pc, int instruction, long long weight) {
+    if ((unsigned int) pc >= NUMMEMORY) {
+        return;
+    }
+
+    if (pc != profile->nextPc) {
+        closeProfileBlock(profile);
+        profile->leader = pc;
+        profile->blockEntries[pc]++;
+    }
+
+    int opCode = isaOpCode(instruction);
+    profile->nextPc = opCode == BEQ || opCode == JALR || profile->isLeader[pc + 1] ? -1 : pc + 1;
+    profile->executions[pc]++;
+    profile->pending += weight;
+    profile->total += weight;
+}
+
+static inline void profileStalls(profileType *profile, int pc, long long cycles) {
+    if ((unsigned int) pc < NUMMEMORY && cycles > 0) {
+        profile->stallCycles[pc] += cycles;
+        profile->hasStalls = 1;
+    }
+}
+
+static inline void profileMisses(profileType *profile, int pc, long long misses) {
+    if ((unsigned int) pc < NUMMEMORY && misses > 0) {
+        profile->misses[pc] += misses;
+        profile->hasMisses = 1;
+    }
+}
+
+// After a jalr at pc that went to target: a return if target is where a frame returns to, otherwise a call.
+static inline void profileJump(profileType *profile, int pc, int target) {
+    closeProfileBlock(profile);
+
+    for (int frame = profile->depth - 1; frame > 0; frame--) {
+        if (profile->returnPcs[frame] == target) {
+            profile->depth = frame;
+            return;
+        }
+    }
+
+    if (profile->depth == MAXCALLDEPTH) {
+        profile->numOfTruncatedCalls++;
+        return;
+    }
+
+    int parent = profile->stack[profile->depth - 1];
+    long long *child = findProfileEntry(&profile->children, getProfileKey(parent, target));
+
+    if (*child == 0) {
+        if (profile->numOfNodes == profile->maxNodes) {
+            profile->maxNodes *= 2;
+            profile->parents = (int *) realloc(profile->parents, profile->maxNodes * sizeof(int));
+            profile->functions = (int *) realloc(profile->functions, profile->maxNodes * sizeof(int));
+        }
+        profile->parents[profile->numOfNodes] = parent;
+        profile->functions[profile->numOfNodes] = target;
+        *child = ++profile->numOfNodes; // 1 + the node, since 0 means it isn't there yet
+    }
+
+    profile->stack[profile->depth] = (int) *child - 1;
+    profile->returnPcs[profile->depth] = pc + 1;
+    profile->depth++;
+    if (profile->depth > profile->deepest) {
+        profile->deepest = profile->depth;
+    }
+}
+
+static inline void writeProfileFrames(FILE *filePtr, profileType *profile, int node) {
+    if (profile->parents[node] >= 0) {
+        writeProfileFrames(filePtr, profile, profile->parents[node]);
+        fputc(';', filePtr);
+    }
+    fprintf(filePtr, "func_%d", profile->functions[node]);
+}
+
+// The folded stacks, heaviest first.
+static inline void writeProfile(profileType *profile, const char *fileName) {
+    profileMapType *map = &profile->stackBlocks;
+    FILE *filePtr = fopen(fileName, "w");
+
+    if (filePtr == NULL) {
+        printf("error: can't open file %s", fileName);
+        perror("fopen");
+        exit(1);
+    }
+
+    closeProfileBlock(profile);
+
+    int *order = (int *) malloc(map->size * sizeof(int));
+    int numOfEntries = 0;
+
+    for (int i = 0; i < map->capacity; i++) {
+        if (map->keys[i] != -1) {
+            int position = numOfEntries++;
+            while (position > 0 && map->values[order[position - 1]] < map->values[i]) {
+                order[position] = order[position - 1];
+                position--;
+            }
+            order[position] = i;
+        }
+    }
+
+    for (int i = 0; i < numOfEntries; i++) {
+        long long key = map->keys[order[i]];
+        writeProfileFrames(filePtr, profile, (int) (key >> 32));
+        fprintf(filePtr, ";block_%d %lld\n", (int) (key & 0xFFFFFFFF), map->values[order[i]]);
+    }
+
+    free(order);
+    fclose(filePtr);
+}
+
+// Keeps the PROFILETOP largest counts' indices in top, largest first; returns how many there are.
+static inline int findProfileTop(long long *counts, int top[PROFILETOP]) {
+    int numOfTop = 0;
+
+    for (int i = 0; i < NUMMEMORY; i++) {
+        if (counts[i] == 0 || (numOfTop == PROFILETOP && counts[i] <= counts[top[PROFILETOP - 1]])) {
+            continue;
+        }
+
+        int position = numOfTop < PROFILETOP ? numOfTop++ : PROFILETOP - 1;
+        while (position > 0 && counts[top[position - 1]] < counts[i]) {
+            top[position] = top[position - 1];
+            position--;
+        }
+        top[position] = i;
+    }
+    return numOfTop;
+}
+
+// A block runs from its first pc to the next beq, jalr or halt, or up to the next pc a block starts at.
+static inline int getProfileBlockEnd(profileType *profile, int *mem, int leader) {
+    int end = leader;
+
+    while (end + 1 < NUMMEMORY && profile->blockEntries[end + 1] == 0 && !profile->isLeader[end + 1]) {
+        int opCode = isaOpCode(mem[end]);
+        if (opCode == BEQ || opCode == JALR || opCode == HALT) {
+            break;
+        }
+        end++;
+    }
+    return end;
+}
+
+static inline void printProfile(profileType *profile, int *mem) {
+    int top[PROFILETOP];
+    int numOfTop, numOfBlocks = 0;
+    double total = profile->total > 0 ? (double) profile->total : 1;
+
+    closeProfileBlock(profile);
+
+    for (int i = 0; i < NUMMEMORY; i++) {
+        numOfBlocks += profile->blockEntries[i] > 0;
+    }
+
+    printf("profile: %lld %s in %d basic blocks, %d call stacks, %d frames deep at most\n", profile->total,
+           profile->weightName, numOfBlocks, profile->numOfNodes, profile->deepest);
+    if (profile->numOfTruncatedCalls > 0) {
+        printf("%lld calls past %d frames were charged to the frame below\n", profile->numOfTruncatedCalls,
+               MAXCALLDEPTH);
+    }
+
+    printf("hottest pcs:\n");
+    numOfTop = findProfileTop(profile->executions, top);
+    for (int i = 0; i < numOfTop; i++) {
+        int pc = top[i];
+        printf("\tpc %d %s: executed %lld times", pc, isaName(mem[pc]), profile->executions[pc]);
+        if (profile->hasStalls) {
+            printf(", %lld stall cycles", profile->stallCycles[pc]);
+        }
+        if (profile->hasMisses) {
+            printf(", %lld misses", profile->misses[pc]);
+        }
+        printf("\n");
+    }
+
+    if (profile->hasStalls) {
+        printf("most stall cycles:\n");
+        numOfTop = findProfileTop(profile->stallCycles, top);
+        for (int i = 0; i < numOfTop; i++) {
+            printf("\tpc %d %s: %lld\n", top[i], isaName(mem[top[i]]), profile->stallCycles[top[i]]);
+        }
+    }
+
+    if (profile->hasMisses) {
+        printf("most misses:\n");
+        numOfTop = findProfileTop(profile->misses, top);
+        for (int i = 0; i < numOfTop; i++) {
+            printf("\tpc %d %s: %lld\n", top[i], isaName(mem[top[i]]), profile->misses[top[i]]);
+        }
+    }
+
+    printf("hottest basic blocks:\n");
+    numOfTop = findProfileTop(profile->blockWeights, top);
+    for (int i = 0; i < numOfTop; i++) {
+        printf("\tpcs %d-%d: entered %lld times, %lld %s (%.1f%%)\n", top[i],
+               getProfileBlockEnd(profile, mem, top[i]), profile->blockEntries[top[i]], profile->blockWeights[top[i]],
+               profile->weightName, 100.0 * profile->blockWeights[top[i]] / total);
+    }
+}
+
+#endif
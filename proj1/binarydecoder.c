@@ -1,16 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
-
-// Declaring an enum for easy switch functionality and for re-usability.
-enum {
-    ADD = 0, NAND = 1, LW = 2, SW = 3, BEQ = 4, JALR = 5, HALT = 6, NOOP = 7
-};
+#include <string.h>
+#include "../common/isa.h"
 
 #define NUMMEMORY 65536 /* maximum number of words in memory */
 #define NUMREGS 8 /* number of machine registers */
 #define MAXLINELENGTH 1000
 #define REGZERO 0
 
+#include "../common/debugger.h"
+#include "../common/profiler.h"
+
+#define MAXSEQUENCE 3 /* most instructions fused into one superinstruction */
+#define MAXSUPERS 16 /* most superinstructions -fuse takes from a file */
+
 
 typedef struct stateStruct {
     int pc;
@@ -18,10 +21,35 @@ typedef struct stateStruct {
     int reg[NUMREGS];
     int numMemory;
 } stateType;
+
+// What -sequences counts: how often each run of two or three instructions executed back to back in memory order.
+typedef struct sequenceStruct {
+    long long pairs[8][8];
+    long long triples[8][8][8];
+    int lastPc[2];            // the last two instructions executed, most recent first
+    int lastOpCode[2];
+} sequenceType;
+
+// Superinstructions the loop has its own code for; anything else -fuse is given runs through executeGeneric.
+enum {
+    superGeneric, superUpdate, superCounter, superAnd
+};
+
+typedef struct patternStruct {
+    int length;
+    int opCodes[MAXSEQUENCE];
+    int kind;
+} patternType;
+
+typedef struct fusionStruct {
+    patternType patterns[MAXSUPERS]; // longest first, so the longest match wins
+    int numOfPatterns;
+    signed char starts[NUMMEMORY]; // the pattern the instructions from each address match, or -1
+    char opCodes[NUMMEMORY];  // each word's opcode when starts was last worked out
+} fusionType;
 int convertNum(int num);
 
 void printState(stateType *);
-int getBits(int word, int from, int to);
 
 void clearRegisters(stateType *state);
 
@@ -45,24 +73,96 @@ void nand(stateType *state, int instruction);
 
 void loadWord(stateType *state, int instruction);
 
-void saveWord(stateType *state, int instruction);
+int saveWord(stateType *state, int instruction);
 
-void branchEqual(stateType *state, int instruction);
+void branchEqual(stateType *state, int instruction, int isQuiet);
 
 void jumpAndLink(stateType *state, int instruction);
 
 void printSummary(int numOfInstructions);
 
+int inspectState(void *context, const char *command, const char *argument);
+
+void recordInstruction(historyType *history, stateType *state, int instruction);
+
+int isFusable(int opCode, int isLast);
+
+void recordSequence(sequenceType *sequences, int pc, int opCode);
+
+void writeSequences(sequenceType *sequences, char *fileName);
+
+void initializeFusion(fusionType *fusion, char *fileName);
+
+void addPattern(fusionType *fusion, int length, const int *opCodes);
+
+int getOpCodeByName(const char *name);
+
+void matchPatterns(fusionType *fusion, stateType *state, int from, int to);
+
+void noteFusedStore(fusionType *fusion, stateType *state, int address);
+
+int executeSuper(stateType *state, fusionType *fusion);
+
+int executeGeneric(stateType *state, fusionType *fusion, patternType *pattern);
+
 
 int main(int argc, char *argv[]) {
     char line[MAXLINELENGTH];
     stateType state;
     FILE *filePtr;
 
-    if (argc != 2) {
-        printf("error: usage: %s <machine-code file>\n", argv[0]);
+    // -quiet only prints the summary and the final state, for timing the simulator itself; -debug runs just as
+    // quietly between stops and takes commands from stdin at each one (see common/debugger.h), keeping a history
+    // of checkpoints every <interval> instructions in up to <kilobytes> to step back through. -sequences writes
+    // the runs of instructions executed most often to a file, and -fuse runs those (or the built-in ones) as
+    // superinstructions, just as quietly. -profile writes the folded call stacks to a file and prints the hottest pcs
+    // and basic blocks after the run (see common/profiler.h).
+    int interval, kilobytes;
+    int isQuiet = 0, isDebug = 0;
+    char *sequencesFileName = NULL, *fuseFileName = NULL, *profileFileName = NULL;
+    int isFused = 0;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-quiet") == 0) {
+            isQuiet = 1;
+        } else if (parseDebugOption(argv[i], &interval, &kilobytes)) {
+            isDebug = 1;
+        } else if (strncmp(argv[i], "-sequences=", 11) == 0) {
+            sequencesFileName = argv[i] + 11;
+        } else if (strcmp(argv[i], "-fuse") == 0 || strncmp(argv[i], "-fuse=", 6) == 0) {
+            isFused = 1;
+            fuseFileName = argv[i][5] == '=' ? argv[i] + 6 : NULL;
+        } else if (strncmp(argv[i], "-profile=", 9) == 0) {
+            profileFileName = argv[i] + 9;
+        } else {
+            isDebug = -1;
+        }
+    }
+    if (argc < 2 || isDebug < 0 || (isDebug && (isFused || sequencesFileName != NULL || profileFileName != NULL))
+        || (isFused && (sequencesFileName != NULL || profileFileName != NULL))) {
+        printf("error: usage: %s <machine-code file> [-quiet] [-debug[=<interval>,<kilobytes>] | "
+               "-sequences=<file> | -fuse[=<file>] | -profile=<file>]\n", argv[0]);
         exit(1);
     }
+    isQuiet = isQuiet || isDebug || isFused;
+    int halted = 0, numOfInstructions = 0;
+    debuggerType *debugger = NULL;
+    sequenceType *sequences = NULL;
+    fusionType *fusion = NULL;
+    profileType *profile = NULL;
+
+    if (isDebug) {
+        debugger = malloc(sizeof(debuggerType));
+        initializeDebugger(debugger, "instructions");
+        attachMachine(debugger, &state.pc, &numOfInstructions, state.reg, state.mem);
+        debugger->stepsLeft = 1; // stop before the first instruction
+
+        if (interval > 0) {
+            debugger->history = malloc(sizeof(historyType));
+            initializeHistory(debugger->history, interval, kilobytes, &state.pc, &numOfInstructions, state.reg,
+                              state.mem, NULL, 0);
+        }
+    }
 
     filePtr = fopen(argv[1], "r");
     if (filePtr == NULL) {
@@ -78,19 +178,53 @@ int main(int argc, char *argv[]) {
             printf("error in reading address %d\n", state.numMemory);
             exit(1);
         }
-        printf("memory[%d]=%d\n", state.numMemory, state.mem[state.numMemory]);
+        if (!isQuiet) {
+            printf("memory[%d]=%d\n", state.numMemory, state.mem[state.numMemory]);
+        }
     }
 
     clearRegisters(&state);
 
-    int halted = 0, numOfInstructions = 0;
+    if (sequencesFileName != NULL) {
+        sequences = calloc(1, sizeof(sequenceType));
+        sequences->lastPc[0] = sequences->lastPc[1] = -MAXSEQUENCE;
+    }
+    if (isFused) {
+        fusion = malloc(sizeof(fusionType));
+        initializeFusion(fusion, fuseFileName);
+        matchPatterns(fusion, &state, 0, NUMMEMORY - 1);
+    }
+    if (profileFileName != NULL) {
+        profile = malloc(sizeof(profileType));
+        initializeProfile(profile, "instructions", state.mem, 0);
+    }
 
     while (!halted) {
-        printState(&state);
+        if (!isQuiet) {
+            printState(&state);
+        }
+        if (debugger != NULL && checkDebugger(debugger)) {
+            runDebuggerPrompt(debugger, inspectState, &state);
+        }
+
+        // a superinstruction only starts where its first instruction is; a jump into the middle of one runs
+        // the rest one at a time
+        if (fusion != NULL && fusion->starts[state.pc] >= 0) {
+            numOfInstructions += executeSuper(&state, fusion);
+            continue;
+        }
 
-        int instruction = state.mem[state.pc];
+        int pc = state.pc;
+        int instruction = state.mem[pc];
         int opCode = getOpCode(instruction);
 
+        if (debugger != NULL && debugger->history != NULL) {
+            recordInstruction(debugger->history, &state, instruction);
+        }
+        if (sequences != NULL) {
+            recordSequence(sequences, state.pc, opCode);
+        }
+
         switch (opCode) {
             case ADD:
                 add(&state, instruction);
@@ -101,11 +235,18 @@ int main(int argc, char *argv[]) {
             case LW:
                 loadWord(&state, instruction);
                 break;
-            case SW:
-                saveWord(&state, instruction);
+            case SW: {
+                int address = saveWord(&state, instruction);
+                if (debugger != NULL) {
+                    noteStore(debugger, address);
+                }
+                if (fusion != NULL) {
+                    noteFusedStore(fusion, &state, address);
+                }
                 break;
+            }
             case BEQ:
-                branchEqual(&state, instruction);
+                branchEqual(&state, instruction, isQuiet);
                 break;
             case JALR:
                 jumpAndLink(&state, instruction);
@@ -123,11 +264,27 @@ int main(int argc, char *argv[]) {
 
         state.pc++;
         numOfInstructions++;
+
+        if (profile != NULL) {
+            profileInstruction(profile, pc, instruction, 1);
+            if (opCode == JALR) {
+                profileJump(profile, pc, state.pc);
+            }
+        }
+    }
+
+    if (sequences != NULL) {
+        writeSequences(sequences, sequencesFileName);
     }
 
     printSummary(numOfInstructions);
     printState(&state);
 
+    if (profile != NULL) {
+        writeProfile(profile, profileFileName);
+        printProfile(profile, state.mem);
+    }
+
     return (0);
 }
 void printState(stateType *statePtr) {
@@ -160,21 +317,6 @@ int convertNum(int num) {
 
     return (num);
 }
-// ##########################################################################################
-// # getBits: Used to extract each number and data from the instruction. Word is the 32-bit
-// # instruction that's sent in to the function. From is the first part of the bits that    #
-// # are needed for isolation. Argument "to" is the inclusive ending bit position.          #
-// # For instance:                                                                          #
-// # Operation codes are in bits 24, 23, and 22. From = 22, to = 24.                        #
-// # Register A bits are in 21 to 19. From 21 to 19.                                        #
-// ##########################################################################################
-
-
-int getBits(int word, int from, int to) {
-    int mask = ((1 << (to - from + 1)) - 1) << from;
-    return (word & mask) >> from;
-}
-
 // ##########################################################################################
 // # Simply clears the registers before using them. Without doing so, they'll collect garb -#
 // # -age information that's leftover. So, each position in the array is initialized to 0.  #
@@ -213,22 +355,21 @@ void checkRegister(int reg) {
 }
 
 // ##########################################################################################
-// # The following get* functions grab their respective bit from the instruction that's     #
-// # passed to getBits( ). It will isolate each section of the instruction and return the   #
-// # appropriate integer value for regA, regB, the opcode, the destination register, and    #
-// # the offset.                                                                            #
+// # The following get* functions grab their respective field from the instruction, as laid #
+// # out in common/isa.h, and return the appropriate integer value for regA, regB, the      #
+// # opcode, the destination register, and the offset.                                      #
 // ##########################################################################################
 
 
-int getOpCode(int word) { return getBits(word, 22, 24); }
+int getOpCode(int word) { return isaOpCode(word); }
 
-int getRegA(int word) { return getBits(word, 19, 21); }
+int getRegA(int word) { return isaRegA(word); }
 
-int getRegB(int word) { return getBits(word, 16, 18); }
+int getRegB(int word) { return isaRegB(word); }
 
-int getDestination(int word) { return getBits(word, 0, 2); }
+int getDestination(int word) { return isaDestination(word); }
 
-int getOffset(int word) { return getBits(word, 0, 15); }
+int getOffset(int word) { return isaOffset(word); }
 
 // ##########################################################################################
 // # If the add operation code is called for, it will use the by-reference state of the     #
@@ -285,10 +426,11 @@ void loadWord(stateType *state, int instruction) {
 
 // ##########################################################################################
 // # If the SW operation code is called for, it will use the by-reference state of the      #
-// # computer and save the value of regB into a memory destination of offset + regA.        #
+// # computer and save the value of regB into a memory destination of offset + regA. The    #
+// # address is returned for the debugger's watchpoints.                                    #
 // ##########################################################################################
 
-void saveWord(stateType *state, int instruction) {
+int saveWord(stateType *state, int instruction) {
     int regA, regB, offset = getOffset(instruction);
     offset = convertNum(offset);
 
@@ -300,15 +442,17 @@ void saveWord(stateType *state, int instruction) {
     checkOffset(offset);
 
     state->mem[offset + state->reg[regA]] = state->reg[regB];
+    return offset + state->reg[regA];
 }
 
 // ##########################################################################################
 // # If the add operation code is called for, it will use the by-reference state of the     #
 // # computer and compare the values in regA and regB. If they're equal, it'll branch into  #
-// # the PC of PC + offset (plus 1, but that's incremented regardless in the while).        #
+// # the PC of PC + offset (plus 1, but that's incremented regardless in the while). The    #
+// # values it compared are printed too, unless the run is quiet.                           #
 // ##########################################################################################
 
-void branchEqual(stateType *state, int instruction) {
+void branchEqual(stateType *state, int instruction, int isQuiet) {
     int regA, regB, offset = getOffset(instruction);
     offset = convertNum(offset);
 
@@ -320,11 +464,13 @@ void branchEqual(stateType *state, int instruction) {
     checkOffset(offset);
 
     if (state->reg[regA] == state->reg[regB]) {
-        state->pc += offset;	
-	printf("%d", state->reg[regA]);
-	printf("\n");
-	printf("%d", state->reg[regB]);
-	printf("\n regA and regB are equal!");
+        state->pc += offset;
+        if (!isQuiet) {
+            printf("%d", state->reg[regA]);
+            printf("\n");
+            printf("%d", state->reg[regB]);
+            printf("\n regA and regB are equal!");
+        }
     }
 }
 
@@ -363,3 +509,315 @@ void printSummary(int numOfInstructions) {
 
 
 
+
+// ##########################################################################################
+// # The -debug commands only this simulator has: "state" prints the whole machine the way  #
+// # the trace does.                                                                        #
+// ##########################################################################################
+
+int inspectState(void *context, const char *command, const char *argument) {
+    stateType *state = (stateType *) context;
+
+    if (strcmp(command, "help") == 0) {
+        printf("state                         print the whole machine state\n");
+    } else if (strcmp(command, "state") == 0) {
+        if (argument[0] != '\0') {
+            printf("usage: state\n");
+        } else {
+            printState(state);
+        }
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// ##########################################################################################
+// # Logs what the instruction is about to overwrite for -debug's history: the pc always,   #
+// # the register it writes, and the word a sw stores to.                                   #
+// ##########################################################################################
+
+void recordInstruction(historyType *history, stateType *state, int instruction) {
+    int writtenRegister = isaWrittenRegister(instruction);
+
+    keepHistory(history);
+    recordPc(history);
+
+    if (writtenRegister >= 0) {
+        recordRegister(history, writtenRegister);
+    }
+    if (getOpCode(instruction) == SW) {
+        recordMemory(history, state->reg[getRegA(instruction)] + convertNum(getOffset(instruction)));
+    }
+}
+
+// ##########################################################################################
+// # Superinstructions: runs of two or three instructions executed with one trip through    #
+// # the loop instead of one each. Anything but a branch, jalr or halt can start or         #
+// # continue one, and a beq can end one, since a taken branch leaves the run anyway.       #
+// ##########################################################################################
+
+int isFusable(int opCode, int isLast) {
+    return opCode == ADD || opCode == NAND || opCode == LW || opCode == SW || opCode == NOOP
+           || (isLast && opCode == BEQ);
+}
+
+// Counts the runs the instruction at pc ends, when the ones before it were executed right before it.
+void recordSequence(sequenceType *sequences, int pc, int opCode) {
+    if (sequences->lastPc[0] == pc - 1 && isFusable(sequences->lastOpCode[0], 0) && isFusable(opCode, 1)) {
+        sequences->pairs[sequences->lastOpCode[0]][opCode]++;
+
+        if (sequences->lastPc[1] == pc - 2 && isFusable(sequences->lastOpCode[1], 0)) {
+            sequences->triples[sequences->lastOpCode[1]][sequences->lastOpCode[0]][opCode]++;
+        }
+    }
+
+    sequences->lastPc[1] = sequences->lastPc[0];
+    sequences->lastOpCode[1] = sequences->lastOpCode[0];
+    sequences->lastPc[0] = pc;
+    sequences->lastOpCode[0] = opCode;
+}
+
+// ##########################################################################################
+// # Writes every run that was counted as "<count> <name> <name> [<name>]", most frequent   #
+// # first, which is what -fuse=<file> reads back.                                          #
+// ##########################################################################################
+
+void writeSequences(sequenceType *sequences, char *fileName) {
+    FILE *filePtr = fopen(fileName, "w");
+    long long *counts[8 * 8 + 8 * 8 * 8];
+    int numOfRuns = 0;
+
+    if (filePtr == NULL) {
+        printf("error: can't open file %s", fileName);
+        perror("fopen");
+        exit(1);
+    }
+
+    for (int i = 0; i < 8 * 8; i++) {
+        if (((long long *) sequences->pairs)[i] > 0) {
+            counts[numOfRuns++] = (long long *) sequences->pairs + i;
+        }
+    }
+    for (int i = 0; i < 8 * 8 * 8; i++) {
+        if (((long long *) sequences->triples)[i] > 0) {
+            counts[numOfRuns++] = (long long *) sequences->triples + i;
+        }
+    }
+
+    // there are few enough of them for a selection sort
+    for (int i = 0; i < numOfRuns; i++) {
+        int most = i;
+        for (int j = i + 1; j < numOfRuns; j++) {
+            if (*counts[j] > *counts[most]) {
+                most = j;
+            }
+        }
+        long long *count = counts[i];
+        counts[i] = counts[most];
+        counts[most] = count;
+
+        int index = (int) (counts[i] - (long long *) sequences->pairs);
+        fprintf(filePtr, "%lld", *counts[i]);
+        if (index < 8 * 8) {
+            fprintf(filePtr, " %s %s\n", isaInstructions[index / 8].name, isaInstructions[index % 8].name);
+        } else {
+            index = (int) (counts[i] - (long long *) sequences->triples);
+            fprintf(filePtr, " %s %s %s\n", isaInstructions[index / 64].name, isaInstructions[index / 8 % 8].name,
+                    isaInstructions[index % 8].name);
+        }
+    }
+
+    fclose(filePtr);
+}
+
+// ##########################################################################################
+// # Reads up to MAXSUPERS runs from a -sequences file, or with no file takes the three     #
+// # this loop sees most: a lw/add/sw update, an add/beq loop counter and nand/nand (and).  #
+// ##########################################################################################
+
+void initializeFusion(fusionType *fusion, char *fileName) {
+    char line[MAXLINELENGTH];
+    char names[MAXSEQUENCE + 1][MAXLINELENGTH];
+    int opCodes[MAXSEQUENCE];
+    long long count;
+
+    fusion->numOfPatterns = 0;
+
+    if (fileName == NULL) {
+        int update[3] = {LW, ADD, SW}, counter[2] = {ADD, BEQ}, bitwiseAnd[2] = {NAND, NAND};
+        addPattern(fusion, 3, update);
+        addPattern(fusion, 2, counter);
+        addPattern(fusion, 2, bitwiseAnd);
+        return;
+    }
+
+    FILE *filePtr = fopen(fileName, "r");
+    if (filePtr == NULL) {
+        printf("error: can't open file %s", fileName);
+        perror("fopen");
+        exit(1);
+    }
+
+    while (fusion->numOfPatterns < MAXSUPERS && fgets(line, MAXLINELENGTH, filePtr) != NULL) {
+        int length = sscanf(line, "%lld %s %s %s %s", &count, names[0], names[1], names[2], names[3]) - 1;
+
+        if (length < 2 || length > MAXSEQUENCE) {
+            printf("error: bad sequence %s", line);
+            exit(1);
+        }
+        for (int i = 0; i < length; i++) {
+            opCodes[i] = getOpCodeByName(names[i]);
+            if (opCodes[i] < 0 || !isFusable(opCodes[i], i == length - 1)) {
+                printf("error: %s can't be fused where it is in %s", names[i], line);
+                exit(1);
+            }
+        }
+        addPattern(fusion, length, opCodes);
+    }
+
+    fclose(filePtr);
+}
+
+// Keeps the patterns longest first.
+void addPattern(fusionType *fusion, int length, const int *opCodes) {
+    int i = fusion->numOfPatterns++;
+
+    while (i > 0 && fusion->patterns[i - 1].length < length) {
+        fusion->patterns[i] = fusion->patterns[i - 1];
+        i--;
+    }
+
+    patternType *pattern = &fusion->patterns[i];
+    pattern->length = length;
+    memcpy(pattern->opCodes, opCodes, length * sizeof(int));
+
+    pattern->kind = superGeneric;
+    if (length == 3 && opCodes[0] == LW && opCodes[1] == ADD && opCodes[2] == SW) {
+        pattern->kind = superUpdate;
+    } else if (length == 2 && opCodes[0] == ADD && opCodes[1] == BEQ) {
+        pattern->kind = superCounter;
+    } else if (length == 2 && opCodes[0] == NAND && opCodes[1] == NAND) {
+        pattern->kind = superAnd;
+    }
+}
+
+int getOpCodeByName(const char *name) {
+    for (int opCode = 0; opCode < 8; opCode++) {
+        if (strcmp(name, isaInstructions[opCode].name) == 0) {
+            return opCode;
+        }
+    }
+    return -1;
+}
+
+// ##########################################################################################
+// # Finds the superinstruction starting at each address from "from" to "to". It's run over #
+// # all of memory first and then whenever a store changes a word's opcode, over the        #
+// # addresses whose runs that word is part of, so code a program rewrites is never run as  #
+// # what it was.                                                                           #
+// ##########################################################################################
+
+void matchPatterns(fusionType *fusion, stateType *state, int from, int to) {
+    from = from < 0 ? 0 : from;
+    to = to >= NUMMEMORY ? NUMMEMORY - 1 : to;
+
+    for (int address = from; address <= to + MAXSEQUENCE - 1 && address < NUMMEMORY; address++) {
+        fusion->opCodes[address] = (char) getOpCode(state->mem[address]);
+    }
+
+    for (int start = from; start <= to; start++) {
+        fusion->starts[start] = -1;
+
+        for (int i = 0; i < fusion->numOfPatterns && fusion->starts[start] < 0; i++) {
+            patternType *pattern = &fusion->patterns[i];
+            int isMatch = start + pattern->length <= NUMMEMORY;
+
+            for (int j = 0; j < pattern->length && isMatch; j++) {
+                isMatch = fusion->opCodes[start + j] == pattern->opCodes[j];
+            }
+            if (isMatch) {
+                fusion->starts[start] = (signed char) i;
+            }
+        }
+    }
+}
+
+// Data stores far outnumber code being rewritten, and only an opcode changing can change what matches.
+void noteFusedStore(fusionType *fusion, stateType *state, int address) {
+    if (address >= 0 && address < NUMMEMORY && getOpCode(state->mem[address]) != fusion->opCodes[address]) {
+        matchPatterns(fusion, state, address - (MAXSEQUENCE - 1), address);
+    }
+}
+
+// ##########################################################################################
+// # Runs the superinstruction at the pc and returns how many instructions that was. The    #
+// # three built-in ones are straight-line code; a branch is executed at its own pc, since  #
+// # branchEqual adds the offset to it.                                                     #
+// ##########################################################################################
+
+int executeSuper(stateType *state, fusionType *fusion) {
+    patternType *pattern = &fusion->patterns[fusion->starts[state->pc]];
+    int pc = state->pc;
+    int address;
+
+    switch (pattern->kind) {
+        case superUpdate:
+            loadWord(state, state->mem[pc]);
+            add(state, state->mem[pc + 1]);
+            address = saveWord(state, state->mem[pc + 2]);
+            state->pc = pc + 3;
+            noteFusedStore(fusion, state, address);
+            return 3;
+        case superCounter:
+            add(state, state->mem[pc]);
+            state->pc = pc + 1;
+            branchEqual(state, state->mem[pc + 1], 1);
+            state->pc++;
+            return 2;
+        case superAnd:
+            nand(state, state->mem[pc]);
+            nand(state, state->mem[pc + 1]);
+            state->pc = pc + 2;
+            return 2;
+        default:
+            return executeGeneric(state, fusion, pattern);
+    }
+}
+
+// A pattern from a file, one instruction after another; a store into the rest of the run ends it early.
+int executeGeneric(stateType *state, fusionType *fusion, patternType *pattern) {
+    int end = state->pc + pattern->length;
+
+    for (int i = 0; i < pattern->length; i++) {
+        int instruction = state->mem[state->pc];
+        int address;
+
+        switch (pattern->opCodes[i]) {
+            case ADD:
+                add(state, instruction);
+                break;
+            case NAND:
+                nand(state, instruction);
+                break;
+            case LW:
+                loadWord(state, instruction);
+                break;
+            case SW:
+                address = saveWord(state, instruction);
+                noteFusedStore(fusion, state, address);
+                if (address > state->pc && address < end) {
+                    state->pc++;
+                    return i + 1;
+                }
+                break;
+            case BEQ:
+                branchEqual(state, instruction, 1);
+                break;
+        }
+
+        state->pc++;
+    }
+
+    return pattern->length;
+}
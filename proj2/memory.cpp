@@ -3,22 +3,18 @@
 #include <string.h>
 #include <iostream>
 #include <cstring>
+#include <cstddef>
+#include "../common/isa.h"
 
 #define NUMMEMORY 65536 /* maximum number of data words in memory */
 #define NUMREGS 8 /* number of machine registers */
 #define MAXLINELENGTH 1000
 
-#define ADD 0
-#define NAND 1
-#define LW 2
-#define SW 3
-#define BEQ 4
-#define JALR 5 
-#define HALT 6
-#define NOOP 7
-
 #define NOOPINSTRUCTION 0x1c00000
 
+#include "../common/debugger.h"
+#include "../common/profiler.h"
+
 typedef struct IFIDStruct {
     int instr;
     int pcPlus1;
@@ -62,8 +58,28 @@ typedef struct stateStruct {
     WBENDType WBEND;
     int cycles; /* number of cycles run so far */
 } stateType;
+
+// For -profile, the pc each latch's instruction came from (-1 for a bubble) and the cycles it has cost so far.
+typedef struct profileSlotStruct {
+    int pc;
+    int stallCycles;
+} profileSlotType;
+
+typedef struct pipelineProfileStruct {
+    profileType profile;
+    profileSlotType IFID;
+    profileSlotType IDEX;
+    profileSlotType EXMEM;
+    profileSlotType MEMWB;
+} pipelineProfileType;
 void printState(stateType *statePtr);
 
+void printLatches(stateType *statePtr);
+
+int inspectState(void *context, const char *command, const char *argument);
+
+void recordCycle(historyType *history, stateStruct &state);
+
 int field0(int instruction);
 
 int field1(int instruction);
@@ -78,7 +94,7 @@ int convertNum(int num);
 
 void initializeState(stateType &state);
 
-void run(stateStruct &state);
+void run(stateStruct &state, bool isQuiet, debuggerType *debugger, pipelineProfileType *pipelineProfile);
 
 void instructionFetchStage(stateStruct &state, stateStruct &newState);
 
@@ -98,12 +114,24 @@ int getForwardedRegisterA(stateStruct &state);
 
 int getForwardedRegisterB(stateStruct &state);
 
+int forwardRegister(stateStruct &state, int reg, int contents);
+
+int getWrittenRegister(int instruction);
+
 int getOffset(int instruction, stateStruct &state);
 
 void checkLoadStall(stateStruct &state, stateStruct &newState);
 
+bool hasLoadStall(stateStruct &state);
+
 bool hasBranchTaken(stateStruct &state);
 
+void initializePipelineProfile(pipelineProfileType &pipelineProfile, stateStruct &state);
+
+void retireProfiled(pipelineProfileType &pipelineProfile, stateStruct &state);
+
+void advanceProfile(pipelineProfileType &pipelineProfile, stateStruct &state);
+
 int main(int argc, char *argv[]) {
     char line[MAXLINELENGTH];
     stateType state;
@@ -111,10 +139,47 @@ int main(int argc, char *argv[]) {
 
     initializeState(state);
 
-    if (argc != 2) {
-        printf("error: usage: %s <machine-code file>\n", argv[0]);
+    // -quiet only prints the cycle count, for timing the simulator itself; -debug runs just as quietly between
+    // stops and takes commands from stdin at each one (see common/debugger.h), keeping a history of checkpoints
+    // every <interval> cycles in up to <kilobytes> to step back through. -profile charges every cycle to the
+    // instruction that lost it and writes the folded call stacks to a file (see common/profiler.h).
+    int interval, kilobytes;
+    bool isQuiet = false, isDebug = false, isBadOption = argc < 2;
+    char *profileFileName = NULL;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-quiet") == 0) {
+            isQuiet = true;
+        } else if (parseDebugOption(argv[i], &interval, &kilobytes)) {
+            isDebug = true;
+        } else if (strncmp(argv[i], "-profile=", 9) == 0) {
+            profileFileName = argv[i] + 9;
+        } else {
+            isBadOption = true;
+        }
+    }
+    if (isBadOption || (isDebug && profileFileName != NULL)) {
+        printf("error: usage: %s <machine-code file> [-quiet] [-debug[=<interval>,<kilobytes>] | -profile=<file>]\n",
+               argv[0]);
         exit(1);
     }
+    isQuiet = isQuiet || isDebug;
+    debuggerType *debugger = NULL;
+    pipelineProfileType *pipelineProfile = NULL;
+
+    if (isDebug) {
+        debugger = new debuggerType;
+        initializeDebugger(debugger, "cycles");
+        attachMachine(debugger, &state.pc, &state.cycles, state.reg, state.dataMem);
+        debugger->stepsLeft = 1; // stop before the first cycle
+
+        // the latches, IFID through WBEND, go in the checkpoints with the registers
+        if (interval > 0) {
+            debugger->history = new historyType;
+            initializeHistory(debugger->history, interval, kilobytes, &state.pc, &state.cycles, state.reg,
+                              state.dataMem, &state.IFID, offsetof(stateType, cycles) - offsetof(stateType, IFID));
+        }
+    }
 
     filePtr = fopen(argv[1],"r");
     if (filePtr == NULL) {
@@ -130,7 +195,9 @@ int main(int argc, char *argv[]) {
             printf("error in reading address %d\n", state.numMemory);
             exit(1);
         }
-        printf("memory[%d]=%d\n", state.numMemory, state.instrMem[state.numMemory]);
+        if (!isQuiet) {
+            printf("memory[%d]=%d\n", state.numMemory, state.instrMem[state.numMemory]);
+        }
 
         if (sscanf(line, "%d", state.dataMem + state.numMemory) != 1) {
             printf("error in reading address %d\n", state.numMemory);
@@ -138,20 +205,47 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    run(state);
+    if (profileFileName != NULL) {
+        pipelineProfile = new pipelineProfileType;
+        initializePipelineProfile(*pipelineProfile, state);
+    }
+
+    run(state, isQuiet, debugger, pipelineProfile);
+
+    // only a halt gets here
+    if (pipelineProfile != NULL) {
+        writeProfile(&pipelineProfile->profile, profileFileName);
+        printProfile(&pipelineProfile->profile, state.instrMem);
+    }
 }
 
-void run(stateStruct &state) {
+void run(stateStruct &state, bool isQuiet, debuggerType *debugger, pipelineProfileType *pipelineProfile) {
 
     while (true) {
 
-        printState(&state);
+        if (!isQuiet) {
+            printState(&state);
+        }
+        if (debugger != NULL && checkDebugger(debugger)) {
+            runDebuggerPrompt(debugger, inspectState, &state);
+        }
+
+        if (pipelineProfile != NULL) {
+            retireProfiled(*pipelineProfile, state);
+        }
 
         /* check for halt */
         if (opcode(state.MEMWB.instr) == HALT) {
             printf("machine halted\n");
             printf("total of %d cycles executed\n", state.cycles);
-            exit(0);
+            if (pipelineProfile == NULL) {
+                exit(0);
+            }
+            return;
+        }
+
+        if (debugger != NULL && debugger->history != NULL) {
+            recordCycle(debugger->history, state);
         }
 
         stateStruct newState = state;
@@ -172,11 +266,18 @@ void run(stateStruct &state) {
         /* --------------------- MEM stage --------------------- */
 
         memoryStage(state, newState);
+        if (debugger != NULL && opcode(state.EXMEM.instr) == SW) {
+            noteStore(debugger, state.EXMEM.aluResult);
+        }
 
         /* --------------------- WB stage --------------------- */
 
         writeBackStage(state, newState);
 
+        if (pipelineProfile != NULL) {
+            advanceProfile(*pipelineProfile, state);
+        }
+
         state = newState; /* this is the last statement before end of the loop.
 			    It marks the end of the cycle and updates the
 			    current state with the values calculated in this
@@ -199,21 +300,20 @@ void instructionDecodeStage(stateStruct &state, stateStruct &newState) {
 }
 
 void checkLoadStall(stateStruct &state, stateStruct &newState) {
-    int IDEXOpCode = opcode(state.IDEX.instr);
-    int IFIDRegA = field0(state.IFID.instr), IFIDRegB = field1(state.IFID.instr);
-    int IDEXRegB = field1(state.IDEX.instr);
-
-    if (IDEXOpCode == LW) {
-        if (IFIDRegA == IDEXRegB || IFIDRegB == IDEXRegB) {
-            newState.IDEX.instr = NOOPINSTRUCTION;
-            newState.IFID.instr = state.IFID.instr;
-            newState.IFID.pcPlus1--;
-            newState.pc--;
-        }
+    if (hasLoadStall(state)) {
+        newState.IDEX.instr = NOOPINSTRUCTION;
+        newState.IFID.instr = state.IFID.instr;
+        newState.IFID.pcPlus1--;
+        newState.pc--;
     }
 
 }
 
+// only a register the next instruction actually reads has to wait for the load
+bool hasLoadStall(stateStruct &state) {
+    return opcode(state.IDEX.instr) == LW && isaReadsRegister(state.IFID.instr, field1(state.IDEX.instr));
+}
+
 int getRegisterAContents(int instruction, stateStruct &state) {
     return state.reg[field0(instruction)];
 }
@@ -255,77 +355,34 @@ void executeStage(stateStruct &state, stateStruct &newState) {
 }
 
 int getForwardedRegisterA(stateStruct &state) {
-    int registerA = field0(state.IDEX.instr);
-    int contentsOfA = state.IDEX.readRegA;
-
-    int opCodeWBEND = opcode(state.WBEND.instr);
-    int opCodeMEMWB = opcode(state.MEMWB.instr);
-    int opCodeEXMEM = opcode(state.EXMEM.instr);
-
-    if (opCodeWBEND == LW) {
-        if (registerA == field1(state.WBEND.instr)) {
-            contentsOfA = state.WBEND.writeData;
-        }
-    } else if (opCodeWBEND == ADD || opCodeWBEND == NAND) {
-        if (registerA == field2(state.WBEND.instr)) {
-            contentsOfA = state.WBEND.writeData;
-        }
-    }
-
-    if (opCodeMEMWB == LW) {
-        if (registerA == field1(state.MEMWB.instr)) {
-            contentsOfA = state.MEMWB.writeData;
-        }
-    } else if (opCodeMEMWB == ADD || opCodeMEMWB == NAND) {
-        if (registerA == field2(state.MEMWB.instr)) {
-            contentsOfA = state.MEMWB.writeData;
-        }
-    }
-
-    if (opCodeEXMEM == ADD || opCodeEXMEM == NAND) {
-        if (registerA == field2(state.EXMEM.instr)) {
-            contentsOfA = state.EXMEM.aluResult;
-        }
-    }
-
-    return contentsOfA;
+    return forwardRegister(state, field0(state.IDEX.instr), state.IDEX.readRegA);
 }
 
 int getForwardedRegisterB(stateStruct &state) {
-    int registerB = field1(state.IDEX.instr);
-    int contentsOfB = state.IDEX.readRegB;
-
-    int opCodeWBEND = opcode(state.WBEND.instr);
-    int opCodeMEMWB = opcode(state.MEMWB.instr);
-    int opCodeEXMEM = opcode(state.EXMEM.instr);
+    return forwardRegister(state, field1(state.IDEX.instr), state.IDEX.readRegB);
+}
 
-    if (opCodeWBEND == LW) {
-        if (registerB == field1(state.WBEND.instr)) {
-            contentsOfB = state.WBEND.writeData;
-        }
-    } else if (opCodeWBEND == ADD || opCodeWBEND == NAND) {
-        if (registerB == field2(state.WBEND.instr)) {
-            contentsOfB = state.WBEND.writeData;
-        }
+// The youngest write to reg further down the pipeline wins. A load in EXMEM has nothing to give yet; the load stall
+// keeps anything that reads its register back until it does.
+int forwardRegister(stateStruct &state, int reg, int contents) {
+    if (getWrittenRegister(state.WBEND.instr) == reg) {
+        contents = state.WBEND.writeData;
     }
 
-    if (opCodeMEMWB == LW) {
-        if (registerB == field1(state.MEMWB.instr)) {
-            contentsOfB = state.MEMWB.writeData;
-        }
-    } else if (opCodeMEMWB == ADD || opCodeMEMWB == NAND) {
-        if (registerB == field2(state.MEMWB.instr)) {
-            contentsOfB = state.MEMWB.writeData;
-        }
+    if (getWrittenRegister(state.MEMWB.instr) == reg) {
+        contents = state.MEMWB.writeData;
     }
 
-    if (opCodeEXMEM == ADD || opCodeEXMEM == NAND) {
-        if (registerB == field2(state.EXMEM.instr)) {
-            contentsOfB = state.EXMEM.aluResult;
-        }
+    if (opcode(state.EXMEM.instr) != LW && getWrittenRegister(state.EXMEM.instr) == reg) {
+        contents = state.EXMEM.aluResult;
     }
 
-    return contentsOfB;
+    return contents;
+}
+
+// The register the pipeline writes back for the instruction, or -1. It doesn't implement jalr's link.
+int getWrittenRegister(int instruction) {
+    return opcode(instruction) == JALR ? -1 : isaWrittenRegister(instruction);
 }
 
 void memoryStage(stateStruct &state, stateStruct &newState) {
@@ -365,13 +422,10 @@ void writeBackStage(stateStruct &state, stateStruct &newState) {
     newState.WBEND.writeData = state.MEMWB.writeData;
     newState.WBEND.instr = state.MEMWB.instr;
 
-    int op_code = opcode(state.MEMWB.instr);
-    int writeBack = state.MEMWB.writeData;
+    int writtenRegister = getWrittenRegister(state.MEMWB.instr);
 
-    if (op_code == ADD || op_code == NAND) {
-        newState.reg[field2(state.MEMWB.instr)] = writeBack;
-    } else if (op_code == LW) {
-        newState.reg[field1(state.MEMWB.instr)] = writeBack;
+    if (writtenRegister >= 0) {
+        newState.reg[writtenRegister] = state.MEMWB.writeData;
     }
 }
 
@@ -388,6 +442,10 @@ void printState(stateType *statePtr) {
     for (i = 0; i < NUMREGS; i++) {
         printf("\t\treg[ %d ] %d\n", i, statePtr->reg[i]);
     }
+    printLatches(statePtr);
+}
+
+void printLatches(stateType *statePtr) {
     printf("\tIFID:\n");
     printf("\t\tinstruction ");
     printInstruction(statePtr->IFID.instr);
@@ -416,45 +474,24 @@ void printState(stateType *statePtr) {
 }
 
 int field0(int instruction) {
-    return ((instruction >> 19) & 0x7);
+    return isaRegA(instruction);
 }
 
 int field1(int instruction) {
-    return ((instruction >> 16) & 0x7);
+    return isaRegB(instruction);
 }
 
 int field2(int instruction) {
-    return (instruction & 0xFFFF);
+    return isaOffset(instruction);
 }
 
+// ISADATA for anything that isn't an instruction, so it matches none of them.
 int opcode(int instruction) {
-    return (instruction >> 22);
+    return isaDecode(instruction);
 }
 
 void printInstruction(int instr) {
-    char opcodeString[10];
-    if (opcode(instr) == ADD) {
-        strcpy(opcodeString, "add");
-    } else if (opcode(instr) == NAND) {
-        strcpy(opcodeString, "nand");
-    } else if (opcode(instr) == LW) {
-        strcpy(opcodeString, "lw");
-    } else if (opcode(instr) == SW) {
-        strcpy(opcodeString, "sw");
-    } else if (opcode(instr) == BEQ) {
-        strcpy(opcodeString, "beq");
-    } else if (opcode(instr) == JALR) {
-        strcpy(opcodeString, "jalr");
-    } else if (opcode(instr) == HALT) {
-        strcpy(opcodeString, "halt");
-    } else if (opcode(instr) == NOOP) {
-        strcpy(opcodeString, "noop");
-    } else {
-        strcpy(opcodeString, "data");
-    }
-
-    printf("%s %d %d %d\n", opcodeString, field0(instr), field1(instr),
-           field2(instr));
+    printf("%s %d %d %d\n", isaName(instr), field0(instr), field1(instr), field2(instr));
 }
 
 void initializeState(stateType &state) {
@@ -481,3 +518,86 @@ int convertNum(int num) {
 
     return (num);
 }
+
+// The -debug commands only the pipeline has: "state" prints everything the trace does, "pipe" just the latches.
+int inspectState(void *context, const char *command, const char *argument) {
+    stateType *state = (stateType *) context;
+
+    if (strcmp(command, "help") == 0) {
+        printf("state, pipe                   print the whole machine state, or just the pipeline latches\n");
+    } else if ((strcmp(command, "state") == 0 || strcmp(command, "pipe") == 0) && argument[0] != '\0') {
+        printf("usage: %s\n", command);
+    } else if (strcmp(command, "state") == 0) {
+        printState(state);
+    } else if (strcmp(command, "pipe") == 0) {
+        printLatches(state);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// Logs what this cycle's writeback and memory stages are about to overwrite for -debug's history. The pc and latches
+// change every cycle, so going back always replays from a checkpoint and they needn't be logged.
+void recordCycle(historyType *history, stateStruct &state) {
+    int writtenRegister = getWrittenRegister(state.MEMWB.instr);
+
+    keepHistory(history);
+
+    if (writtenRegister >= 0) {
+        recordRegister(history, writtenRegister);
+    }
+    if (opcode(state.EXMEM.instr) == SW) {
+        recordMemory(history, state.EXMEM.aluResult);
+    }
+}
+
+// ##########################################################################################
+// # -profile follows each instruction down the pipeline by its pc, so the cycles it costs  #
+// # can be charged to it as it leaves MEMWB: one for itself, one for every cycle a load    #
+// # made it wait in IFID, and three for the instructions a taken beq flushed. jalr doesn't #
+// # jump here, so every stack is just the entry.                                           #
+// ##########################################################################################
+
+void initializePipelineProfile(pipelineProfileType &pipelineProfile, stateStruct &state) {
+    profileSlotType bubble = {-1, 0};
+
+    initializeProfile(&pipelineProfile.profile, "cycles", state.instrMem, state.pc);
+    pipelineProfile.IFID = bubble;
+    pipelineProfile.IDEX = bubble;
+    pipelineProfile.EXMEM = bubble;
+    pipelineProfile.MEMWB = bubble;
+}
+
+void retireProfiled(pipelineProfileType &pipelineProfile, stateStruct &state) {
+    profileSlotType &retiring = pipelineProfile.MEMWB;
+
+    if (retiring.pc >= 0) {
+        profileInstruction(&pipelineProfile.profile, retiring.pc, state.MEMWB.instr, 1 + retiring.stallCycles);
+        profileStalls(&pipelineProfile.profile, retiring.pc, retiring.stallCycles);
+    }
+}
+
+// Moves the slots along the way this cycle moved the latches; state is still the one the cycle started from.
+void advanceProfile(pipelineProfileType &pipelineProfile, stateStruct &state) {
+    profileSlotType bubble = {-1, 0};
+    bool isFlushed = opcode(state.EXMEM.instr) == BEQ && hasBranchTaken(state);
+    bool isStalled = hasLoadStall(state);
+
+    pipelineProfile.MEMWB = pipelineProfile.EXMEM;
+    if (isFlushed) {
+        pipelineProfile.MEMWB.stallCycles += 3;
+        pipelineProfile.EXMEM = bubble;
+        pipelineProfile.IDEX = bubble;
+        pipelineProfile.IFID = bubble;
+    } else if (isStalled) {
+        pipelineProfile.EXMEM = pipelineProfile.IDEX;
+        pipelineProfile.IDEX = bubble;
+        pipelineProfile.IFID.stallCycles++;
+    } else {
+        pipelineProfile.EXMEM = pipelineProfile.IDEX;
+        pipelineProfile.IDEX = pipelineProfile.IFID;
+        pipelineProfile.IFID.pc = state.pc;
+        pipelineProfile.IFID.stallCycles = 0;
+    }
+}
@@ -1,14 +1,60 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <cmath>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <climits>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "../../common/isa.h"
 
 // Declaring an enum for easy switch functionality and for re-usability.
 enum actionType {
-    cacheToProcessor, processorToCache, memoryToCache, cacheToMemory, cacheToNowhere
+    cacheToProcessor, processorToCache, memoryToCache, cacheToMemory, cacheToNowhere,
+    memoryToPrefetchBuffer, prefetchBufferToCache, processorToMemory, cacheToWriteBuffer, processorToWriteBuffer,
+    writeBufferToMemory, cacheToVictimCache, victimCacheToCache, victimCacheToMemory, victimCacheToNowhere,
+    victimCacheToWriteBuffer, missCacheToCache
 };
 
-enum {
-    ADD = 0, NAND = 1, LW = 2, SW = 3, BEQ = 4, JALR = 5, HALT = 6, NOOP = 7
+// Every access the processor makes goes through processorRead/processorWrite tagged with one of these.
+enum accessType {
+    instructionFetch, dataLoad, dataStore
+};
+
+enum replacementPolicy {
+    lruPolicy, fifoPolicy, randomPolicy
+};
+
+enum prefetcherType {
+    noPrefetcher, nextLinePrefetcher, stridePrefetcher, streamPrefetcher
+};
+
+// What a -serve run simulates: just the program, the program through the cache, or that plus the timing model.
+enum serverModel {
+    functionalModel, cacheModel, timingModel
+};
+
+// MESI, plus owned for MOESI: a dirty copy that other caches may be sharing.
+enum coherenceState {
+    invalidState, sharedState, exclusiveState, ownedState, modifiedState
 };
 
 #define NUMMEMORY 65536 /* maximum number of words in memory */
@@ -17,6 +63,9 @@ enum {
 #define REGZERO 0
 #define MAXNUMOFBLOCKS 256
 
+#include "../../common/debugger.h"
+#include "../../common/profiler.h"
+
 typedef struct stateStruct {
     int pc;
     int mem[NUMMEMORY];
@@ -25,28 +74,578 @@ typedef struct stateStruct {
 } stateType;
 
 typedef struct blockStruct {
-    int lines[256];
+    int *lines;               // this block's words in the cache's lineData, or NULL when the cache is tag-only
     bool isValid;
     bool isDirty;
     int tag;
     int setIndex;
     int blockIndex;
     int LRU;
+    bool isPrefetched;        // filled by a prefetch and not yet touched by the processor
+    long long prefetchTime;
+    enum coherenceState coherence; // only kept up when the cache is on a bus
+    unsigned long long touchedWords[4]; // words this core has used since the fill, to spot false sharing
+    unsigned long long validSectors; // one bit per sector, when the cache is sectored
+    unsigned long long dirtySectors;
 } blockStruct;
 
+typedef struct accessStruct {
+    int pc;
+    int address;
+    enum accessType type;
+} accessStruct;
+
+// One LRU stack per set: lastAccess maps a block number to the (local) time it was last touched, and tree is a
+// Fenwick tree over those times with a 1 wherever a block's most recent access sits. Counting the ones after a
+// block's last access gives its stack distance in O(log n).
+typedef struct stackSetStruct {
+    std::unordered_map<int, int> lastAccess;
+    std::vector<int> tree;
+    int clock;
+} stackSetStruct;
+
+// Stack distances for one set count. histogram[d] counts accesses at distance d (a hit for any associativity > d),
+// the last bucket collects everything at or beyond maxWays.
+typedef struct stackDistanceStruct {
+    int numOfSets;
+    std::vector<stackSetStruct> sets;
+    std::vector<long long> histogram;
+    long long coldMisses;     // first touches, the same for every set count: the distinct blocks
+} stackDistanceStruct;
+
+typedef struct analysisStruct {
+    int blockSize;
+    int maxWays;
+    long long accesses;
+    std::vector<stackDistanceStruct> stacks;
+} analysisStruct;
+
+// Everything is counted off the actions the cache takes, so it matches the printed transfers exactly.
+typedef struct cacheStatsStruct {
+    long long accesses;
+    long long hits;
+    long long misses;
+    long long writebacks;
+    long long wordsFromMemory;
+    long long wordsToMemory;
+} cacheStatsStruct;
+
+// useful counts prefetched blocks the processor went on to touch, lead sums the accesses between the prefetch and
+// that first touch, and demandMisses counts the misses nothing had prefetched.
+typedef struct prefetchStatsStruct {
+    long long issued;
+    long long redundant;
+    long long useful;
+    long long unusedEvicted;
+    long long totalLead;
+    long long demandMisses;
+} prefetchStatsStruct;
+
+typedef struct prefetchEntryStruct {
+    int blockAddress;
+    bool isValid;
+    long long prefetchTime;
+} prefetchEntryStruct;
+
+// Reference prediction table entry: the last address a load/store at pc touched and the stride it's been moving by.
+typedef struct strideEntryStruct {
+    int pc;
+    int lastAddress;
+    int stride;
+    bool isConfirmed;
+} strideEntryStruct;
+
+typedef struct prefetcherStruct {
+    enum prefetcherType type;
+    int degree;               // blocks fetched per trigger (the depth of each stream buffer)
+    int distance;             // how many blocks (or strides) ahead the first one is
+    bool isIntoBuffer;        // prefetch into a separate fully-associative buffer instead of the cache
+    std::vector<prefetchEntryStruct> buffer;
+    int nextBufferEntry;      // which entry a full buffer overwrites next
+    std::vector<strideEntryStruct> strideTable;
+    std::vector<std::deque<prefetchEntryStruct> > streams;
+    std::vector<long long> streamLastUse;
+    prefetchStatsStruct stats;
+} prefetcherStruct;
+
+// One block's worth of words headed for memory. Writes to the same block merge into the entry until it's drained,
+// and only the words actually written go out.
+typedef struct writeBufferEntryStruct {
+    int blockAddress;
+    std::vector<bool> isWordValid;
+} writeBufferEntryStruct;
+
+typedef struct writeBufferStruct {
+    int numOfEntries;
+    std::deque<writeBufferEntryStruct> entries;
+    long long wordsCoalesced;
+} writeBufferStruct;
+
+typedef struct setStatsStruct {
+    long long hits;
+    long long misses;
+    long long evictions;
+    long long dirtyEvictions;
+} setStatsStruct;
+
+// shadow holds every block ever touched in LRU order, so its stack distance is both the reuse distance and whether
+// a fully-associative LRU cache of the same capacity would have hit. reuseHistogram[0] counts distance 0 and
+// reuseHistogram[b] distances 2^(b-1) to 2^b - 1.
+typedef struct detailedStatsStruct {
+    long long compulsoryMisses;
+    long long capacityMisses;
+    long long conflictMisses;
+    long long firstUses;
+    stackSetStruct shadow;
+    std::vector<setStatsStruct> sets;
+    std::vector<long long> reuseHistogram;
+    bool isJson;
+} detailedStatsStruct;
+
+// What the event log stores per transfer: exactly what printAction needs to print it later.
+typedef struct eventStruct {
+    int address;
+    int size;
+    int type;
+} eventStruct;
+
+#define EVENTLOGMAGIC "LRUEVLOG"
+#define EVENTLOGCAPACITY 65536 /* events the ring holds before the simulation has to wait for the writer */
+
+// A single-producer, single-consumer ring: the simulation only moves head, the writer thread only moves tail.
+typedef struct eventLogStruct {
+    std::vector<eventStruct> ring;
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+    std::atomic<bool> isDone;
+    FILE *file;
+    std::thread writer;
+    bool onlyMisses;
+    bool onlyWritebacks;
+    int lowAddress;
+    int highAddress;
+} eventLogStruct;
+
+typedef struct victimEntryStruct {
+    int blockAddress;
+    bool isValid;
+    bool isDirty;
+    long long lastUse;
+    std::vector<int> lines;
+} victimEntryStruct;
+
+// A small fully-associative LRU buffer beside the cache. As a victim cache it takes whatever the cache evicts
+// (dirty data included) and swaps it back on a hit; as a miss cache it keeps a clean copy of every block the
+// cache fetched from memory.
+typedef struct victimCacheStruct {
+    bool isMissCache;
+    std::vector<victimEntryStruct> entries;
+    long long hits;
+} victimCacheStruct;
+
+// Blocks split into sectors that are filled and written back on their own. The block counts are what filling and
+// writing back the same blocks whole would have moved instead.
+typedef struct sectorStruct {
+    int numOfSectors;         // per block
+    int sectorSize;           // in words
+    long long sectorMisses;   // misses to a block that was there, in a sector that wasn't
+    long long wordsFetched;
+    long long wordsWrittenBack;
+    long long blockWordsFetched;
+    long long blockWordsWrittenBack;
+} sectorStruct;
+
+typedef struct tlbEntryStruct {
+    bool isValid;
+    int key;                  // the page number
+    int value;                // the frame
+    long long lastUse;
+} tlbEntryStruct;
+
+// Set-associative with LRU replacement. The walk cache is one too, keyed by root index and holding leaf tables.
+typedef struct tlbStruct {
+    int numOfEntries;         // 0 when there isn't one
+    int numOfWays;
+    std::vector<tlbEntryStruct> entries;
+    long long accesses;
+    long long misses;
+} tlbStruct;
+
+typedef struct vmStruct {
+    int pageSize;
+    int pageBits;
+    int leafBits;             // page number bits that index a leaf table; the rest index the root
+    int rootTable;            // the leaf tables follow it, all in the top pages of memory
+    tlbStruct itlb;
+    tlbStruct dtlb;
+    tlbStruct walkCache;
+    long long walks;
+    long long walkReads;
+    long long walkMisses;     // page-table reads that missed in the cache
+    long long walkCycles;
+} vmStruct;
+
+typedef struct hotspotStruct {
+    long long invalidations;
+    long long falseSharing;   // invalidations by a write to a word the invalidated core hadn't used
+} hotspotStruct;
+
+struct cacheStruct;
+
+// The snooping bus between the cores' private caches. memoryState holds the one shared memory every cache fills
+// from and writes back to. A transaction holds the bus and then every cache's lock, in core order, while a hit
+// only needs its own cache's lock.
+typedef struct busStruct {
+    bool isMoesi;
+    struct stateStruct *memoryState;
+    std::vector<struct cacheStruct *> caches;
+    std::mutex lock;
+    std::deque<std::mutex> cacheLocks;
+    long long reads;
+    long long readExclusives;
+    long long upgrades;
+    long long invalidations;
+    long long cacheToCacheTransfers;
+    long long snoopWritebacks;
+    std::unordered_map<int, hotspotStruct> hotspots; // by block address
+} busStruct;
+
+typedef struct mshrStruct {
+    int blockAddress;
+    long long readyCycle;
+} mshrStruct;
+
+// A first-order timing model: one instruction issues per cycle, hits are pipelined, and only latency beyond a
+// hit stalls the processor. Fetches block, a load only stalls the first instruction that reads its register,
+// and stores never wait unless every MSHR is busy. Fills (prefetches included) hold an MSHR until they arrive,
+// and every transfer to or from memory queues for the memory channel.
+typedef struct timingStruct {
+    int hitLatency;
+    int bufferLatency;        // a hit in the victim cache or prefetch buffer
+    int memoryLatency;
+    int wordsPerCycle;
+    int numOfMSHRs;
+    long long cycle;
+    long long channelFreeCycle;
+    std::vector<mshrStruct> mshrs; // fills still in flight
+    long long registerReady[NUMREGS];
+    long long accessStart;
+    long long pendingReady;   // when a fill already in flight for the block being accessed arrives, or -1
+    long long lastFillReady;  // when the fill this access started arrives, or -1
+    long long lastReady;      // when the data of the last access is available
+    long long numOfInstructions;
+    long long accesses;
+    long long latencySum;
+    long long stallCycles;
+    long long mshrFullCycles;
+    long long hitsUnderMiss;
+    long long missesUnderMiss;
+    long long delayedHits;    // accesses to a block whose fill was still in flight
+    int slowHitCycles;        // what a mispredicted way adds to this access if it hits
+} timingStruct;
+
+enum wayPredictionKind {
+    mruPrediction, pcPrediction
+};
+
+typedef struct wayPredictorStruct {
+    enum wayPredictionKind kind;
+    std::vector<int> mruWays; // per set
+    std::vector<int> pcWays;  // per table entry, picked by the pc and whether it's a fetch
+    int extraLatency;         // cycles a hit in a way other than the predicted one costs
+    int hitLatency;
+    long long hits;
+    long long correct;
+} wayPredictorStruct;
+
+// One way of banking the L1, judged on the same bundles as every other.
+typedef struct bankConfigStruct {
+    int numOfBanks;
+    int numOfPorts;           // per bank
+    long long cycles;         // what the bundles took, conflicts included
+    long long numOfConflicts; // bundles that needed more than one cycle to get through the banks
+    long long stallCycles;
+    std::vector<long long> busyPorts; // per bank, the port-cycles used
+    std::vector<int> requests;        // per bank, for the bundle being counted
+} bankConfigStruct;
+
+typedef struct bankStruct {
+    int issueWidth;           // instructions issued together in a bundle
+    int interleave;           // consecutive words in each bank
+    std::vector<bankConfigStruct> configs;
+    int numOfInstructions;    // in the bundle being filled
+    std::vector<int> dataAddresses; // its loads and stores
+    long long numOfBundles;
+    long long numOfDataAccesses;
+} bankStruct;
+
+// Finds tag among a set's packed tags and returns its way, or -1.
+typedef int (*findWayFunction)(const int *tags, int numOfWays, int tag);
+
+struct cacheStruct;
+struct accessStruct;
+
+// Replays accesses through a cache that only keeps counts (tag-only, quiet, nothing hung off it).
+typedef void (*cacheEngineFunction)(struct cacheStruct &cache, const struct accessStruct *accesses,
+                                    size_t numOfAccesses);
+
+typedef struct writePolicyStruct {
+    bool isWriteThrough;
+    bool isWriteAllocate;
+} writePolicyStruct;
+
 typedef struct cacheStruct {
     blockStruct blocks[256];
+    int tags[MAXNUMOFBLOCKS + 8]; // blocks[i].tag packed for the way search, padded so it can read a vector past the end
+    int lastWays[MAXNUMOFBLOCKS]; // per set, the way getCacheBlock last found a block in, which it compares first
+    findWayFunction findWay;
     int numOfSets;
     int blocksPerSet;
     int blockSize;
     int blockBits;
     int setBits;
+    enum replacementPolicy policy;
+    unsigned int randomState;
+    bool isWriteThrough;      // stores go on to memory right away and blocks are never dirty
+    bool isWriteAllocate;     // a store miss brings the block in; otherwise the word goes straight to memory
+    writeBufferStruct *writeBuffer; // when set, everything written to memory goes through it
+    bool isQuiet;             // count the transfers without printing them
+    bool isBypassed;          // there is no cache: accesses only feed the analysis/recording and go straight to memory
+    analysisStruct *analysis;
+    FILE *recordFile;         // when set, every access is written out in trace format
+    std::vector<accessStruct> *recordTrace; // when set, every access is appended here
+    prefetcherStruct *prefetcher;
+    detailedStatsStruct *detailedStats;
+    eventLogStruct *eventLog; // when set, transfers are logged here instead of printed
+    victimCacheStruct *victimCache;
+    sectorStruct *sectors;    // when set, blocks are filled and written back a sector at a time
+    vmStruct *vm;             // when set, the processor's addresses are virtual and get translated first
+    busStruct *bus;           // when set, the cache is one core's private cache and keeps coherent through the bus
+    int coreNumber;
+    timingStruct *timing;
+    bool isTagOnly;           // blocks keep no data: memory always holds the current values and is read directly
+    debuggerType *debugger;   // when set, the program stops for commands at breakpoints and watchpoints
+    struct streamStruct *stream; // when set, every access is handed to cache models on other threads
+    profileType *profile;     // when set, every instruction is counted with the misses (and cycles) it cost
+    bankStruct *banks;        // when set, every load and store is also sent to a bank
+    wayPredictorStruct *wayPredictor; // when set, each access guesses its way before the tags are compared
+    std::vector<int> lineData;
+    cacheStatsStruct stats;
 } cacheStruct;
 
+typedef struct rangeStruct {
+    int min;
+    int max;
+} rangeStruct;
+
+typedef struct optionsStruct {
+    bool stackDistance;
+    bool traceDriven;
+    char *recordFileName;
+    enum replacementPolicy policy;
+    bool sweep;
+    rangeStruct blockSizes;
+    rangeStruct sets;
+    rangeStruct ways;
+    std::vector<enum replacementPolicy> policies;
+    int numOfThreads;
+    bool json;
+    char *outputFileName;
+    enum prefetcherType prefetcher;
+    int prefetchDegree;
+    int prefetchDistance;
+    int prefetchBufferSize;
+    int numOfStreams;
+    writePolicyStruct writePolicy;
+    std::vector<writePolicyStruct> writePolicies;
+    int writeBufferSize;
+    bool quiet;
+    bool detailedStats;
+    bool detailedStatsJson;
+    char *eventLogFileName;
+    bool onlyMissEvents;
+    bool onlyWritebackEvents;
+    rangeStruct eventAddresses;
+    int victimCacheSize;
+    bool isMissCache;
+    int numOfCores;
+    std::vector<char *> coreImages; // <address>:<file>
+    bool isMoesi;
+    int quantum;
+    bool timing;
+    int hitLatency;
+    int bufferLatency;
+    int memoryLatency;
+    int wordsPerCycle;
+    int numOfMSHRs;
+    int numOfSampledSets;
+    unsigned int sampleSeed;
+    int samplePeriod;
+    int sampleWarmup;
+    int sampleMeasure;
+    bool tagOnly;
+    char *tagCompare;
+    int numOfSectors;
+    bool virtualMemory;
+    int pageSize;
+    int itlbEntries;
+    int itlbWays;
+    int dtlbEntries;
+    int dtlbWays;
+    int walkCacheEntries;
+    bool debug;
+    bool stream;
+    char *profileFileName;
+    std::vector<int> bankCounts;
+    std::vector<int> portCounts;
+    int issueWidth;
+    int bankInterleave;
+    bool wayPrediction;
+    enum wayPredictionKind wayPredictionKind;
+    int wayTableSize;
+} optionsType;
+
+// One row of the sweep: the geometry and policy going in, the counters coming out.
+typedef struct sweepConfigStruct {
+    int blockSize;
+    int numOfSets;
+    int blocksPerSet;
+    enum replacementPolicy policy;
+    writePolicyStruct writePolicy;
+    cacheStatsStruct stats;
+} sweepConfigStruct;
+
+typedef struct sweepStruct {
+    const std::vector<accessStruct> *trace;
+    std::vector<sweepConfigStruct> configs;
+    std::atomic<int> nextConfig;
+    int writeBufferSize;
+    int victimCacheSize;
+    bool isMissCache;
+} sweepStruct;
+
+#define ACCESSRINGCAPACITY 65536 /* accesses a consumer's ring holds before the program has to wait for it */
+
+// ##########################################################################################
+// # One consumer's single-producer, single-consumer ring: the program only moves head and  #
+// # the consumer only moves tail. The two sit on their own cache lines, and the program    #
+// # rereads tail only once its last look says the ring is full, so a push is normally one  #
+// # store into the ring and one into head.                                                 #
+// ##########################################################################################
+
+typedef struct accessRingStruct {
+    std::vector<accessStruct> ring;
+    alignas(64) std::atomic<size_t> head;
+    size_t tailSeen;          // the program's last look at tail
+    alignas(64) std::atomic<size_t> tail;
+    std::atomic<bool> isDone;
+    std::vector<cacheStruct *> caches; // the cache models this consumer feeds
+    std::thread consumer;
+} accessRingStruct;
+
+// -stream: the program runs on the main thread and every access goes into each consumer's ring.
+typedef struct streamStruct {
+    std::deque<accessRingStruct> rings;
+} streamStruct;
+
+#define MAXREQUESTLENGTH 4096 /* longest request line a -serve client can send */
+#define SERVERDEFAULTLIMIT 100000000LL /* instructions a run gets without -limit */
+#define SERVERMAXLIMIT 10000000000LL /* the most -limit can ask for, so every run ends */
+#define SERVERPOLLINTERVAL (1 << 20) /* instructions between checks that the client is still there */
+
+// A program -serve has read once; every run copies it into a worker's machine instead of parsing the file again.
+typedef struct imageStruct {
+    char fileName[MAXLINELENGTH];
+    std::vector<int> words;
+} imageStruct;
+
+typedef struct memoryOverrideStruct {
+    int address;
+    int value;
+} memoryOverrideStruct;
+
+typedef struct runRequestStruct {
+    int image;
+    enum serverModel model;
+    int blockSize;
+    int numOfSets;
+    int blocksPerSet;
+    optionsType options;      // only the policies, buffers and latencies are used
+    std::vector<memoryOverrideStruct> memory;
+    std::vector<memoryOverrideStruct> registers;
+    long long limit;          // instructions to run before giving up on a halt
+    bool isBinary;
+} runRequestStruct;
+
+// The binary reply to a run, in host byte order, followed by numOfWords words of memory.
+typedef struct runReplyStruct {
+    int status;               // 0, or the length of the error message that follows instead
+    int isHalted;             // 0 when the limit ran out first
+    int pc;
+    int reg[NUMREGS];
+    int numOfWords;
+    long long numOfInstructions;
+    cacheStatsStruct stats;
+    long long cycles;
+    long long stallCycles;
+} runReplyStruct;
+
+// One worker's machine, allocated once and reset for every run rather than set up per process.
+typedef struct serverInstanceStruct {
+    stateType state;
+    cacheStruct cache;
+    writeBufferStruct writeBuffer;
+    victimCacheStruct victimCache;
+    timingStruct timing;
+} serverInstanceStruct;
+
+typedef struct serverStruct {
+    std::deque<imageStruct> images; // a deque, so loading another doesn't move the ones being run
+    std::mutex imageLock;
+    std::deque<int> connections;    // accepted, waiting for a worker
+    std::mutex connectionLock;
+    std::condition_variable hasConnection;
+    int listener;
+    std::atomic<bool> isStopping;
+} serverStruct;
+
+// One unit of a sample (a sampled set, or a measured interval) for the error estimate.
+typedef struct sampleUnitStruct {
+    long long accesses;
+    long long misses;
+} sampleUnitStruct;
+
+// Only the pc and registers are a core's own; its memory is the bus's, so it doesn't get a whole stateType.
+typedef struct coreStruct {
+    int pc;
+    int reg[NUMREGS];
+    cacheStruct *cache;
+    long long numOfInstructions;
+} coreStruct;
+
+// Every core runs a quantum of instructions and then waits here for the others, so none gets more than a
+// quantum ahead. A core that halts leaves and the rest carry on without it.
+typedef struct quantumBarrierStruct {
+    std::mutex lock;
+    std::condition_variable isReleased;
+    int numOfCores;
+    int numArrived;
+    long long generation;
+} quantumBarrierStruct;
+
+typedef struct multiCoreStruct {
+    busStruct bus;
+    std::vector<coreStruct> cores;
+    quantumBarrierStruct barrier;
+    int quantum;
+} multiCoreStruct;
+
 int convertNum(int num);
 
 void printAction(int address, int size, enum actionType type);
 
+void reportAction(cacheStruct &cache, int address, int size, enum actionType type);
+
 int getBits(int word, int from, int to);
 
 void clearRegisters(stateType *state);
@@ -103,513 +702,5304 @@ int getOldAddress(blockStruct &block, cacheStruct &cache);
 
 void updateLRU(cacheStruct &cache, int address);
 
-int main(int argc, char *argv[]) {
+int processorRead(cacheStruct &cache, stateType &state, int address, enum accessType type);
 
-    char line[MAXLINELENGTH];
-    stateType state;
-    FILE *filePtr;
-    cacheStruct cache;
+void processorWrite(cacheStruct &cache, stateType &state, int address, int data);
 
-    cache.blockSize = atoi(argv[2]);
-    cache.numOfSets = atoi(argv[3]);
-    cache.blocksPerSet = atoi(argv[4]);
+void recordAccess(cacheStruct &cache, stateType &state, int address, enum accessType type);
 
-    if (argc != 5) {
-        printf("error: usage: %s <machine-code file>\n", argv[0]);
-        exit(1);
-    }
+void configureCache(cacheStruct &cache, int blockSize, int numOfSets, int blocksPerSet);
 
-    filePtr = fopen(argv[1],"r");
-    if (filePtr == NULL) {
-        printf("error: can't open file %s", argv[1]);
-        perror("fopen");
-        exit(1);
-    }
+void parseOptions(int argc, char *argv[], optionsType &options);
 
-    /* read in the entire machine-code file into memory */
-    for (state.numMemory = 0; fgets(line, MAXLINELENGTH, filePtr) != NULL;
-         state.numMemory++) {
-        if (sscanf(line, "%d", state.mem + state.numMemory) != 1) {
-            printf("error in reading address %d\n", state.numMemory);
-            exit(1);
-        }
-    }
+void parseRange(char *text, rangeStruct &range);
 
-    clearRegisters(&state);
-    initializeCacheBlocks(cache);
+void parseTLB(char *text, int &numOfEntries, int &numOfWays);
 
-    int halted = 0, numOfInstructions = 0;
+enum replacementPolicy parsePolicy(char *name);
 
-    while (!halted) {
+const char *getPolicyName(enum replacementPolicy policy);
 
-        int instruction = state.mem[state.pc];
-        int opCode = getOpCode(instruction);
-        int instructionAddress = state.pc;
+unsigned int nextRandom(cacheStruct &cache);
 
-        int minus = instructionAddress % cache.blockSize;
-        int printAddress = instructionAddress - minus;
+void checkCacheGeometry(cacheStruct &cache);
 
-        if (!isCacheHit(cache, instructionAddress)) {
-            loadCacheFromMemory(cache, state, instructionAddress);
-            printAction(printAddress, cache.blockSize, memoryToCache);
-        }
+bool isCacheGeometryValid(cacheStruct &cache);
 
-        printAction(instructionAddress, 1, cacheToProcessor);
-        updateLRU(cache, instructionAddress);
+void runProgram(stateType &state, cacheStruct &cache);
 
-        switch (opCode) {
-            case ADD:
-                add(&state, instruction);
-                break;
-            case NAND:
-                nand(&state, instruction);
-                break;
-            case LW:
-                loadWord(&state, instruction, cache);
-                break;
-            case SW:
-                saveWord(&state, instruction, cache);
-                break;
-            case BEQ:
-                branchEqual(&state, instruction);
-                break;
-            case JALR:
-                jumpAndLink(&state, instruction);
-                break;
-            case NOOP:
-                break;
-            case HALT:
-                halted = 1;
-                break;
-            default:
-                printf("error: opcode isn't recognized");
-                exit(1);
-        }
+void profileExecuted(cacheStruct &cache, stateType &state, int pc, long long missesBefore, long long cycleBefore);
 
-        state.pc++;
-        numOfInstructions++;
+int inspectCache(void *context, const char *command, const char *argument);
 
-    }
+void printCacheSet(cacheStruct &cache, int setIndex);
 
+void runServer(int argc, char *argv[]);
 
-    return (0);
-}
+bool loadImage(const char *fileName, imageStruct &image, char *error, size_t errorSize);
 
+void runServerWorker(serverStruct &server);
 
-void printAction(int address, int size, enum actionType type) {
-    printf("@@@ transferring word [%d-%d] ", address, address + size - 1);
-    if (type == cacheToProcessor) {
-        printf("from the cache to the processor\n");
-    } else if (type == processorToCache) {
-        printf("from the processor to the cache\n");
-    } else if (type == memoryToCache) {
-        printf("from the memory to the cache\n");
-    } else if (type == cacheToMemory) {
-        printf("from the cache to the memory\n");
-    } else if (type == cacheToNowhere) {
-        printf("from the cache to nowhere\n");
-    }
-}
+void serveConnection(serverStruct &server, serverInstanceStruct &instance, int connection);
 
-int convertNum(int num) {
-    /* convert a 16-bit number into a 32-bit Sun integer */
+bool parseRunRequest(serverStruct &server, char *arguments, runRequestStruct &request, char *error, size_t errorSize);
 
-    if (num & (1 << 15)) {
-        num -= (1 << 16);
-    }
+bool parseRequestNumber(const char *text, long long min, long long max, long long &value);
 
-    return (num);
-}
-// ##########################################################################################
-// # getBits: Used to extract each number and data from the instruction. Word is the 32-bit
-// # instruction that's sent in to the function. From is the first part of the bits that    #
-// # are needed for isolation. Argument "to" is the inclusive ending bit position.          #
-// # For instance:                                                                          #
-// # Operation codes are in bits 24, 23, and 22. From = 22, to = 24.                        #
-// # Register A bits are in 21 to 19. From 21 to 19.                                        #
-// ##########################################################################################
+void runRequest(serverStruct &server, serverInstanceStruct &instance, runRequestStruct &request,
+                runReplyStruct &reply, int connection, char *error, size_t errorSize);
 
+bool isClientGone(int connection);
 
-int getBits(int word, int from, int to) {
-    int mask = ((1 << (to - from + 1)) - 1) << from;
-    return (word & mask) >> from;
-}
+const char *getGuestFault(stateType &state);
 
-// ##########################################################################################
-// # Simply clears the registers before using them. Without doing so, they'll collect garb -#
-// # -age information that's leftover. So, each position in the array is initialized to 0.  #
-// ##########################################################################################
+void sendRunReply(FILE *output, serverInstanceStruct &instance, runRequestStruct &request, runReplyStruct &reply);
 
-void clearRegisters(stateType *state) {
-    state->pc = 0;
-    int i = 0;
+void sendError(FILE *output, bool isBinary, const char *error);
 
-    for (i; i < NUMREGS; i++) {
-        state->reg[i] = 0;
-    }
-}
+void printJsonString(FILE *output, const char *text);
 
-// ##########################################################################################
-// # Make sure that the offset does not exceed 16 bits. If it did, an error is thrown and   #
-// # the program halts with an exit-code.                                                   #
-// ##########################################################################################
+int executeInstruction(stateType &state, cacheStruct &cache);
 
-void checkOffset(int offset) {
-    if (offset > NUMMEMORY) {
-        printf("\nout of memory\n");
-        exit(1);
-    }
-}
+void readTrace(char *fileName, std::vector<accessStruct> &trace);
 
-// ##########################################################################################
-// # Checks if the register is within the limits of 0 to 7 (it's only an 8-bit registry)    #
-// ##########################################################################################
+void runTrace(const std::vector<accessStruct> &trace, stateType &state, cacheStruct &cache);
 
-void checkRegister(int reg) {
-    if (reg < REGZERO || reg > (NUMREGS - 1)) {
-        printf("\nunreachable registry state\n");
-        exit(1);
-    }
-}
+void runAccesses(const accessStruct *accesses, size_t numOfAccesses, stateType &state, cacheStruct &cache);
 
-// ##########################################################################################
-// # The following get* functions grab their respective bit from the instruction that's     #
-// # passed to getBits( ). It will isolate each section of the instruction and return the   #
-// # appropriate integer value for regA, regB, the opcode, the destination register, and    #
-// # the offset.                                                                            #
-// ##########################################################################################
+void initializeAnalysis(analysisStruct &analysis, int blockSize, int maxSets, int maxWays);
 
+void addStackAccess(analysisStruct &analysis, int address);
 
-int getOpCode(int word) { return getBits(word, 22, 24); }
+int getStackDistance(stackSetStruct &set, int block);
 
-int getRegA(int word) { return getBits(word, 19, 21); }
+void compactStackSet(stackSetStruct &set);
 
-int getRegB(int word) { return getBits(word, 16, 18); }
+void addToTree(std::vector<int> &tree, int position, int delta);
 
-int getDestination(int word) { return getBits(word, 0, 2); }
+int sumOfTree(std::vector<int> &tree, int position);
 
-int getOffset(int word) { return getBits(word, 0, 15); }
+void printAnalysis(analysisStruct &analysis);
 
-// ##########################################################################################
-// # If the add operation code is called for, it will use the by-reference state of the     #
-// # computer and save the values from regA + regB into the destination register.           #
-// ##########################################################################################
+void runSweep(std::vector<accessStruct> &trace, optionsType &options);
 
-void add(stateType *state, int instruction) {
-    int regA, regB, destination;
-    regA = getRegA(instruction);
-    regB = getRegB(instruction);
-    destination = getDestination(instruction);
+void runSweepWorker(sweepStruct &sweep);
 
-    checkRegister(regA);
-    checkRegister(regB);
+void buildSweep(sweepStruct &sweep, optionsType &options);
 
-    state->reg[destination] = state->reg[regA] + state->reg[regB];
-}
+void configureSweepCache(cacheStruct &cache, sweepConfigStruct &config, sweepStruct &sweep,
+                         writeBufferStruct &writeBuffer, victimCacheStruct &victimCache);
 
-// ##########################################################################################
-// # If the nand operation code is called for, it will use the by-reference state of the    #
-// # computer and save the value from ~(regA & regB) into the destination register.         #
-// ##########################################################################################
+void printSweep(sweepStruct &sweep, optionsType &options);
 
-void nand(stateType *state, int instruction) {
-    int regA, regB, destination;
-    regA = getRegA(instruction);
-    regB = getRegB(instruction);
-    destination = getDestination(instruction);
+void runStreamed(stateType &state, std::vector<cacheStruct *> &caches, int numOfConsumers, FILE *recordFile);
 
-    checkRegister(regA);
-    checkRegister(regB);
+void pushAccess(streamStruct &stream, int pc, int address, enum accessType type);
 
-    state->reg[destination] = ~(state->reg[regA] & state->reg[regB]);
-}
+void runStreamConsumer(accessRingStruct &ring);
 
-// ##########################################################################################
-// # If the LW operation code is called for, it will use the by-reference state of the      #
-// # computer and load the value from the offset plus regA into regB.                       #
-// ##########################################################################################
+void runStreamedSweep(stateType &state, optionsType &options, FILE *recordFile);
 
-void loadWord(stateType *state, int instruction, cacheStruct &cache) {
-    int regA, regB, offset = getOffset(instruction);
-    offset = convertNum(offset);
+void initializePrefetcher(prefetcherStruct &prefetcher, optionsType &options);
 
-    regA = getRegA(instruction);
-    regB = getRegB(instruction);
+blockStruct *getCacheBlock(cacheStruct &cache, int address);
 
-    checkRegister(regA);
-    checkRegister(regB);
-    checkOffset(offset);
+void runPrefetcher(cacheStruct &cache, stateType &state, int address, enum accessType type, bool wasHit,
+                   bool wasBufferHit);
 
+void issuePrefetch(cacheStruct &cache, stateType &state, int address);
 
-    int address = offset + state->reg[regA];
+bool takeFromPrefetchBuffer(cacheStruct &cache, stateType &state, int address);
 
-    int minus = address % cache.blockSize;
-    int printAddress = address - minus;
+bool isInPrefetchBuffer(prefetcherStruct &prefetcher, int blockAddress);
 
-    if (isCacheHit(cache, address)) {
-        updateLRU(cache, address);
-        printAction(address, 1, cacheToProcessor);
-        state->reg[regB] = getLoadWordFromCache(cache, address);
-    } else {
-        loadCacheFromMemory(cache, *state, address);
-        printAction(printAddress, cache.blockSize, memoryToCache);
-        state->reg[regB] = getLoadWordFromCache(cache, address);
-        printAction(address, 1, cacheToProcessor);
-    }
+void allocateStream(cacheStruct &cache, int blockAddress);
 
-    state->reg[regB] = state->mem[offset + state->reg[regA]];
-}
+void printPrefetchStats(cacheStruct &cache);
 
-int getLoadWordFromCache(cacheStruct &cache, int address) {
-    int tag = getTag(cache, address);
-    int blockOffset = getBlockOffset(cache, address);
+writePolicyStruct parseWritePolicy(char *name);
 
-    for (int i = 0; i < (cache.blocksPerSet * cache.numOfSets); i++) {
-        if (cache.blocks[i].tag == tag) {
-            return cache.blocks[i].lines[blockOffset];
-        }
-    }
+const char *getWritePolicyName(writePolicyStruct policy);
 
-    return 0;
-}
+void initializeWriteBuffer(writeBufferStruct &writeBuffer, int numOfEntries);
 
-// ##########################################################################################
-// # If the SW operation code is called for, it will use the by-reference state of the      #
-// # computer and save the value of regB into a memory destination of offset + regA.        #
-// ##########################################################################################
+void sendToMemory(cacheStruct &cache, int address, int size, enum actionType type);
 
-void saveWord(stateType *state, int instruction, cacheStruct &cache) {
-    int regA, regB, offset = getOffset(instruction);
+void drainWriteBuffer(cacheStruct &cache, size_t numOfEntriesLeft);
 
-    offset = convertNum(offset);
+void printTraffic(cacheStruct &cache);
 
-    regA = getRegA(instruction);
-    regB = getRegB(instruction);
+void initializeDetailedStats(detailedStatsStruct &detailedStats, cacheStruct &cache, bool isJson);
 
-    checkRegister(regA);
-    checkRegister(regB);
-    checkOffset(offset);
+void recordDetailedStats(cacheStruct &cache, int address, bool wasHit);
 
+void recordEviction(cacheStruct &cache, blockStruct &block);
 
-    int address = offset + state->reg[regA];
+void printDetailedStats(cacheStruct &cache);
 
-    int minus = address % cache.blockSize;
-    int printAddress = address - minus;
+void printDetailedStatsJson(cacheStruct &cache);
 
-    if (!isCacheHit(cache, address)) {
-        loadCacheFromMemory(cache, *state, address);
-        printAction(printAddress, cache.blockSize, memoryToCache);
-        saveToCache(cache, address, state->reg[regB]);
-        printAction(address, 1, processorToCache);
-    } else {
-        updateLRU(cache, address);
-        saveToCache(cache, address, state->reg[regB]);
-        printAction(address, 1, processorToCache);
-    }
+void openEventLog(eventLogStruct &eventLog, optionsType &options);
 
-}
+void logEvent(eventLogStruct &eventLog, int address, int size, enum actionType type);
 
-void saveToCache(cacheStruct &cache, int address, int data) {
-    int tag = getTag(cache, address);
-    int blockOffset = getBlockOffset(cache, address);
-    int setOffset = getSetOffset(cache, address);
+void runEventWriter(eventLogStruct &eventLog);
 
-    for (int i = 0; i < (cache.numOfSets * cache.blocksPerSet); i++) {
-        if (cache.blocks[i].tag == tag && cache.blocks[i].setIndex == setOffset) {
-            cache.blocks[i].lines[blockOffset] = data;
-            cache.blocks[i].isDirty = true;
-        }
-    }
-}
+void closeEventLog(eventLogStruct &eventLog);
 
-// ##########################################################################################
-// # If the add operation code is called for, it will use the by-reference state of the     #
-// # computer and compare the values in regA and regB. If they're equal, it'll branch into  #
-// # the PC of PC + offset (plus 1, but that's incremented regardless in the while).        #
-// ##########################################################################################
+void formatEventLog(char *fileName);
 
-void branchEqual(stateType *state, int instruction) {
-    int regA, regB, offset = getOffset(instruction);
-    offset = convertNum(offset);
+void initializeVictimCache(victimCacheStruct &victimCache, int numOfEntries, bool isMissCache, int blockSize);
 
-    regA = getRegA(instruction);
-    regB = getRegB(instruction);
+victimEntryStruct *findVictimEntry(cacheStruct &cache, int address);
 
-    checkRegister(regA);
-    checkRegister(regB);
-    checkOffset(offset);
+victimEntryStruct &getOldestVictimEntry(victimCacheStruct &victimCache);
 
-    if (state->reg[regA] == state->reg[regB]) {
-        state->pc += offset;
-    }
-}
+bool takeFromVictimCache(cacheStruct &cache, stateType &state, int address);
 
-// ##########################################################################################
-// # If the JALR operation code is called for, it will use the by-reference state of the    #
-// # computer and save the current PC + 1 into regB, then the PC will be replaced with the  #
-// # count in regA.                                                                         #
-// ##########################################################################################
+void moveToVictimCache(cacheStruct &cache, stateType &state, blockStruct &block, int oldAddress);
 
-void jumpAndLink(stateType *state, int instruction) {
-    int regA, regB;
+void copyToMissCache(cacheStruct &cache, int address);
 
-    regA = getRegA(instruction);
-    regB = getRegB(instruction);
+void printVictimCacheStats(cacheStruct &cache);
 
-    checkRegister(regA);
-    checkRegister(regB);
+void initializeSectors(sectorStruct &sectors, int numOfSectors, int blockSize);
 
-    state->reg[regB] = state->pc + 1;
-    state->pc = state->reg[regA] - 1;
-}
+unsigned long long getSectorBit(cacheStruct &cache, int address);
 
-//// ########################################################################################################
-//// #                                CACHE FUNCTIONS: Initialize the Blocks                                #
-//// ########################################################################################################
+int getFillSize(cacheStruct &cache);
 
-void initializeCacheBlocks(cacheStruct &cache) {
-    setNumberOfBits(cache);
+void writeBackSectors(cacheStruct &cache, stateStruct &state, blockStruct &block, int oldAddress);
 
-    for (int i = 0; i < MAXNUMOFBLOCKS; i++) {
-        cache.blocks[i].tag = -1;
-        cache.blocks[i].isValid = false;
-        cache.blocks[i].isDirty = false;
-        cache.blocks[i].LRU = 0;
-        cache.blocks[i].setIndex = -1;
+void printSectorStats(cacheStruct &cache);
+
+void initializeVirtualMemory(vmStruct &vm, stateType &state, optionsType &options);
+
+void initializeTLB(tlbStruct &tlb, int numOfEntries, int numOfWays);
+
+int lookupTLB(tlbStruct &tlb, int key);
+
+void insertTLB(tlbStruct &tlb, int key, int value);
+
+int translateAddress(cacheStruct &cache, stateType &state, int address, enum accessType type);
+
+int walkPageTable(cacheStruct &cache, stateType &state, int address);
+
+int readPageTable(cacheStruct &cache, stateType &state, int address);
+
+void printTLB(const char *name, tlbStruct &tlb);
+
+void printVirtualMemoryStats(cacheStruct &cache);
+
+void runMultiCore(stateType &memoryState, cacheStruct &cache, optionsType &options);
+
+int loadCoreImage(stateType &memoryState, char *coreImage);
+
+void runCore(multiCoreStruct &multiCore, int coreNumber);
+
+int executeCoreInstruction(coreStruct &core);
+
+void waitForQuantum(quantumBarrierStruct &barrier, bool isLeaving);
+
+int coherentRead(cacheStruct &cache, int address);
+
+void coherentWrite(cacheStruct &cache, int address, int data);
+
+blockStruct *fillOnBus(cacheStruct &cache, int address, bool isForWrite);
+
+void invalidateCopies(busStruct &bus, int coreNumber, int address);
+
+void setCoherence(blockStruct &block, enum coherenceState coherence);
+
+void markWordTouched(cacheStruct &cache, blockStruct &block, int address);
+
+void acquireBus(busStruct &bus);
+
+void releaseBus(busStruct &bus);
+
+void printMultiCoreStats(multiCoreStruct &multiCore);
+
+void initializeTiming(timingStruct &timing, optionsType &options);
+
+void beginTimedAccess(cacheStruct &cache, int address, bool wasHit);
+
+void endTimedAccess(cacheStruct &cache, bool wasHit, bool wasBufferHit);
+
+long long timeMemoryTransfer(timingStruct &timing, int address, int size, bool isRead);
+
+void issueInstruction(timingStruct &timing, int instruction);
+
+void stallUntil(timingStruct &timing, long long readyCycle);
+
+void printTiming(timingStruct &timing);
+
+void initializeBanks(bankStruct &banks, optionsType &options);
+
+void recordBankAccess(bankStruct &banks, int address, enum accessType type);
+
+void issueBundle(bankStruct &banks);
+
+void printBankStats(bankStruct &banks);
+
+void initializeWayPredictor(wayPredictorStruct &wayPredictor, cacheStruct &cache, optionsType &options);
+
+int *getPredictedWay(cacheStruct &cache, stateType &state, int address, enum accessType type);
+
+void checkWayPrediction(cacheStruct &cache, stateType &state, int address, enum accessType type, bool wasHit);
+
+void trainWayPredictor(cacheStruct &cache, stateType &state, int address, enum accessType type);
+
+void printWayPredictionStats(wayPredictorStruct &wayPredictor);
+
+void setBlockTag(cacheStruct &cache, blockStruct &block, int tag);
+
+findWayFunction getFindWay(const char *name, int blocksPerSet);
+
+int findWayScalar(const int *tags, int numOfWays, int tag);
+
+#if defined(__x86_64__) || defined(__i386__)
+int findWaySse4(const int *tags, int numOfWays, int tag);
+
+int findWayAvx2(const int *tags, int numOfWays, int tag);
+#endif
+
+void benchmarkLookups();
+
+cacheEngineFunction getCacheEngine(cacheStruct &cache);
+
+void runSampled(std::vector<accessStruct> &trace, cacheStruct &cache, optionsType &options);
+
+void chooseSampledSets(cacheStruct &cache, optionsType &options, std::vector<int> &sampleOf);
+
+unsigned int hashSet(int set, unsigned int seed);
+
+double getSampleError(std::vector<sampleUnitStruct> &units, double fraction);
+
+int main(int argc, char *argv[]) {
+
+    char line[MAXLINELENGTH];
+    stateType state;
+    FILE *filePtr;
+    cacheStruct cache;
+    optionsType options;
+    analysisStruct analysis;
+    prefetcherStruct prefetcher;
+    writeBufferStruct writeBuffer;
+    detailedStatsStruct detailedStats;
+    eventLogStruct eventLog;
+    victimCacheStruct victimCache;
+    timingStruct timing;
+    sectorStruct sectors;
+    vmStruct vm;
+    std::vector<accessStruct> trace;
+
+    if (argc == 3 && strcmp(argv[1], "-format") == 0) {
+        formatEventLog(argv[2]);
+        return (0);
+    }
+
+    if (argc == 2 && strcmp(argv[1], "-benchlookup") == 0) {
+        benchmarkLookups();
+        return (0);
+    }
+
+    if (argc >= 2 && strncmp(argv[1], "-serve=", 7) == 0) {
+        runServer(argc, argv);
+        return (0);
+    }
+
+    if (argc < 5) {
+        printf("error: usage: %s <machine-code file> <blockSize> <numOfSets> <blocksPerSet> [options]\n", argv[0]);
+        printf("       %s -format <event log>\n", argv[0]);
+        printf("       %s -benchlookup\n", argv[0]);
+        printf("       %s -serve=<socket> [-workers=<n>] [<machine-code file>...]\n", argv[0]);
+        exit(1);
+    }
+
+    configureCache(cache, atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
+
+    parseOptions(argc, argv, options);
+    cache.policy = options.policy;
+    cache.isWriteThrough = options.writePolicy.isWriteThrough;
+    cache.isWriteAllocate = options.writePolicy.isWriteAllocate;
+    cache.isTagOnly = options.tagOnly;
+    cache.findWay = getFindWay(options.tagCompare, cache.blocksPerSet);
+
+    memset(state.mem, 0, sizeof(state.mem));
+
+    if (options.traceDriven) {
+        readTrace(argv[1], trace);
+        state.numMemory = 0;
+    } else {
+        filePtr = fopen(argv[1], "r");
+        if (filePtr == NULL) {
+            printf("error: can't open file %s", argv[1]);
+            perror("fopen");
+            exit(1);
+        }
+
+        /* read in the entire machine-code file into memory */
+        for (state.numMemory = 0; fgets(line, MAXLINELENGTH, filePtr) != NULL;
+             state.numMemory++) {
+            if (sscanf(line, "%d", state.mem + state.numMemory) != 1) {
+                printf("error in reading address %d\n", state.numMemory);
+                exit(1);
+            }
+        }
+        fclose(filePtr);
+    }
+
+    if (options.recordFileName != NULL) {
+        cache.recordFile = fopen(options.recordFileName, "w");
+        if (cache.recordFile == NULL) {
+            printf("error: can't open file %s", options.recordFileName);
+            perror("fopen");
+            exit(1);
+        }
+    }
+
+    clearRegisters(&state);
+
+    if (options.sweep && options.stream) {
+        runStreamedSweep(state, options, cache.recordFile);
+        return (0);
+    }
+
+    if (options.sweep) {
+        // the access stream doesn't depend on the cache, so execute once and let every configuration replay it
+        if (!options.traceDriven) {
+            cache.isBypassed = true;
+            cache.recordTrace = &trace;
+            runProgram(state, cache);
+        }
+        runSweep(trace, options);
+        return (0);
+    }
+
+    if (options.numOfSampledSets > 0 || options.samplePeriod > 0) {
+        if (!options.traceDriven) {
+            cache.isBypassed = true;
+            cache.recordTrace = &trace;
+            runProgram(state, cache);
+        }
+        runSampled(trace, cache, options);
+        return (0);
+    }
+
+    if (options.numOfCores > 1 || !options.coreImages.empty()) {
+        // state becomes the shared memory; each core gets its own registers and private cache
+        checkCacheGeometry(cache);
+        runMultiCore(state, cache, options);
+        return (0);
+    }
+
+    if (options.stackDistance) {
+        // numOfSets and blocksPerSet become the largest set count and associativity reported
+        initializeAnalysis(analysis, cache.blockSize, cache.numOfSets, cache.blocksPerSet);
+        cache.analysis = &analysis;
+        cache.isBypassed = true;
+        setNumberOfBits(cache);
+    } else {
+        checkCacheGeometry(cache);
+        initializeCacheBlocks(cache);
+    }
+
+    if (options.prefetcher != noPrefetcher && !options.stackDistance) {
+        initializePrefetcher(prefetcher, options);
+        cache.prefetcher = &prefetcher;
+    }
+
+    if (options.writeBufferSize > 0) {
+        initializeWriteBuffer(writeBuffer, options.writeBufferSize);
+        cache.writeBuffer = &writeBuffer;
+    }
+
+    if (options.detailedStats && !options.stackDistance) {
+        initializeDetailedStats(detailedStats, cache, options.detailedStatsJson);
+        cache.detailedStats = &detailedStats;
+    }
+
+    cache.isQuiet = options.quiet;
+
+    if (options.victimCacheSize > 0 && !options.stackDistance) {
+        initializeVictimCache(victimCache, options.victimCacheSize, options.isMissCache, cache.blockSize);
+        cache.victimCache = &victimCache;
+    }
+
+    if (options.numOfSectors > 1) {
+        initializeSectors(sectors, options.numOfSectors, cache.blockSize);
+        cache.sectors = &sectors;
+    }
+
+    if (options.eventLogFileName != NULL && !options.stackDistance) {
+        openEventLog(eventLog, options);
+        cache.eventLog = &eventLog;
+    }
+
+    if (options.timing && !options.stackDistance) {
+        initializeTiming(timing, options);
+        cache.timing = &timing;
+    }
+
+    if (options.virtualMemory) {
+        initializeVirtualMemory(vm, state, options);
+        cache.vm = &vm;
+    }
+
+    if (options.debug) {
+        cache.debugger = new debuggerType;
+        initializeDebugger(cache.debugger, "instructions");
+        cache.debugger->stepsLeft = 1; // stop before the first instruction
+        cache.isQuiet = true;
+    }
+
+    if (options.wayPrediction) {
+        cache.wayPredictor = new wayPredictorStruct;
+        initializeWayPredictor(*cache.wayPredictor, cache, options);
+    }
+
+    if (!options.bankCounts.empty()) {
+        cache.banks = new bankStruct;
+        initializeBanks(*cache.banks, options);
+    }
+
+    if (options.profileFileName != NULL) {
+        cache.profile = new profileType;
+        initializeProfile(cache.profile, cache.timing != NULL ? "cycles" : "instructions", state.mem, state.pc);
+    }
+
+    if (options.traceDriven) {
+        runTrace(trace, state, cache);
+    } else if (options.stream) {
+        // only the program records its accesses; the cache on the other thread just simulates them
+        std::vector<cacheStruct *> caches(1, &cache);
+        FILE *recordFile = cache.recordFile;
+
+        cache.recordFile = NULL;
+        runStreamed(state, caches, 1, recordFile);
+        cache.recordFile = recordFile;
+    } else {
+        runProgram(state, cache);
+    }
+
+    if (cache.writeBuffer != NULL) {
+        drainWriteBuffer(cache, 0);
+    }
+
+    if (cache.eventLog != NULL) {
+        closeEventLog(eventLog);
+    }
+
+    if (cache.recordFile != NULL) {
+        fclose(cache.recordFile);
+    }
+
+    if (options.stackDistance) {
+        printAnalysis(analysis);
+    }
+
+    if (cache.prefetcher != NULL) {
+        printPrefetchStats(cache);
+    }
+
+    if (cache.victimCache != NULL) {
+        printVictimCacheStats(cache);
+    }
+
+    if (!options.stackDistance && (cache.isWriteThrough || !cache.isWriteAllocate || cache.writeBuffer != NULL)) {
+        printTraffic(cache);
+    }
+
+    if (cache.sectors != NULL) {
+        printSectorStats(cache);
+    }
+
+    if (cache.detailedStats != NULL) {
+        if (cache.detailedStats->isJson) {
+            printDetailedStatsJson(cache);
+        } else {
+            printDetailedStats(cache);
+        }
+    }
+
+    if (cache.vm != NULL) {
+        printVirtualMemoryStats(cache);
+    }
+
+    if (cache.timing != NULL) {
+        printTiming(timing);
+    }
+
+    if (cache.banks != NULL) {
+        printBankStats(*cache.banks);
+    }
+
+    if (cache.wayPredictor != NULL) {
+        printWayPredictionStats(*cache.wayPredictor);
+    }
+
+    if (cache.profile != NULL) {
+        writeProfile(cache.profile, options.profileFileName);
+        printProfile(cache.profile, state.mem);
+    }
+
+    return (0);
+}
+
+// ##########################################################################################
+// # Options come after the four positional arguments:                                      #
+// #   -stack          one-pass LRU stack-distance analysis for every power-of-two set count #
+// #                   up to numOfSets and every associativity up to blocksPerSet.           #
+// #   -trace          the first argument is an access trace instead of machine code.        #
+// #   -record=<file>  write every access to <file> in the same trace format.                #
+// #   -policy=<name>  replacement policy: lru (default), fifo or random.                   #
+// #   -sweep          simulate every combination of the ranges below on -threads workers,  #
+// #                   printing a CSV (or -json) table to stdout or -output=<file>. Block   #
+// #                   sizes and set counts step through powers of two, ways through every  #
+// #                   count. Unset ranges run from 1 to the positional argument.           #
+// #   -blocksizes=<min>-<max>, -sets=<min>-<max>, -ways=<min>-<max>                         #
+// #   -policies=<name>,<name>,...                                                          #
+// #   -prefetch=<kind>  nextline, stride (per-pc, for loads and stores) or stream buffers. #
+// #   -degree=<n>       blocks per prefetch, or the depth of each stream buffer.           #
+// #   -distance=<n>     how far ahead (in blocks, or strides) the first prefetch lands.    #
+// #   -prefetchbuffer=<n>  prefetch into an n-entry buffer instead of into the cache.      #
+// #   -streams=<n>      number of stream buffers.                                          #
+// #   -writethrough     write-through instead of write-back.                               #
+// #   -nowriteallocate  store misses write memory instead of bringing the block in.        #
+// #   -writebuffer=<n>  an n-entry coalescing write buffer in front of memory.             #
+// #   -writepolicies=<name>,...  sweep write policies: wb-wa, wb-nwa, wt-wa, wt-nwa.        #
+// #   -quiet            don't print the transfers.                                         #
+// #   -stats            after the run, classify the misses and print per-set counts and a  #
+// #                     reuse-distance histogram; -stats=json prints the same as JSON.     #
+// #   -eventlog=<file>  log the transfers to <file> as binary records from a background    #
+// #                     thread instead of printing them; "lrucache -format <file>" prints  #
+// #                     them later, exactly as they would have been printed.               #
+// #   -events=misses    log only fills into the cache; -events=writebacks only blocks      #
+// #                     leaving it for memory; -eventrange=<low>-<high> only transfers     #
+// #                     touching those addresses.                                          #
+// #   -victimcache=<n>  an n-block fully-associative victim cache probed on misses.        #
+// #   -misscache=<n>    the same, but holding copies of blocks fetched on misses instead.   #
+// #   -cores=<n>        run n cores on one shared memory, each on its own thread with its   #
+// #                     own registers and private cache, kept coherent by MESI snooping.    #
+// #                     Every core starts at pc 0 with its core number in reg[7].           #
+// #   -core=<address>:<file>  add a core running <file>, loaded at <address> (assembled to  #
+// #                     run there) and started from it.                                     #
+// #   -moesi            MOESI instead of MESI.                                              #
+// #   -quantum=<n>      instructions each core runs before waiting for the others.          #
+// #   -timing           estimate cycles: prints AMAT, stall cycles and CPI after the run.   #
+// #   -hitlatency=<n>, -bufferlatency=<n>, -memlatency=<n>  cycles for a cache hit, a      #
+// #                     victim cache or prefetch buffer hit, and memory (1, 2 and 100).    #
+// #   -bandwidth=<n>    words the memory channel moves per cycle (1).                       #
+// #   -mshrs=<n>        misses that can be outstanding at once (4).                        #
+// #   -samplesets=<n>   simulate only n of the sets (a power of two, picked by hashing the #
+// #                     set index, -sampleseed=<n> to pick others) and extrapolate. The    #
+// #                     full geometry may then be far bigger than the cache array.         #
+// #   -tagonly          blocks hold only their tags and state bits and every value comes   #
+// #                     from memory; the counts and transfers come out the same. Sweeps    #
+// #                     and sampling always run this way.                                  #
+// #   -sectors=<n>      split each block into n sectors with their own valid and dirty     #
+// #                     bits, fetching and writing back only the sectors used.             #
+// #   -vm               translate every address through split instruction and data TLBs    #
+// #                     and a two-level page table in the top pages of memory, walked      #
+// #                     through the cache. Pages map to themselves.                        #
+// #   -pagesize=<n>     words per page (64).                                               #
+// #   -itlb=<n>,<ways>, -dtlb=<n>,<ways>  entries and associativity of each TLB (16,4),    #
+// #                     or 0 entries for none.                                             #
+// #   -walkcache=<n>    an n-entry cache of root entries to shorten walks (none).          #
+// #   -stream           run the program on this thread and the cache model (or every       #
+// #                     -sweep configuration, split over -threads consumers) on others,    #
+// #                     passing accesses through a ring to each. Implies -tagonly.         #
+// #   -debug            run without printing transfers and stop for commands from stdin    #
+// #                     before the first instruction and at each breakpoint, watchpoint,   #
+// #                     count or register condition set there (see common/debugger.h).     #
+// #   -banks=<n>,...    split the L1 into n address-interleaved banks and count the cycles #
+// #                     lost when a bundle of -issuewidth=<n> instructions (2) sends more  #
+// #                     loads and stores to one bank than it has -ports=<n>,... (1). Every #
+// #                     combination is judged in one pass. -bankinterleave=<n> puts n      #
+// #                     consecutive words in each bank (1).                                #
+// #   -waypredict=<kind>  guess each access's way before comparing tags, from the set's    #
+// #                     most recently used way (mru) or a -waytable=<n> entry table (256)  #
+// #                     by pc (pc). A hit in another way takes a cycle more; the accuracy  #
+// #                     and average hit latency are printed after the run.                 #
+// #   -profile=<file>   count every instruction with the misses it caused (and the cycles  #
+// #                     it took, with -timing), print the hottest pcs and basic blocks,    #
+// #                     and write the folded call stacks to <file> (common/profiler.h).    #
+// #   -tagcompare=<kind>  search a set's tags with scalar, sse4 or avx2 code instead of    #
+// #                     whatever the CPU supports best for the associativity.              #
+// #   -timesample=<period>,<warmup>,<measure>  of every period accesses, skip the first,   #
+// #                     warm the cache with the next warmup and count the last measure.    #
+// #                     Both print the estimated miss rate with a 95% confidence bound and #
+// #                     only use the replacement and write policies.                       #
+// ##########################################################################################
+
+void parseOptions(int argc, char *argv[], optionsType &options) {
+    options.stackDistance = false;
+    options.traceDriven = false;
+    options.recordFileName = NULL;
+    options.policy = lruPolicy;
+    options.sweep = false;
+    options.blockSizes.min = 1;
+    options.blockSizes.max = atoi(argv[2]);
+    options.sets.min = 1;
+    options.sets.max = atoi(argv[3]);
+    options.ways.min = 1;
+    options.ways.max = atoi(argv[4]);
+    options.numOfThreads = (int) std::thread::hardware_concurrency();
+    options.json = false;
+    options.outputFileName = NULL;
+    options.prefetcher = noPrefetcher;
+    options.prefetchDegree = 0;
+    options.prefetchDistance = 1;
+    options.prefetchBufferSize = 0;
+    options.numOfStreams = 4;
+    options.writePolicy.isWriteThrough = false;
+    options.writePolicy.isWriteAllocate = true;
+    options.writeBufferSize = 0;
+    options.quiet = false;
+    options.detailedStats = false;
+    options.detailedStatsJson = false;
+    options.eventLogFileName = NULL;
+    options.onlyMissEvents = false;
+    options.onlyWritebackEvents = false;
+    options.eventAddresses.min = 0;
+    options.eventAddresses.max = NUMMEMORY - 1;
+    options.victimCacheSize = 0;
+    options.isMissCache = false;
+    options.numOfCores = 1;
+    options.isMoesi = false;
+    options.quantum = 1000;
+    options.timing = false;
+    options.hitLatency = 1;
+    options.bufferLatency = 2;
+    options.memoryLatency = 100;
+    options.wordsPerCycle = 1;
+    options.numOfMSHRs = 4;
+    options.numOfSampledSets = 0;
+    options.sampleSeed = 1;
+    options.samplePeriod = 0;
+    options.sampleWarmup = 0;
+    options.sampleMeasure = 0;
+    options.tagOnly = false;
+    options.tagCompare = NULL;
+    options.numOfSectors = 1;
+    options.virtualMemory = false;
+    options.pageSize = 64;
+    options.itlbEntries = 16;
+    options.itlbWays = 4;
+    options.dtlbEntries = 16;
+    options.dtlbWays = 4;
+    options.walkCacheEntries = 0;
+    options.debug = false;
+    options.stream = false;
+    options.profileFileName = NULL;
+    options.issueWidth = 2;
+    options.bankInterleave = 1;
+    options.wayPrediction = false;
+    options.wayPredictionKind = mruPrediction;
+    options.wayTableSize = 256;
+
+    for (int i = 5; i < argc; i++) {
+        if (strcmp(argv[i], "-stack") == 0) {
+            options.stackDistance = true;
+        } else if (strcmp(argv[i], "-trace") == 0) {
+            options.traceDriven = true;
+        } else if (strncmp(argv[i], "-record=", 8) == 0) {
+            options.recordFileName = argv[i] + 8;
+        } else if (strncmp(argv[i], "-policy=", 8) == 0) {
+            options.policy = parsePolicy(argv[i] + 8);
+        } else if (strcmp(argv[i], "-sweep") == 0) {
+            options.sweep = true;
+        } else if (strncmp(argv[i], "-blocksizes=", 12) == 0) {
+            parseRange(argv[i] + 12, options.blockSizes);
+        } else if (strncmp(argv[i], "-sets=", 6) == 0) {
+            parseRange(argv[i] + 6, options.sets);
+        } else if (strncmp(argv[i], "-ways=", 6) == 0) {
+            parseRange(argv[i] + 6, options.ways);
+        } else if (strncmp(argv[i], "-policies=", 10) == 0) {
+            for (char *name = strtok(argv[i] + 10, ","); name != NULL; name = strtok(NULL, ",")) {
+                options.policies.push_back(parsePolicy(name));
+            }
+        } else if (strncmp(argv[i], "-threads=", 9) == 0) {
+            options.numOfThreads = atoi(argv[i] + 9);
+        } else if (strcmp(argv[i], "-json") == 0) {
+            options.json = true;
+        } else if (strncmp(argv[i], "-output=", 8) == 0) {
+            options.outputFileName = argv[i] + 8;
+        } else if (strcmp(argv[i], "-prefetch=nextline") == 0) {
+            options.prefetcher = nextLinePrefetcher;
+        } else if (strcmp(argv[i], "-prefetch=stride") == 0) {
+            options.prefetcher = stridePrefetcher;
+        } else if (strcmp(argv[i], "-prefetch=stream") == 0) {
+            options.prefetcher = streamPrefetcher;
+        } else if (strncmp(argv[i], "-degree=", 8) == 0) {
+            options.prefetchDegree = atoi(argv[i] + 8);
+        } else if (strncmp(argv[i], "-distance=", 10) == 0) {
+            options.prefetchDistance = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "-prefetchbuffer=", 16) == 0) {
+            options.prefetchBufferSize = atoi(argv[i] + 16);
+        } else if (strncmp(argv[i], "-streams=", 9) == 0) {
+            options.numOfStreams = atoi(argv[i] + 9);
+        } else if (strcmp(argv[i], "-writethrough") == 0) {
+            options.writePolicy.isWriteThrough = true;
+        } else if (strcmp(argv[i], "-nowriteallocate") == 0) {
+            options.writePolicy.isWriteAllocate = false;
+        } else if (strncmp(argv[i], "-writebuffer=", 13) == 0) {
+            options.writeBufferSize = atoi(argv[i] + 13);
+        } else if (strcmp(argv[i], "-quiet") == 0) {
+            options.quiet = true;
+        } else if (strcmp(argv[i], "-stats") == 0) {
+            options.detailedStats = true;
+        } else if (strcmp(argv[i], "-stats=json") == 0) {
+            options.detailedStats = true;
+            options.detailedStatsJson = true;
+        } else if (strncmp(argv[i], "-victimcache=", 13) == 0) {
+            options.victimCacheSize = atoi(argv[i] + 13);
+            options.isMissCache = false;
+        } else if (strncmp(argv[i], "-misscache=", 11) == 0) {
+            options.victimCacheSize = atoi(argv[i] + 11);
+            options.isMissCache = true;
+        } else if (strncmp(argv[i], "-eventlog=", 10) == 0) {
+            options.eventLogFileName = argv[i] + 10;
+        } else if (strcmp(argv[i], "-events=misses") == 0) {
+            options.onlyMissEvents = true;
+        } else if (strcmp(argv[i], "-events=writebacks") == 0) {
+            options.onlyWritebackEvents = true;
+        } else if (strncmp(argv[i], "-eventrange=", 12) == 0) {
+            if (sscanf(argv[i] + 12, "%d-%d", &options.eventAddresses.min, &options.eventAddresses.max) != 2
+                || options.eventAddresses.max < options.eventAddresses.min) {
+                printf("error: bad range %s\n", argv[i] + 12);
+                exit(1);
+            }
+        } else if (strncmp(argv[i], "-cores=", 7) == 0) {
+            options.numOfCores = atoi(argv[i] + 7);
+        } else if (strncmp(argv[i], "-core=", 6) == 0) {
+            options.coreImages.push_back(argv[i] + 6);
+        } else if (strcmp(argv[i], "-moesi") == 0) {
+            options.isMoesi = true;
+        } else if (strncmp(argv[i], "-quantum=", 9) == 0) {
+            options.quantum = atoi(argv[i] + 9);
+        } else if (strcmp(argv[i], "-timing") == 0) {
+            options.timing = true;
+        } else if (strncmp(argv[i], "-hitlatency=", 12) == 0) {
+            options.hitLatency = atoi(argv[i] + 12);
+        } else if (strncmp(argv[i], "-bufferlatency=", 15) == 0) {
+            options.bufferLatency = atoi(argv[i] + 15);
+        } else if (strncmp(argv[i], "-memlatency=", 12) == 0) {
+            options.memoryLatency = atoi(argv[i] + 12);
+        } else if (strncmp(argv[i], "-bandwidth=", 11) == 0) {
+            options.wordsPerCycle = atoi(argv[i] + 11);
+        } else if (strncmp(argv[i], "-mshrs=", 7) == 0) {
+            options.numOfMSHRs = atoi(argv[i] + 7);
+        } else if (strncmp(argv[i], "-samplesets=", 12) == 0) {
+            options.numOfSampledSets = atoi(argv[i] + 12);
+        } else if (strncmp(argv[i], "-sampleseed=", 12) == 0) {
+            options.sampleSeed = (unsigned int) strtoul(argv[i] + 12, NULL, 10);
+        } else if (strncmp(argv[i], "-timesample=", 12) == 0) {
+            if (sscanf(argv[i] + 12, "%d,%d,%d", &options.samplePeriod, &options.sampleWarmup,
+                       &options.sampleMeasure) != 3 || options.sampleWarmup < 0 || options.sampleMeasure < 1
+                || options.sampleWarmup + options.sampleMeasure > options.samplePeriod) {
+                printf("error: bad time sample %s\n", argv[i] + 12);
+                exit(1);
+            }
+        } else if (strncmp(argv[i], "-tagcompare=", 12) == 0) {
+            options.tagCompare = argv[i] + 12;
+        } else if (strncmp(argv[i], "-sectors=", 9) == 0) {
+            options.numOfSectors = atoi(argv[i] + 9);
+        } else if (strcmp(argv[i], "-vm") == 0) {
+            options.virtualMemory = true;
+        } else if (strncmp(argv[i], "-pagesize=", 10) == 0) {
+            options.pageSize = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "-itlb=", 6) == 0) {
+            parseTLB(argv[i] + 6, options.itlbEntries, options.itlbWays);
+        } else if (strncmp(argv[i], "-dtlb=", 6) == 0) {
+            parseTLB(argv[i] + 6, options.dtlbEntries, options.dtlbWays);
+        } else if (strncmp(argv[i], "-walkcache=", 11) == 0) {
+            options.walkCacheEntries = atoi(argv[i] + 11);
+        } else if (strcmp(argv[i], "-stream") == 0) {
+            options.stream = true;
+        } else if (strcmp(argv[i], "-debug") == 0) {
+            options.debug = true;
+        } else if (strncmp(argv[i], "-profile=", 9) == 0) {
+            options.profileFileName = argv[i] + 9;
+        } else if (strncmp(argv[i], "-banks=", 7) == 0) {
+            for (char *count = strtok(argv[i] + 7, ","); count != NULL; count = strtok(NULL, ",")) {
+                options.bankCounts.push_back(atoi(count));
+            }
+        } else if (strncmp(argv[i], "-ports=", 7) == 0) {
+            for (char *count = strtok(argv[i] + 7, ","); count != NULL; count = strtok(NULL, ",")) {
+                options.portCounts.push_back(atoi(count));
+            }
+        } else if (strncmp(argv[i], "-issuewidth=", 12) == 0) {
+            options.issueWidth = atoi(argv[i] + 12);
+        } else if (strncmp(argv[i], "-bankinterleave=", 16) == 0) {
+            options.bankInterleave = atoi(argv[i] + 16);
+        } else if (strcmp(argv[i], "-waypredict=mru") == 0) {
+            options.wayPrediction = true;
+            options.wayPredictionKind = mruPrediction;
+        } else if (strcmp(argv[i], "-waypredict=pc") == 0) {
+            options.wayPrediction = true;
+            options.wayPredictionKind = pcPrediction;
+        } else if (strncmp(argv[i], "-waytable=", 10) == 0) {
+            options.wayTableSize = atoi(argv[i] + 10);
+        } else if (strcmp(argv[i], "-tagonly") == 0) {
+            options.tagOnly = true;
+        } else if (strncmp(argv[i], "-writepolicies=", 15) == 0) {
+            for (char *name = strtok(argv[i] + 15, ","); name != NULL; name = strtok(NULL, ",")) {
+                options.writePolicies.push_back(parseWritePolicy(name));
+            }
+        } else {
+            printf("error: unknown option %s\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    if (options.policies.empty()) {
+        options.policies.push_back(options.policy);
+    }
+    if (options.writePolicies.empty()) {
+        options.writePolicies.push_back(options.writePolicy);
+    }
+    if (options.numOfThreads < 1) {
+        options.numOfThreads = 1;
+    }
+    if (options.prefetchDegree < 1) {
+        options.prefetchDegree = options.prefetcher == streamPrefetcher ? 4 : 1;
+    }
+    if (options.prefetchDistance < 1 || options.prefetchBufferSize < 0 || options.numOfStreams < 1) {
+        printf("error: bad prefetch settings\n");
+        exit(1);
+    }
+    if (options.numOfCores < 1 || options.quantum < 1) {
+        printf("error: bad multi-core settings\n");
+        exit(1);
+    }
+    if ((options.numOfCores > 1 || !options.coreImages.empty())
+        && (options.traceDriven || options.stackDistance || options.sweep)) {
+        printf("error: -cores and -core can't be combined with -trace, -stack or -sweep\n");
+        exit(1);
+    }
+    if (options.hitLatency < 1 || options.bufferLatency < 1 || options.memoryLatency < 0
+        || options.wordsPerCycle < 1 || options.numOfMSHRs < 1) {
+        printf("error: bad timing settings\n");
+        exit(1);
+    }
+    if (options.numOfSampledSets < 0 || (options.numOfSampledSets & (options.numOfSampledSets - 1)) != 0) {
+        printf("error: the number of sampled sets has to be a power of two\n");
+        exit(1);
+    }
+    if ((options.numOfSampledSets > 0 || options.samplePeriod > 0)
+        && (options.stackDistance || options.sweep || options.numOfCores > 1 || !options.coreImages.empty())) {
+        printf("error: sampling can't be combined with -stack, -sweep or -cores\n");
+        exit(1);
+    }
+    if (options.numOfSectors < 1 || options.numOfSectors > 64
+        || (options.numOfSectors & (options.numOfSectors - 1)) != 0) {
+        printf("error: the number of sectors has to be a power of two up to 64\n");
+        exit(1);
+    }
+    if (options.numOfSectors > 1
+        && (options.stackDistance || options.sweep || options.numOfSampledSets > 0 || options.samplePeriod > 0
+            || options.numOfCores > 1 || !options.coreImages.empty() || options.prefetcher != noPrefetcher
+            || options.victimCacheSize > 0 || options.detailedStats)) {
+        printf("error: -sectors can't be combined with -stack, -sweep, sampling, -cores, -prefetch, -stats or a "
+               "victim or miss cache\n");
+        exit(1);
+    }
+    if (options.virtualMemory
+        && (options.stackDistance || options.sweep || options.numOfSampledSets > 0 || options.samplePeriod > 0
+            || options.numOfCores > 1 || !options.coreImages.empty())) {
+        printf("error: -vm can't be combined with -stack, -sweep, sampling or -cores\n");
+        exit(1);
+    }
+    if (options.debug
+        && (options.traceDriven || options.stackDistance || options.sweep || options.numOfSampledSets > 0
+            || options.samplePeriod > 0 || options.numOfCores > 1 || !options.coreImages.empty())) {
+        printf("error: -debug can't be combined with -trace, -stack, -sweep, sampling or -cores\n");
+        exit(1);
+    }
+    if (options.stream
+        && (options.traceDriven || options.stackDistance || options.numOfSampledSets > 0 || options.samplePeriod > 0
+            || options.numOfCores > 1 || !options.coreImages.empty() || options.virtualMemory || options.timing
+            || options.debug)) {
+        printf("error: -stream can't be combined with -trace, -stack, sampling, -cores, -vm, -timing or -debug\n");
+        exit(1);
+    }
+    if (options.profileFileName != NULL
+        && (options.traceDriven || options.stackDistance || options.sweep || options.numOfSampledSets > 0
+            || options.samplePeriod > 0 || options.numOfCores > 1 || !options.coreImages.empty() || options.stream)) {
+        printf("error: -profile can't be combined with -trace, -stack, -sweep, sampling, -cores or -stream\n");
+        exit(1);
+    }
+    if (!options.bankCounts.empty() && options.portCounts.empty()) {
+        options.portCounts.push_back(1);
+    }
+    if (!options.portCounts.empty() && options.bankCounts.empty()) {
+        options.bankCounts.push_back(1);
+    }
+    bool hasBadBanks = options.issueWidth < 1 || options.bankInterleave < 1;
+    for (size_t i = 0; i < options.bankCounts.size(); i++) {
+        hasBadBanks = hasBadBanks || options.bankCounts[i] < 1;
+    }
+    for (size_t i = 0; i < options.portCounts.size(); i++) {
+        hasBadBanks = hasBadBanks || options.portCounts[i] < 1;
+    }
+    if (hasBadBanks) {
+        printf("error: bad bank settings\n");
+        exit(1);
+    }
+    if (!options.bankCounts.empty()
+        && (options.sweep || options.numOfSampledSets > 0 || options.samplePeriod > 0 || options.numOfCores > 1
+            || !options.coreImages.empty() || options.stream)) {
+        printf("error: -banks and -ports can't be combined with -sweep, sampling, -cores or -stream\n");
+        exit(1);
+    }
+    if (options.wayTableSize < 1) {
+        printf("error: bad way prediction settings\n");
+        exit(1);
+    }
+    if (options.wayPrediction
+        && (options.stackDistance || options.sweep || options.numOfSampledSets > 0 || options.samplePeriod > 0
+            || options.numOfCores > 1 || !options.coreImages.empty() || options.stream)) {
+        printf("error: -waypredict can't be combined with -stack, -sweep, sampling, -cores or -stream\n");
+        exit(1);
+    }
+
+    // a streamed cache sees only addresses, so like a sweep's it keeps no data
+    if (options.stream) {
+        options.tagOnly = true;
+    }
+}
+
+// "<entries>,<ways>", or just "<entries>" for a fully-associative one.
+void parseTLB(char *text, int &numOfEntries, int &numOfWays) {
+    if (sscanf(text, "%d,%d", &numOfEntries, &numOfWays) == 1) {
+        numOfWays = numOfEntries;
+    }
+}
+
+// A single number or <min>-<max>, and nothing after it: "4,8" is not a range.
+void parseRange(char *text, rangeStruct &range) {
+    int length = 0;
+    int numOfFields = sscanf(text, "%d%n-%d%n", &range.min, &length, &range.max, &length);
+
+    if (numOfFields == 1) {
+        range.max = range.min;
+    }
+
+    if (numOfFields < 1 || text[length] != '\0' || range.min < 1 || range.max < range.min) {
+        printf("error: bad range %s\n", text);
+        exit(1);
+    }
+}
+
+enum replacementPolicy parsePolicy(char *name) {
+    if (strcmp(name, "lru") == 0) {
+        return lruPolicy;
+    } else if (strcmp(name, "fifo") == 0) {
+        return fifoPolicy;
+    } else if (strcmp(name, "random") == 0) {
+        return randomPolicy;
+    }
+
+    printf("error: unknown replacement policy %s\n", name);
+    exit(1);
+}
+
+writePolicyStruct parseWritePolicy(char *name) {
+    writePolicyStruct policy;
+
+    if (strcmp(name, "wb-wa") == 0 || strcmp(name, "wb-nwa") == 0 || strcmp(name, "wt-wa") == 0
+        || strcmp(name, "wt-nwa") == 0) {
+        policy.isWriteThrough = name[1] == 't';
+        policy.isWriteAllocate = name[3] == 'w';
+        return policy;
+    }
+
+    printf("error: unknown write policy %s\n", name);
+    exit(1);
+}
+
+const char *getWritePolicyName(writePolicyStruct policy) {
+    if (policy.isWriteThrough) {
+        return policy.isWriteAllocate ? "wt-wa" : "wt-nwa";
+    }
+    return policy.isWriteAllocate ? "wb-wa" : "wb-nwa";
+}
+
+const char *getPolicyName(enum replacementPolicy policy) {
+    if (policy == fifoPolicy) {
+        return "fifo";
+    } else if (policy == randomPolicy) {
+        return "random";
+    }
+    return "lru";
+}
+
+// ##########################################################################################
+// # Sets the geometry and puts every other knob back to the plain write-back LRU cache     #
+// # that prints each transfer. The blocks themselves are set up by initializeCacheBlocks.  #
+// ##########################################################################################
+
+void configureCache(cacheStruct &cache, int blockSize, int numOfSets, int blocksPerSet) {
+    cache.blockSize = blockSize;
+    cache.numOfSets = numOfSets;
+    cache.blocksPerSet = blocksPerSet;
+    cache.policy = lruPolicy;
+    cache.randomState = 1;
+    cache.isWriteThrough = false;
+    cache.isWriteAllocate = true;
+    cache.writeBuffer = NULL;
+    cache.isQuiet = false;
+    cache.isBypassed = false;
+    cache.analysis = NULL;
+    cache.recordFile = NULL;
+    cache.recordTrace = NULL;
+    cache.prefetcher = NULL;
+    cache.detailedStats = NULL;
+    cache.eventLog = NULL;
+    cache.victimCache = NULL;
+    cache.sectors = NULL;
+    cache.vm = NULL;
+    cache.bus = NULL;
+    cache.coreNumber = 0;
+    cache.timing = NULL;
+    cache.isTagOnly = false;
+    cache.debugger = NULL;
+    cache.stream = NULL;
+    cache.profile = NULL;
+    cache.banks = NULL;
+    cache.wayPredictor = NULL;
+    cache.findWay = getFindWay(NULL, blocksPerSet);
+    memset(&cache.stats, 0, sizeof(cache.stats));
+}
+
+// ##########################################################################################
+// # The cache is a fixed array of MAXNUMOFBLOCKS blocks of up to 256 words, and the bit    #
+// # slicing in getTag/getSetOffset only works for powers of two, so reject anything else.  #
+// ##########################################################################################
+
+void checkCacheGeometry(cacheStruct &cache) {
+    if (!isCacheGeometryValid(cache)) {
+        printf("error: unsupported cache geometry %d %d %d\n", cache.blockSize, cache.numOfSets,
+               cache.blocksPerSet);
+        exit(1);
+    }
+}
+
+bool isCacheGeometryValid(cacheStruct &cache) {
+    bool isPowerOfTwo = cache.blockSize > 0 && (cache.blockSize & (cache.blockSize - 1)) == 0
+                        && cache.numOfSets > 0 && (cache.numOfSets & (cache.numOfSets - 1)) == 0;
+
+    return isPowerOfTwo && cache.blocksPerSet >= 1 && cache.blockSize <= 256
+           && cache.numOfSets * cache.blocksPerSet <= MAXNUMOFBLOCKS;
+}
+
+void runProgram(stateType &state, cacheStruct &cache) {
+    int halted = 0, numOfInstructions = 0;
+
+    if (cache.debugger != NULL) {
+        attachMachine(cache.debugger, &state.pc, &numOfInstructions, state.reg, state.mem);
+    }
+
+    while (!halted) {
+        if (cache.debugger != NULL && checkDebugger(cache.debugger)) {
+            runDebuggerPrompt(cache.debugger, inspectCache, &cache);
+        }
+        if (cache.profile != NULL) {
+            int pc = state.pc;
+            long long misses = cache.stats.misses, cycle = cache.timing != NULL ? cache.timing->cycle : 0;
+
+            halted = executeInstruction(state, cache);
+            profileExecuted(cache, state, pc, misses, cycle);
+        } else {
+            halted = executeInstruction(state, cache);
+        }
+        numOfInstructions++;
+    }
+}
+
+// Charges the instruction that just ran at pc with the misses it caused, its fetch's included, and with -timing, the
+// cycles it took past the one it issued in. The opcode only matters for jalr and beq, so it's read from memory.
+void profileExecuted(cacheStruct &cache, stateType &state, int pc, long long missesBefore, long long cycleBefore) {
+    int instruction = state.mem[pc];
+    long long cycles = cache.timing != NULL ? cache.timing->cycle - cycleBefore : 1;
+
+    profileInstruction(cache.profile, pc, instruction, cycles);
+    profileMisses(cache.profile, pc, cache.stats.misses - missesBefore);
+    if (cache.timing != NULL) {
+        profileStalls(cache.profile, pc, cycles - 1);
+    }
+    if (getOpCode(instruction) == JALR) {
+        profileJump(cache.profile, pc, state.pc);
+    }
+}
+
+// Fetches and executes the instruction at state.pc; returns 1 once it was a halt.
+int executeInstruction(stateType &state, cacheStruct &cache) {
+    int halted = 0;
+    int instruction = processorRead(cache, state, translateAddress(cache, state, state.pc, instructionFetch),
+                                    instructionFetch);
+    int opCode = getOpCode(instruction);
+
+    if (cache.timing != NULL) {
+        issueInstruction(*cache.timing, instruction);
+    }
+
+    switch (opCode) {
+        case ADD:
+            add(&state, instruction);
+            break;
+        case NAND:
+            nand(&state, instruction);
+            break;
+        case LW:
+            loadWord(&state, instruction, cache);
+            break;
+        case SW:
+            saveWord(&state, instruction, cache);
+            break;
+        case BEQ:
+            branchEqual(&state, instruction);
+            break;
+        case JALR:
+            jumpAndLink(&state, instruction);
+            break;
+        case NOOP:
+            break;
+        case HALT:
+            halted = 1;
+            break;
+        default:
+            printf("error: opcode isn't recognized");
+            exit(1);
+    }
+
+    state.pc++;
+    if (cache.timing != NULL) {
+        cache.timing->cycle++;
+    }
+    return halted;
+}
+
+// ##########################################################################################
+// # Trace files hold one access per line: "<pc> <type> <address>", where type is i for an #
+// # instruction fetch, l for a load and s for a store. Stores write zero, since only the   #
+// # addresses matter when replaying a trace. Traces get big, so the file is mapped and     #
+// # parsed in place rather than copied through stdio.                                      #
+// ##########################################################################################
+
+void readTrace(char *fileName, std::vector<accessStruct> &trace) {
+    int fileDescriptor = open(fileName, O_RDONLY);
+    struct stat fileStat;
+
+    if (fileDescriptor < 0 || fstat(fileDescriptor, &fileStat) != 0) {
+        printf("error: can't open file %s", fileName);
+        perror("open");
+        exit(1);
+    }
+
+    size_t length = (size_t) fileStat.st_size;
+    if (length == 0) {
+        close(fileDescriptor);
+        return;
+    }
+
+    char *contents = (char *) mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    if (contents == MAP_FAILED) {
+        printf("error: can't map file %s", fileName);
+        perror("mmap");
+        exit(1);
+    }
+
+    char *cursor = contents, *end = contents + length;
+
+    while (cursor < end) {
+        char *lineEnd = (char *) memchr(cursor, '\n', end - cursor);
+        if (lineEnd == NULL) {
+            lineEnd = end;
+        }
+
+        char line[MAXLINELENGTH];
+        size_t lineLength = std::min((size_t) (lineEnd - cursor), (size_t) MAXLINELENGTH - 1);
+        memcpy(line, cursor, lineLength);
+        line[lineLength] = '\0';
+        cursor = lineEnd + 1;
+
+        accessStruct access;
+        char type;
+
+        if (sscanf(line, "%d %c %d", &access.pc, &type, &access.address) != 3
+            || access.address < 0 || access.address >= NUMMEMORY) {
+            printf("error in reading trace line %d\n", (int) trace.size() + 1);
+            exit(1);
+        }
+
+        if (type == 'i') {
+            access.type = instructionFetch;
+        } else if (type == 'l') {
+            access.type = dataLoad;
+        } else if (type == 's') {
+            access.type = dataStore;
+        } else {
+            printf("error in reading trace line %d\n", (int) trace.size() + 1);
+            exit(1);
+        }
+
+        trace.push_back(access);
+    }
+
+    munmap(contents, length);
+    close(fileDescriptor);
+}
+
+void runTrace(const std::vector<accessStruct> &trace, stateType &state, cacheStruct &cache) {
+    runAccesses(trace.data(), trace.size(), state, cache);
+}
+
+void runAccesses(const accessStruct *accesses, size_t numOfAccesses, stateType &state, cacheStruct &cache) {
+    for (size_t i = 0; i < numOfAccesses; i++) {
+        state.pc = accesses[i].pc;
+        int address = translateAddress(cache, state, accesses[i].address, accesses[i].type);
+
+        if (accesses[i].type == dataStore) {
+            processorWrite(cache, state, address, 0);
+        } else {
+            processorRead(cache, state, address, accesses[i].type);
+        }
+
+        // without registers to go by, loads block like fetches
+        if (cache.timing != NULL) {
+            if (accesses[i].type != dataStore) {
+                stallUntil(*cache.timing, cache.timing->lastReady - cache.timing->hitLatency);
+            }
+            if (accesses[i].type == instructionFetch) {
+                cache.timing->numOfInstructions++;
+            }
+            cache.timing->cycle++;
+        }
+    }
+}
+
+
+void reportAction(cacheStruct &cache, int address, int size, enum actionType type) {
+    if (type == memoryToCache || type == memoryToPrefetchBuffer) {
+        cache.stats.wordsFromMemory += size;
+        if (cache.timing != NULL) {
+            long long ready = timeMemoryTransfer(*cache.timing, address, size, true);
+
+            // only a fill into the cache is one the access waits for; prefetches keep their MSHR instead
+            if (type == memoryToCache) {
+                cache.timing->lastFillReady = ready;
+            }
+        }
+    } else if (type == cacheToMemory || type == processorToMemory || type == writeBufferToMemory
+               || type == victimCacheToMemory) {
+        cache.stats.wordsToMemory += size;
+        if (cache.timing != NULL) {
+            timeMemoryTransfer(*cache.timing, address, size, false);
+        }
+    }
+
+    if (cache.eventLog != NULL) {
+        logEvent(*cache.eventLog, address, size, type);
+    } else if (!cache.isQuiet) {
+        printAction(address, size, type);
+    }
+}
+
+void printAction(int address, int size, enum actionType type) {
+    printf("@@@ transferring word [%d-%d] ", address, address + size - 1);
+    if (type == cacheToProcessor) {
+        printf("from the cache to the processor\n");
+    } else if (type == processorToCache) {
+        printf("from the processor to the cache\n");
+    } else if (type == memoryToCache) {
+        printf("from the memory to the cache\n");
+    } else if (type == cacheToMemory) {
+        printf("from the cache to the memory\n");
+    } else if (type == cacheToNowhere) {
+        printf("from the cache to nowhere\n");
+    } else if (type == memoryToPrefetchBuffer) {
+        printf("from the memory to the prefetch buffer\n");
+    } else if (type == prefetchBufferToCache) {
+        printf("from the prefetch buffer to the cache\n");
+    } else if (type == processorToMemory) {
+        printf("from the processor to the memory\n");
+    } else if (type == cacheToWriteBuffer) {
+        printf("from the cache to the write buffer\n");
+    } else if (type == processorToWriteBuffer) {
+        printf("from the processor to the write buffer\n");
+    } else if (type == writeBufferToMemory) {
+        printf("from the write buffer to the memory\n");
+    } else if (type == cacheToVictimCache) {
+        printf("from the cache to the victim cache\n");
+    } else if (type == victimCacheToCache) {
+        printf("from the victim cache to the cache\n");
+    } else if (type == victimCacheToMemory) {
+        printf("from the victim cache to the memory\n");
+    } else if (type == victimCacheToNowhere) {
+        printf("from the victim cache to nowhere\n");
+    } else if (type == victimCacheToWriteBuffer) {
+        printf("from the victim cache to the write buffer\n");
+    } else if (type == missCacheToCache) {
+        printf("from the miss cache to the cache\n");
+    }
+}
+
+int convertNum(int num) {
+    /* convert a 16-bit number into a 32-bit Sun integer */
+
+    if (num & (1 << 15)) {
+        num -= (1 << 16);
+    }
+
+    return (num);
+}
+// ##########################################################################################
+// # getBits: Used to extract each number and data from the instruction. Word is the 32-bit
+// # instruction that's sent in to the function. From is the first part of the bits that    #
+// # are needed for isolation. Argument "to" is the inclusive ending bit position.          #
+// # For instance:                                                                          #
+// # Operation codes are in bits 24, 23, and 22. From = 22, to = 24.                        #
+// # Register A bits are in 21 to 19. From 21 to 19.                                        #
+// ##########################################################################################
+
+
+int getBits(int word, int from, int to) {
+    int mask = ((1 << (to - from + 1)) - 1) << from;
+    return (word & mask) >> from;
+}
+
+// ##########################################################################################
+// # Simply clears the registers before using them. Without doing so, they'll collect garb -#
+// # -age information that's leftover. So, each position in the array is initialized to 0.  #
+// ##########################################################################################
+
+void clearRegisters(stateType *state) {
+    state->pc = 0;
+    int i = 0;
+
+    for (i; i < NUMREGS; i++) {
+        state->reg[i] = 0;
+    }
+}
+
+// ##########################################################################################
+// # Make sure that the offset does not exceed 16 bits. If it did, an error is thrown and   #
+// # the program halts with an exit-code.                                                   #
+// ##########################################################################################
+
+void checkOffset(int offset) {
+    if (offset > NUMMEMORY) {
+        printf("\nout of memory\n");
+        exit(1);
+    }
+}
+
+// ##########################################################################################
+// # Checks if the register is within the limits of 0 to 7 (it's only an 8-bit registry)    #
+// ##########################################################################################
+
+void checkRegister(int reg) {
+    if (reg < REGZERO || reg > (NUMREGS - 1)) {
+        printf("\nunreachable registry state\n");
+        exit(1);
+    }
+}
+
+// ##########################################################################################
+// # The following get* functions grab their respective field from the instruction, as laid #
+// # out in common/isa.h, and return the appropriate integer value for regA, regB, the      #
+// # opcode, the destination register, and the offset.                                      #
+// ##########################################################################################
+
+
+int getOpCode(int word) { return isaOpCode(word); }
+
+int getRegA(int word) { return isaRegA(word); }
+
+int getRegB(int word) { return isaRegB(word); }
+
+int getDestination(int word) { return isaDestination(word); }
+
+int getOffset(int word) { return isaOffset(word); }
+
+// ##########################################################################################
+// # If the add operation code is called for, it will use the by-reference state of the     #
+// # computer and save the values from regA + regB into the destination register.           #
+// ##########################################################################################
+
+void add(stateType *state, int instruction) {
+    int regA, regB, destination;
+    regA = getRegA(instruction);
+    regB = getRegB(instruction);
+    destination = getDestination(instruction);
+
+    checkRegister(regA);
+    checkRegister(regB);
+
+    state->reg[destination] = state->reg[regA] + state->reg[regB];
+}
+
+// ##########################################################################################
+// # If the nand operation code is called for, it will use the by-reference state of the    #
+// # computer and save the value from ~(regA & regB) into the destination register.         #
+// ##########################################################################################
+
+void nand(stateType *state, int instruction) {
+    int regA, regB, destination;
+    regA = getRegA(instruction);
+    regB = getRegB(instruction);
+    destination = getDestination(instruction);
+
+    checkRegister(regA);
+    checkRegister(regB);
+
+    state->reg[destination] = ~(state->reg[regA] & state->reg[regB]);
+}
+
+// ##########################################################################################
+// # If the LW operation code is called for, it will use the by-reference state of the      #
+// # computer and load the value from the offset plus regA into regB.                       #
+// ##########################################################################################
+
+void loadWord(stateType *state, int instruction, cacheStruct &cache) {
+    int regA, regB, offset = getOffset(instruction);
+    offset = convertNum(offset);
+
+    regA = getRegA(instruction);
+    regB = getRegB(instruction);
+
+    checkRegister(regA);
+    checkRegister(regB);
+    checkOffset(offset);
+
+
+    int address = translateAddress(cache, *state, offset + state->reg[regA], dataLoad);
+
+    state->reg[regB] = processorRead(cache, *state, address, dataLoad);
+
+    if (cache.timing != NULL) {
+        cache.timing->registerReady[regB] = cache.timing->lastReady - cache.timing->hitLatency;
+    }
+}
+
+int getLoadWordFromCache(cacheStruct &cache, int address) {
+    blockStruct *block = getCacheBlock(cache, address);
+
+    if (block != NULL) {
+        return block->lines[getBlockOffset(cache, address)];
+    }
+
+    return 0;
+}
+
+// ##########################################################################################
+// # If the SW operation code is called for, it will use the by-reference state of the      #
+// # computer and save the value of regB into a memory destination of offset + regA.        #
+// ##########################################################################################
+
+void saveWord(stateType *state, int instruction, cacheStruct &cache) {
+    int regA, regB, offset = getOffset(instruction);
+
+    offset = convertNum(offset);
+
+    regA = getRegA(instruction);
+    regB = getRegB(instruction);
+
+    checkRegister(regA);
+    checkRegister(regB);
+    checkOffset(offset);
+
+
+    int address = translateAddress(cache, *state, offset + state->reg[regA], dataStore);
+
+    if (cache.debugger != NULL) {
+        noteStore(cache.debugger, offset + state->reg[regA]);
+    }
+    processorWrite(cache, *state, address, state->reg[regB]);
+}
+
+void saveToCache(cacheStruct &cache, int address, int data) {
+    blockStruct *block = getCacheBlock(cache, address);
+
+    if (block != NULL) {
+        if (!cache.isTagOnly) {
+            block->lines[getBlockOffset(cache, address)] = data;
+        }
+        block->isDirty = true;
+        if (cache.sectors != NULL) {
+            block->dirtySectors |= getSectorBit(cache, address);
+        }
+    }
+}
+
+// ##########################################################################################
+// # If the add operation code is called for, it will use the by-reference state of the     #
+// # computer and compare the values in regA and regB. If they're equal, it'll branch into  #
+// # the PC of PC + offset (plus 1, but that's incremented regardless in the while).        #
+// ##########################################################################################
+
+void branchEqual(stateType *state, int instruction) {
+    int regA, regB, offset = getOffset(instruction);
+    offset = convertNum(offset);
+
+    regA = getRegA(instruction);
+    regB = getRegB(instruction);
+
+    checkRegister(regA);
+    checkRegister(regB);
+    checkOffset(offset);
+
+    if (state->reg[regA] == state->reg[regB]) {
+        state->pc += offset;
+    }
+}
+
+// ##########################################################################################
+// # If the JALR operation code is called for, it will use the by-reference state of the    #
+// # computer and save the current PC + 1 into regB, then the PC will be replaced with the  #
+// # count in regA.                                                                         #
+// ##########################################################################################
+
+void jumpAndLink(stateType *state, int instruction) {
+    int regA, regB;
+
+    regA = getRegA(instruction);
+    regB = getRegB(instruction);
+
+    checkRegister(regA);
+    checkRegister(regB);
+
+    state->reg[regB] = state->pc + 1;
+    state->pc = state->reg[regA] - 1;
+}
+
+//// ########################################################################################################
+//// #                                CACHE FUNCTIONS: Initialize the Blocks                                #
+//// ########################################################################################################
+
+void initializeCacheBlocks(cacheStruct &cache) {
+    setNumberOfBits(cache);
+
+    for (int i = 0; i < MAXNUMOFBLOCKS + 8; i++) {
+        cache.tags[i] = -1;
+    }
+    memset(cache.lastWays, 0, sizeof(cache.lastWays));
+
+    for (int i = 0; i < MAXNUMOFBLOCKS; i++) {
+        cache.blocks[i].tag = -1;
+        cache.blocks[i].isValid = false;
+        cache.blocks[i].isDirty = false;
+        cache.blocks[i].LRU = 0;
+        cache.blocks[i].setIndex = -1;
+        cache.blocks[i].isPrefetched = false;
+        cache.blocks[i].coherence = invalidState;
+        memset(cache.blocks[i].touchedWords, 0, sizeof(cache.blocks[i].touchedWords));
+        cache.blocks[i].validSectors = 0;
+        cache.blocks[i].dirtySectors = 0;
+    }
+
+    // partition the cache into sets and block-indices per set
+    // using integer division to combine all of the blocks (numSets * blocksPer) into categories
+    for (int i = 0; i < (cache.numOfSets * cache.blocksPerSet); i++) {
+        cache.blocks[i].setIndex = (i / cache.blocksPerSet);
+        cache.blocks[i].blockIndex = (i % cache.blocksPerSet);
+    }
+
+    // the data is sized to the geometry, not to the largest cache the array allows
+    if (cache.isTagOnly) {
+        std::vector<int>().swap(cache.lineData);
+    } else {
+        cache.lineData.assign(cache.numOfSets * cache.blocksPerSet * cache.blockSize, 0);
+    }
+    for (int i = 0; i < MAXNUMOFBLOCKS; i++) {
+        bool hasData = !cache.isTagOnly && i < cache.numOfSets * cache.blocksPerSet;
+        cache.blocks[i].lines = hasData ? &cache.lineData[i * cache.blockSize] : NULL;
+    }
+
+}
+
+void setNumberOfBits(cacheStruct &cache) {
+    int numOfBlockBits = log2(cache.blockSize);
+    int numOfSetBits = log2(cache.numOfSets);
+
+    cache.blockBits = numOfBlockBits;
+    cache.setBits = numOfSetBits;
+}
+
+//// ########################################################################################################
+//// #                       CACHE FUNCTIONS: Get the tag, set offset, and block offset                     #
+//// ########################################################################################################
+
+int getBlockOffset(cacheStruct &cache, int address) {
+    return getBits(address, 0, cache.blockBits - 1);
+}
+
+int getSetOffset(cacheStruct &cache, int address) {
+    return getBits(address, cache.blockBits, cache.blockBits + cache.setBits - 1);
+}
+
+int getTag(cacheStruct &cache, int address) {
+    return getBits(address, cache.setBits + cache.blockBits, 30);
+}
+
+//// ########################################################################################################
+//// #                       CACHE FUNCTIONS: Load the dang data                                            #
+//// ########################################################################################################
+
+void loadCacheFromMemory(cacheStruct &cache, stateStruct &state, int address) {
+    int setOffset = getSetOffset(cache, address);
+    int tag = getTag(cache, address);
+    // with sectors, the block may already be there with only this sector missing
+    blockStruct *presentBlock = cache.sectors == NULL ? NULL : getCacheBlock(cache, address);
+    int bestBlockIndex = presentBlock != NULL ? presentBlock->blockIndex
+                                              : findBestBlock(cache, setOffset, tag, address, state);
+    int fillSize = getFillSize(cache);
+    int fillAddress = address - (address % fillSize);
+    int lineIndex = fillAddress % cache.blockSize;
+
+    // a set's blocks sit next to each other in blocks[], way by way
+    blockStruct &block = cache.blocks[setOffset * cache.blocksPerSet + bestBlockIndex];
+
+    if (cache.sectors != NULL) {
+        if (presentBlock != NULL) {
+            cache.sectors->sectorMisses++;
+            updateLRU(cache, address);
+        } else {
+            block.validSectors = 0;
+            block.dirtySectors = 0;
+            cache.sectors->blockWordsFetched += cache.blockSize;
+        }
+        block.validSectors |= getSectorBit(cache, address);
+        cache.sectors->wordsFetched += fillSize;
+    }
+
+    if (cache.isTagOnly) {
+        return;
+    }
+
+    for (int j = fillAddress; j < (fillAddress + fillSize); j++) {
+        block.lines[lineIndex] = state.mem[j];
+        lineIndex++;
+    }
+
+}
+
+// ##########################################################################################
+// # LRU counts the age of every block in the set since it was last touched, FIFO since it  #
+// # was filled (updateLRU leaves it alone on hits), and either way the oldest block goes.  #
+// # Random picks any way once the set is full. Invalid blocks always go first.             #
+// ##########################################################################################
+
+int findBestBlock(cacheStruct &cache, int setOffset, int tag, int address, stateStruct &state) {
+    int highestLRU = 0;
+    bool isSetFull = true;
+    int firstBlock = setOffset * cache.blocksPerSet, lastBlock = firstBlock + cache.blocksPerSet;
+
+    for (int i = firstBlock; i < lastBlock; i++) {
+        cache.blocks[i].LRU++;
+        if (cache.blocks[i].LRU > highestLRU) {
+            highestLRU = cache.blocks[i].LRU;
+        }
+        if (cache.blocks[i].isValid == false) {
+            isSetFull = false;
+        }
+    }
+
+    int randomWay = -1;
+    if (cache.policy == randomPolicy && isSetFull) {
+        randomWay = (int) (nextRandom(cache) % cache.blocksPerSet);
+    }
+
+    for (int i = firstBlock; i < lastBlock; i++) {
+        if (cache.blocks[i].isValid == false) {
+            cache.blocks[i].isValid = true;
+            setBlockTag(cache, cache.blocks[i], tag);
+            cache.blocks[i].LRU = 0;
+            return cache.blocks[i].blockIndex;
+        } else if (randomWay >= 0 ? cache.blocks[i].blockIndex == randomWay : cache.blocks[i].LRU >= highestLRU) {
+            int oldAddress = getOldAddress(cache.blocks[i], cache);
+
+            if (cache.blocks[i].isPrefetched) {
+                cache.prefetcher->stats.unusedEvicted++;
+                cache.blocks[i].isPrefetched = false;
+            }
+
+            recordEviction(cache, cache.blocks[i]);
+
+            if (cache.victimCache != NULL && !cache.victimCache->isMissCache) {
+                moveToVictimCache(cache, state, cache.blocks[i], oldAddress);
+                cache.blocks[i].isDirty = false;
+            } else if (cache.blocks[i].isDirty && cache.sectors != NULL) {
+                writeBackSectors(cache, state, cache.blocks[i], oldAddress);
+                cache.stats.writebacks++;
+            } else if (cache.blocks[i].isDirty) {
+                sendDirtyCacheToMemory(cache.blocks[i], state, oldAddress, cache.blockSize);
+                sendToMemory(cache, oldAddress, cache.blockSize, cacheToMemory);
+                cache.stats.writebacks++;
+            } else {
+                reportAction(cache, oldAddress, cache.blockSize, cacheToNowhere);
+            }
+
+            cache.blocks[i].isValid = true;
+            setBlockTag(cache, cache.blocks[i], tag);
+            cache.blocks[i].LRU = 0;
+            return cache.blocks[i].blockIndex;
+        }
+    }
+
+    return -1;
+}
+
+// xorshift, seeded per cache so a random-policy run is the same every time
+unsigned int nextRandom(cacheStruct &cache) {
+    cache.randomState ^= cache.randomState << 13;
+    cache.randomState ^= cache.randomState >> 17;
+    cache.randomState ^= cache.randomState << 5;
+    return cache.randomState;
+}
+
+int getOldAddress(blockStruct &block, cacheStruct &cache) {
+    return (block.tag << (cache.setBits + cache.blockBits)) + (block.setIndex << cache.blockBits);
+}
+
+void sendDirtyCacheToMemory(blockStruct &block, stateStruct &state, int address, int blockSize) {
+    block.isDirty = false;
+
+    // a tag-only cache writes memory as it goes
+    if (block.lines == NULL) {
+        return;
+    }
+
+    int minus = address % blockSize;
+    int memAddress = address - minus;
+
+    for (int i = 0; i < blockSize; i++) {
+        state.mem[memAddress] = block.lines[i];
+        memAddress++;
+    }
+}
+
+bool isCacheHit(cacheStruct &cache, int address) {
+    blockStruct *block = getCacheBlock(cache, address);
+
+    return block != NULL && (cache.sectors == NULL || (block->validSectors & getSectorBit(cache, address)) != 0);
+}
+
+// Only the order of the ages within a set matters, so only the accessed set ages.
+void updateLRU(cacheStruct &cache, int address) {
+    if (cache.policy != lruPolicy) {
+        return;
+    }
+
+    int tag = getTag(cache, address);
+    int firstBlock = getSetOffset(cache, address) * cache.blocksPerSet;
+
+    for (int i = firstBlock; i < firstBlock + cache.blocksPerSet; i++) {
+        if (cache.blocks[i].tag == tag) {
+            cache.blocks[i].LRU = 0;
+        } else {
+            cache.blocks[i].LRU++;
+        }
+    }
+}
+
+//// ########################################################################################################
+//// #                  CACHE FUNCTIONS: The processor's side of the cache (fetches, loads, stores)         #
+//// ########################################################################################################
+
+int processorRead(cacheStruct &cache, stateType &state, int address, enum accessType type) {
+    recordAccess(cache, state, address, type);
+
+    if (cache.isBypassed) {
+        return state.mem[address];
+    }
+
+    if (cache.bus != NULL) {
+        return coherentRead(cache, address);
+    }
+
+    int minus = address % getFillSize(cache);
+    int printAddress = address - minus;
+
+    bool wasHit = isCacheHit(cache, address), wasBufferHit = false;
+
+    recordDetailedStats(cache, address, wasHit);
+    beginTimedAccess(cache, address, wasHit);
+    if (cache.wayPredictor != NULL) {
+        checkWayPrediction(cache, state, address, type, wasHit);
+    }
+
+    cache.stats.accesses++;
+    if (wasHit) {
+        cache.stats.hits++;
+    } else {
+        cache.stats.misses++;
+        wasBufferHit = takeFromVictimCache(cache, state, address) || takeFromPrefetchBuffer(cache, state, address);
+        if (!wasBufferHit) {
+            loadCacheFromMemory(cache, state, address);
+            reportAction(cache, printAddress, getFillSize(cache), memoryToCache);
+            copyToMissCache(cache, address);
+        }
+    }
+
+    reportAction(cache, address, 1, cacheToProcessor);
+    updateLRU(cache, address);
+
+    int data = cache.isTagOnly ? state.mem[address] : getLoadWordFromCache(cache, address);
+    if (cache.wayPredictor != NULL) {
+        trainWayPredictor(cache, state, address, type);
+    }
+    endTimedAccess(cache, wasHit, wasBufferHit);
+    runPrefetcher(cache, state, address, type, wasHit, wasBufferHit);
+
+    return data;
+}
+
+void processorWrite(cacheStruct &cache, stateType &state, int address, int data) {
+    recordAccess(cache, state, address, dataStore);
+
+    if (cache.isBypassed) {
+        state.mem[address] = data;
+        return;
+    }
+
+    if (cache.bus != NULL) {
+        coherentWrite(cache, address, data);
+        return;
+    }
+
+    int minus = address % getFillSize(cache);
+    int printAddress = address - minus;
+
+    bool wasHit = isCacheHit(cache, address), wasBufferHit = false;
+
+    recordDetailedStats(cache, address, wasHit);
+    beginTimedAccess(cache, address, wasHit);
+    if (cache.wayPredictor != NULL) {
+        checkWayPrediction(cache, state, address, dataStore, wasHit);
+    }
+
+    cache.stats.accesses++;
+    // a victim cache may be holding the only up-to-date copy of the block, so that has to come back in regardless
+    if (!wasHit && !cache.isWriteAllocate && findVictimEntry(cache, address) == NULL) {
+        cache.stats.misses++;
+        state.mem[address] = data;
+        sendToMemory(cache, address, 1, processorToMemory);
+        endTimedAccess(cache, wasHit, wasBufferHit);
+        runPrefetcher(cache, state, address, dataStore, wasHit, wasBufferHit);
+        return;
+    } else if (!wasHit) {
+        cache.stats.misses++;
+        wasBufferHit = takeFromVictimCache(cache, state, address) || takeFromPrefetchBuffer(cache, state, address);
+        if (!wasBufferHit) {
+            loadCacheFromMemory(cache, state, address);
+            reportAction(cache, printAddress, getFillSize(cache), memoryToCache);
+            copyToMissCache(cache, address);
+        }
+    } else {
+        cache.stats.hits++;
+        updateLRU(cache, address);
+    }
+
+    saveToCache(cache, address, data);
+    if (cache.isTagOnly) {
+        state.mem[address] = data;
+    }
+    reportAction(cache, address, 1, processorToCache);
+
+    if (cache.isWriteThrough) {
+        getCacheBlock(cache, address)->isDirty = false;
+        state.mem[address] = data;
+        sendToMemory(cache, address, 1, cacheToMemory);
+    }
+
+    if (cache.wayPredictor != NULL) {
+        trainWayPredictor(cache, state, address, dataStore);
+    }
+    endTimedAccess(cache, wasHit, wasBufferHit);
+    runPrefetcher(cache, state, address, dataStore, wasHit, wasBufferHit);
+}
+
+void recordAccess(cacheStruct &cache, stateType &state, int address, enum accessType type) {
+    if (cache.banks != NULL) {
+        recordBankAccess(*cache.banks, address, type);
+    }
+
+    if (cache.recordFile != NULL) {
+        char typeLetter = type == instructionFetch ? 'i' : (type == dataLoad ? 'l' : 's');
+        fprintf(cache.recordFile, "%d %c %d\n", state.pc, typeLetter, address);
+    }
+
+    if (cache.recordTrace != NULL) {
+        accessStruct access = {state.pc, address, type};
+        cache.recordTrace->push_back(access);
+    }
+
+    if (cache.stream != NULL) {
+        pushAccess(*cache.stream, state.pc, address, type);
+    }
+
+    if (cache.analysis != NULL) {
+        addStackAccess(*cache.analysis, address);
+    }
+}
+
+//// ########################################################################################################
+//// #            STACK DISTANCE: One pass over the accesses gives the LRU miss rate of every geometry      #
+//// ########################################################################################################
+
+// ##########################################################################################
+// # Mattson's observation: an LRU cache of associativity A hits exactly when fewer than A  #
+// # distinct blocks of the same set were touched since the last touch of this block. So a  #
+// # single histogram of those distances per set count covers every associativity at once, #
+// # and one stack per power-of-two set count (1, 2, 4, ... maxSets) covers every geometry.  #
+// ##########################################################################################
+
+void initializeAnalysis(analysisStruct &analysis, int blockSize, int maxSets, int maxWays) {
+    if (blockSize < 1 || (blockSize & (blockSize - 1)) != 0 || maxSets < 1 || maxWays < 1) {
+        printf("error: unsupported cache geometry %d %d %d\n", blockSize, maxSets, maxWays);
+        exit(1);
+    }
+
+    analysis.blockSize = blockSize;
+    analysis.maxWays = maxWays;
+    analysis.accesses = 0;
+
+    for (int numOfSets = 1; numOfSets <= maxSets; numOfSets *= 2) {
+        stackDistanceStruct stack;
+        stack.numOfSets = numOfSets;
+        stack.sets.resize(numOfSets);
+        stack.histogram.assign(maxWays + 1, 0);
+        stack.coldMisses = 0;
+
+        for (int i = 0; i < numOfSets; i++) {
+            stack.sets[i].clock = 0;
+            stack.sets[i].tree.assign(64, 0);
+        }
+
+        analysis.stacks.push_back(stack);
+    }
+}
+
+void addStackAccess(analysisStruct &analysis, int address) {
+    int block = address / analysis.blockSize;
+
+    analysis.accesses++;
+
+    for (size_t i = 0; i < analysis.stacks.size(); i++) {
+        stackDistanceStruct &stack = analysis.stacks[i];
+        int distance = getStackDistance(stack.sets[block % stack.numOfSets], block);
+
+        if (distance < 0) {
+            stack.coldMisses++;
+        } else if (distance < analysis.maxWays) {
+            stack.histogram[distance]++;
+        } else {
+            stack.histogram[analysis.maxWays]++;
+        }
+    }
+}
+
+// ##########################################################################################
+// # Returns how many distinct blocks of this set were touched since block was last, or -1  #
+// # the first time the block is seen, then moves block to the top of the stack.            #
+// ##########################################################################################
+
+int getStackDistance(stackSetStruct &set, int block) {
+    if (set.clock + 1 >= (int) set.tree.size()) {
+        compactStackSet(set);
+    }
+
+    int distance = -1;
+    std::unordered_map<int, int>::iterator last = set.lastAccess.find(block);
+
+    if (last != set.lastAccess.end()) {
+        distance = sumOfTree(set.tree, set.clock) - sumOfTree(set.tree, last->second);
+        addToTree(set.tree, last->second, -1);
+    }
+
+    set.clock++;
+    addToTree(set.tree, set.clock, 1);
+    set.lastAccess[block] = set.clock;
+
+    return distance;
+}
+
+// ##########################################################################################
+// # Times only ever grow, so when the tree fills up the live blocks are renumbered 1..n in #
+// # the same order and the tree is rebuilt twice as large as what's live. Each rebuild is  #
+// # paid for by the n accesses that filled the space, keeping accesses O(log n) amortized.  #
+// ##########################################################################################
+
+void compactStackSet(stackSetStruct &set) {
+    std::vector<std::pair<int, int> > live;
+
+    for (std::unordered_map<int, int>::iterator it = set.lastAccess.begin(); it != set.lastAccess.end(); ++it) {
+        live.push_back(std::make_pair(it->second, it->first));
+    }
+    std::sort(live.begin(), live.end());
+
+    set.tree.assign(std::max((size_t) 64, 2 * live.size() + 2), 0);
+    for (size_t i = 0; i < live.size(); i++) {
+        set.lastAccess[live[i].second] = (int) i + 1;
+        addToTree(set.tree, (int) i + 1, 1);
+    }
+
+    set.clock = (int) live.size();
+}
+
+void addToTree(std::vector<int> &tree, int position, int delta) {
+    for (; position < (int) tree.size(); position += position & -position) {
+        tree[position] += delta;
+    }
+}
+
+int sumOfTree(std::vector<int> &tree, int position) {
+    int sum = 0;
+
+    for (; position > 0; position -= position & -position) {
+        sum += tree[position];
+    }
+
+    return sum;
+}
+
+void printAnalysis(analysisStruct &analysis) {
+    printf("stack distance: block size %d, %lld accesses, %lld distinct blocks\n", analysis.blockSize,
+           analysis.accesses, analysis.stacks[0].coldMisses);
+    printf("%8s %8s %8s %12s %10s\n", "sets", "ways", "words", "misses", "miss rate");
+
+    for (size_t i = 0; i < analysis.stacks.size(); i++) {
+        stackDistanceStruct &stack = analysis.stacks[i];
+        long long hits = 0;
+
+        for (int ways = 1; ways <= analysis.maxWays; ways++) {
+            hits += stack.histogram[ways - 1];
+            long long misses = analysis.accesses - hits;
+            double missRate = analysis.accesses == 0 ? 0.0 : (double) misses / analysis.accesses;
+
+            printf("%8d %8d %8d %12lld %10.4f\n", stack.numOfSets, ways,
+                   stack.numOfSets * ways * analysis.blockSize, misses, missRate);
+        }
+    }
+}
+
+//// ########################################################################################################
+//// #           SWEEP: Every geometry and policy in the given ranges, replayed on a pool of threads        #
+//// ########################################################################################################
+
+// ##########################################################################################
+// # The trace is built (or read) once and only ever read by the workers. Each worker pulls #
+// # the next configuration off a shared counter and runs it on its own cache and memory,   #
+// # quietly, so nothing is shared between them but the trace and their own result row.    #
+// ##########################################################################################
+
+void runSweep(std::vector<accessStruct> &trace, optionsType &options) {
+    sweepStruct sweep;
+    sweep.trace = &trace;
+    buildSweep(sweep, options);
+
+    int numOfThreads = std::min(options.numOfThreads, (int) sweep.configs.size());
+    std::vector<std::thread> workers;
+
+    for (int i = 0; i < numOfThreads; i++) {
+        workers.push_back(std::thread(runSweepWorker, std::ref(sweep)));
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+
+    printSweep(sweep, options);
+}
+
+// Every geometry and policy in the ranges, skipping any the cache array can't hold.
+void buildSweep(sweepStruct &sweep, optionsType &options) {
+    sweep.nextConfig = 0;
+    sweep.writeBufferSize = options.writeBufferSize;
+    sweep.victimCacheSize = options.victimCacheSize;
+    sweep.isMissCache = options.isMissCache;
+
+    for (int blockSize = options.blockSizes.min; blockSize <= options.blockSizes.max; blockSize *= 2) {
+        for (int numOfSets = options.sets.min; numOfSets <= options.sets.max; numOfSets *= 2) {
+            for (int blocksPerSet = options.ways.min; blocksPerSet <= options.ways.max; blocksPerSet++) {
+                for (size_t i = 0; i < options.policies.size(); i++) {
+                    for (size_t j = 0; j < options.writePolicies.size(); j++) {
+                        sweepConfigStruct config;
+                        config.blockSize = blockSize;
+                        config.numOfSets = numOfSets;
+                        config.blocksPerSet = blocksPerSet;
+                        config.policy = options.policies[i];
+                        config.writePolicy = options.writePolicies[j];
+
+                        if ((blockSize & (blockSize - 1)) == 0 && (numOfSets & (numOfSets - 1)) == 0
+                            && blockSize <= 256 && numOfSets * blocksPerSet <= MAXNUMOFBLOCKS) {
+                            sweep.configs.push_back(config);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void runSweepWorker(sweepStruct &sweep) {
+    // both are far too big for a thread's stack
+    cacheStruct *cache = new cacheStruct;
+    stateType *state = new stateType;
+    writeBufferStruct writeBuffer;
+    victimCacheStruct victimCache;
+
+    memset(state->mem, 0, sizeof(state->mem));
+    state->numMemory = 0;
+
+    for (int next = sweep.nextConfig++; next < (int) sweep.configs.size(); next = sweep.nextConfig++) {
+        sweepConfigStruct &config = sweep.configs[next];
+
+        configureSweepCache(*cache, config, sweep, writeBuffer, victimCache);
+
+        cacheEngineFunction engine = getCacheEngine(*cache);
+        if (engine != NULL) {
+            engine(*cache, sweep.trace->data(), sweep.trace->size());
+        } else {
+            runTrace(*sweep.trace, *state, *cache);
+        }
+
+        if (cache->writeBuffer != NULL) {
+            drainWriteBuffer(*cache, 0);
+        }
+        config.stats = cache->stats;
+    }
+
+    delete state;
+    delete cache;
+}
+
+// A quiet, tag-only cache for one configuration; the write buffer and victim cache are only hung on if the sweep uses them.
+void configureSweepCache(cacheStruct &cache, sweepConfigStruct &config, sweepStruct &sweep,
+                         writeBufferStruct &writeBuffer, victimCacheStruct &victimCache) {
+    configureCache(cache, config.blockSize, config.numOfSets, config.blocksPerSet);
+    cache.policy = config.policy;
+    cache.isWriteThrough = config.writePolicy.isWriteThrough;
+    cache.isWriteAllocate = config.writePolicy.isWriteAllocate;
+    cache.isQuiet = true;
+    cache.isTagOnly = true;
+    initializeCacheBlocks(cache);
+
+    if (sweep.writeBufferSize > 0) {
+        initializeWriteBuffer(writeBuffer, sweep.writeBufferSize);
+        cache.writeBuffer = &writeBuffer;
+    }
+
+    if (sweep.victimCacheSize > 0) {
+        initializeVictimCache(victimCache, sweep.victimCacheSize, sweep.isMissCache, config.blockSize);
+        cache.victimCache = &victimCache;
+    }
+}
+
+void printSweep(sweepStruct &sweep, optionsType &options) {
+    FILE *output = stdout;
+
+    if (options.outputFileName != NULL) {
+        output = fopen(options.outputFileName, "w");
+        if (output == NULL) {
+            printf("error: can't open file %s", options.outputFileName);
+            perror("fopen");
+            exit(1);
+        }
+    }
+
+    if (options.json) {
+        fprintf(output, "[\n");
+    } else {
+        fprintf(output, "blockSize,numOfSets,blocksPerSet,policy,writePolicy,accesses,hits,misses,hitRate,writebacks,"
+                        "wordsFromMemory,wordsToMemory,memoryTraffic\n");
+    }
+
+    for (size_t i = 0; i < sweep.configs.size(); i++) {
+        sweepConfigStruct &config = sweep.configs[i];
+        cacheStatsStruct &stats = config.stats;
+        double hitRate = stats.accesses == 0 ? 0.0 : (double) stats.hits / stats.accesses;
+        long long memoryTraffic = stats.wordsFromMemory + stats.wordsToMemory;
+
+        if (options.json) {
+            fprintf(output, "  {\"blockSize\": %d, \"numOfSets\": %d, \"blocksPerSet\": %d, \"policy\": \"%s\", "
+                            "\"writePolicy\": \"%s\", \"accesses\": %lld, \"hits\": %lld, \"misses\": %lld, \"hitRate\": %.6f, "
+                            "\"writebacks\": %lld, \"wordsFromMemory\": %lld, \"wordsToMemory\": %lld, "
+                            "\"memoryTraffic\": %lld}%s\n",
+                    config.blockSize, config.numOfSets, config.blocksPerSet, getPolicyName(config.policy),
+                    getWritePolicyName(config.writePolicy), stats.accesses, stats.hits, stats.misses, hitRate, stats.writebacks, stats.wordsFromMemory,
+                    stats.wordsToMemory, memoryTraffic, i + 1 < sweep.configs.size() ? "," : "");
+        } else {
+            fprintf(output, "%d,%d,%d,%s,%s,%lld,%lld,%lld,%.6f,%lld,%lld,%lld,%lld\n", config.blockSize,
+                    config.numOfSets, config.blocksPerSet, getPolicyName(config.policy),
+                    getWritePolicyName(config.writePolicy), stats.accesses, stats.hits,
+                    stats.misses, hitRate, stats.writebacks, stats.wordsFromMemory, stats.wordsToMemory,
+                    memoryTraffic);
+        }
+    }
+
+    if (options.json) {
+        fprintf(output, "]\n");
+    }
+
+    if (output != stdout) {
+        fclose(output);
+    }
+}
+
+//// ########################################################################################################
+//// #        STREAMING: The program on one thread, the cache models on others, a ring between them         #
+//// ########################################################################################################
+
+// ##########################################################################################
+// # A tag-only cache never changes what the program computes, so the two halves needn't    #
+// # take turns. The program runs here behind a bypassed cache whose accesses go into one   #
+// # ring per consumer, and each consumer thread replays them, a ring-full at a time, into  #
+// # the caches it was given: round robin, so the work spreads out. Nothing is ever stored  #
+// # whole, and when this returns every cache has seen every access.                        #
+// ##########################################################################################
+
+void runStreamed(stateType &state, std::vector<cacheStruct *> &caches, int numOfConsumers, FILE *recordFile) {
+    streamStruct stream;
+    cacheStruct *front = new cacheStruct;
+
+    for (int i = 0; i < numOfConsumers; i++) {
+        stream.rings.emplace_back();
+        accessRingStruct &ring = stream.rings.back();
+        ring.ring.resize(ACCESSRINGCAPACITY);
+        ring.head = 0;
+        ring.tailSeen = 0;
+        ring.tail = 0;
+        ring.isDone = false;
+    }
+    for (size_t i = 0; i < caches.size(); i++) {
+        stream.rings[i % numOfConsumers].caches.push_back(caches[i]);
+    }
+    for (int i = 0; i < numOfConsumers; i++) {
+        stream.rings[i].consumer = std::thread(runStreamConsumer, std::ref(stream.rings[i]));
+    }
+
+    configureCache(*front, 1, 1, 1);
+    front->isBypassed = true;
+    front->recordFile = recordFile;
+    front->stream = &stream;
+    runProgram(state, *front);
+
+    for (int i = 0; i < numOfConsumers; i++) {
+        stream.rings[i].isDone.store(true, std::memory_order_release);
+        stream.rings[i].consumer.join();
+    }
+    delete front;
+}
+
+void pushAccess(streamStruct &stream, int pc, int address, enum accessType type) {
+    for (size_t i = 0; i < stream.rings.size(); i++) {
+        accessRingStruct &ring = stream.rings[i];
+        size_t head = ring.head.load(std::memory_order_relaxed);
+
+        while (head - ring.tailSeen == ACCESSRINGCAPACITY) {
+            ring.tailSeen = ring.tail.load(std::memory_order_acquire);
+            if (head - ring.tailSeen == ACCESSRINGCAPACITY) {
+                std::this_thread::yield();
+            }
+        }
+
+        accessStruct &access = ring.ring[head % ACCESSRINGCAPACITY];
+        access.pc = pc;
+        access.address = address;
+        access.type = type;
+
+        ring.head.store(head + 1, std::memory_order_release);
+    }
+}
+
+void runStreamConsumer(accessRingStruct &ring) {
+    // far too big for a thread's stack; a tag-only cache only writes stores through to it
+    stateType *state = new stateType;
+    std::vector<cacheEngineFunction> engines;
+
+    memset(state->mem, 0, sizeof(state->mem));
+    state->numMemory = 0;
+    for (size_t i = 0; i < ring.caches.size(); i++) {
+        engines.push_back(getCacheEngine(*ring.caches[i]));
+    }
+
+    while (true) {
+        bool isDone = ring.isDone.load(std::memory_order_acquire);
+        size_t tail = ring.tail.load(std::memory_order_relaxed);
+        size_t head = ring.head.load(std::memory_order_acquire);
+
+        if (tail == head) {
+            if (isDone) {
+                break;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+
+        // everything up to the end of the ring in one go
+        size_t start = tail % ACCESSRINGCAPACITY;
+        size_t count = std::min(head - tail, ACCESSRINGCAPACITY - start);
+
+        for (size_t i = 0; i < ring.caches.size(); i++) {
+            if (engines[i] != NULL) {
+                engines[i](*ring.caches[i], &ring.ring[start], count);
+            } else {
+                runAccesses(&ring.ring[start], count, *state, *ring.caches[i]);
+            }
+        }
+
+        ring.tail.store(tail + count, std::memory_order_release);
+    }
+
+    delete state;
+}
+
+// -sweep -stream: every configuration gets its own cache, fed as the program runs, instead of replaying a trace.
+void runStreamedSweep(stateType &state, optionsType &options, FILE *recordFile) {
+    sweepStruct sweep;
+    std::vector<cacheStruct *> caches;
+    std::vector<writeBufferStruct> writeBuffers;
+    std::deque<victimCacheStruct> victimCaches;
+
+    sweep.trace = NULL;
+    buildSweep(sweep, options);
+    writeBuffers.resize(sweep.configs.size());
+    victimCaches.resize(sweep.configs.size());
+
+    for (size_t i = 0; i < sweep.configs.size(); i++) {
+        caches.push_back(new cacheStruct);
+        configureSweepCache(*caches[i], sweep.configs[i], sweep, writeBuffers[i], victimCaches[i]);
+    }
+
+    int numOfConsumers = std::max(1, std::min(options.numOfThreads, (int) sweep.configs.size()));
+    runStreamed(state, caches, numOfConsumers, recordFile);
+
+    for (size_t i = 0; i < sweep.configs.size(); i++) {
+        if (caches[i]->writeBuffer != NULL) {
+            drainWriteBuffer(*caches[i], 0);
+        }
+        sweep.configs[i].stats = caches[i]->stats;
+        delete caches[i];
+    }
+
+    printSweep(sweep, options);
+}
+
+//// ########################################################################################################
+//// #          PREFETCHING: Next-line, per-pc stride and stream buffers, with how much of it paid off      #
+//// ########################################################################################################
+
+void initializePrefetcher(prefetcherStruct &prefetcher, optionsType &options) {
+    prefetcher.type = options.prefetcher;
+    prefetcher.degree = options.prefetchDegree;
+    prefetcher.distance = options.prefetchDistance;
+    prefetcher.isIntoBuffer = options.prefetchBufferSize > 0;
+    prefetcher.nextBufferEntry = 0;
+    memset(&prefetcher.stats, 0, sizeof(prefetcher.stats));
+
+    prefetchEntryStruct emptyEntry = {-1, false, 0};
+    prefetcher.buffer.assign(options.prefetchBufferSize, emptyEntry);
+
+    strideEntryStruct emptyStride = {-1, 0, 0, false};
+    prefetcher.strideTable.assign(64, emptyStride);
+
+    // stream buffers always sit beside the cache, that's what makes them stream buffers
+    if (prefetcher.type == streamPrefetcher) {
+        prefetcher.isIntoBuffer = true;
+        prefetcher.streams.resize(options.numOfStreams);
+        prefetcher.streamLastUse.assign(options.numOfStreams, 0);
+    }
+}
+
+blockStruct *getCacheBlock(cacheStruct &cache, int address) {
+    int set = getSetOffset(cache, address);
+    int firstBlock = set * cache.blocksPerSet;
+    int tag = getTag(cache, address);
+
+    // an access looks its block up several times, and the next access usually wants the same one; below 8 ways the
+    // full search is about as cheap as the extra compare
+    if (cache.blocksPerSet >= 8 && cache.tags[firstBlock + cache.lastWays[set]] == tag) {
+        return &cache.blocks[firstBlock + cache.lastWays[set]];
+    }
+
+    int way = cache.findWay(cache.tags + firstBlock, cache.blocksPerSet, tag);
+    if (way >= 0) {
+        cache.lastWays[set] = way;
+    }
+
+    return way < 0 ? NULL : &cache.blocks[firstBlock + way];
+}
+
+// ##########################################################################################
+// # Called after every processor access. A miss, or the first touch of a block that was    #
+// # prefetched, is what triggers next-line prefetching (so a run of useful prefetches      #
+// # keeps itself going). The stride table watches every load and store by pc and, once    #
+// # the same stride shows up twice in a row, runs ahead of it. A miss no stream buffer     #
+// # could serve restarts the least recently used stream just past the missing block.      #
+// ##########################################################################################
+
+void runPrefetcher(cacheStruct &cache, stateType &state, int address, enum accessType type, bool wasHit,
+                   bool wasBufferHit) {
+    prefetcherStruct *prefetcher = cache.prefetcher;
+
+    if (prefetcher == NULL) {
+        return;
+    }
+
+    bool isTriggered = !wasHit;
+    blockStruct *block = getCacheBlock(cache, address);
+
+    if (wasHit && block != NULL && block->isPrefetched) {
+        prefetcher->stats.useful++;
+        prefetcher->stats.totalLead += cache.stats.accesses - block->prefetchTime;
+        block->isPrefetched = false;
+        isTriggered = true;
+    }
+    if (!wasHit && !wasBufferHit) {
+        prefetcher->stats.demandMisses++;
+    }
+
+    int blockAddress = address - (address % cache.blockSize);
+
+    if (prefetcher->type == nextLinePrefetcher && isTriggered) {
+        for (int i = 0; i < prefetcher->degree; i++) {
+            issuePrefetch(cache, state, blockAddress + (prefetcher->distance + i) * cache.blockSize);
+        }
+    } else if (prefetcher->type == stridePrefetcher && type != instructionFetch) {
+        strideEntryStruct &entry = prefetcher->strideTable[state.pc % prefetcher->strideTable.size()];
+
+        if (entry.pc != state.pc) {
+            entry.pc = state.pc;
+            entry.stride = 0;
+            entry.isConfirmed = false;
+        } else {
+            int stride = address - entry.lastAddress;
+            entry.isConfirmed = stride != 0 && stride == entry.stride;
+            entry.stride = stride;
+        }
+        entry.lastAddress = address;
+
+        if (entry.isConfirmed) {
+            for (int i = 0; i < prefetcher->degree; i++) {
+                int target = address + (prefetcher->distance + i) * entry.stride;
+                if (target - (target % cache.blockSize) != blockAddress) {
+                    issuePrefetch(cache, state, target);
+                }
+            }
+        }
+    } else if (prefetcher->type == streamPrefetcher && !wasHit && !wasBufferHit) {
+        allocateStream(cache, blockAddress);
+    }
+}
+
+// ##########################################################################################
+// # Brings the block holding address in ahead of the processor, either straight into the   #
+// # cache (where it can evict demand data) or into a free prefetch buffer entry, the       #
+// # entries taking turns to be overwritten once the buffer is full.                        #
+// ##########################################################################################
+
+void issuePrefetch(cacheStruct &cache, stateType &state, int address) {
+    prefetcherStruct *prefetcher = cache.prefetcher;
+
+    if (address < 0 || address >= NUMMEMORY) {
+        return;
+    }
+
+    int blockAddress = address - (address % cache.blockSize);
+
+    if (isCacheHit(cache, blockAddress) || isInPrefetchBuffer(*prefetcher, blockAddress)
+        || findVictimEntry(cache, blockAddress) != NULL) {
+        prefetcher->stats.redundant++;
+        return;
+    }
+
+    prefetcher->stats.issued++;
+
+    if (prefetcher->isIntoBuffer) {
+        size_t slot = prefetcher->buffer.size();
+
+        for (size_t i = 0; i < prefetcher->buffer.size() && slot == prefetcher->buffer.size(); i++) {
+            if (!prefetcher->buffer[i].isValid) {
+                slot = i;
+            }
+        }
+        if (slot == prefetcher->buffer.size()) {
+            slot = prefetcher->nextBufferEntry;
+            prefetcher->nextBufferEntry = (prefetcher->nextBufferEntry + 1) % prefetcher->buffer.size();
+            prefetcher->stats.unusedEvicted++;
+        }
+
+        prefetchEntryStruct &entry = prefetcher->buffer[slot];
+        entry.blockAddress = blockAddress;
+        entry.isValid = true;
+        entry.prefetchTime = cache.stats.accesses;
+
+        reportAction(cache, blockAddress, cache.blockSize, memoryToPrefetchBuffer);
+    } else {
+        long long demandReady = cache.timing != NULL ? cache.timing->lastFillReady : -1;
+
+        loadCacheFromMemory(cache, state, blockAddress);
+        reportAction(cache, blockAddress, cache.blockSize, memoryToCache);
+        if (cache.timing != NULL) {
+            cache.timing->lastFillReady = demandReady;
+        }
+
+        blockStruct *block = getCacheBlock(cache, blockAddress);
+        block->isPrefetched = true;
+        block->prefetchTime = cache.stats.accesses;
+    }
+}
+
+// ##########################################################################################
+// # On a cache miss, looks for the block in the prefetch buffer, or at the head of a       #
+// # stream buffer, and moves it into the cache instead of going to memory. A stream buffer #
+// # that supplies its head shifts up and fetches one more block onto its tail.             #
+// ##########################################################################################
+
+bool takeFromPrefetchBuffer(cacheStruct &cache, stateType &state, int address) {
+    prefetcherStruct *prefetcher = cache.prefetcher;
+
+    if (prefetcher == NULL || !prefetcher->isIntoBuffer) {
+        return false;
+    }
+
+    int blockAddress = address - (address % cache.blockSize);
+    long long prefetchTime = -1;
+
+    for (size_t i = 0; i < prefetcher->buffer.size(); i++) {
+        if (prefetcher->buffer[i].isValid && prefetcher->buffer[i].blockAddress == blockAddress) {
+            prefetcher->buffer[i].isValid = false;
+            prefetchTime = prefetcher->buffer[i].prefetchTime;
+        }
+    }
+
+    for (size_t i = 0; i < prefetcher->streams.size() && prefetchTime < 0; i++) {
+        std::deque<prefetchEntryStruct> &stream = prefetcher->streams[i];
+
+        if (!stream.empty() && stream.front().blockAddress == blockAddress) {
+            prefetchTime = stream.front().prefetchTime;
+            int nextAddress = stream.back().blockAddress + cache.blockSize;
+            stream.pop_front();
+            prefetcher->streamLastUse[i] = cache.stats.accesses;
+
+            if (nextAddress < NUMMEMORY) {
+                prefetchEntryStruct entry = {nextAddress, true, cache.stats.accesses};
+                stream.push_back(entry);
+                prefetcher->stats.issued++;
+                reportAction(cache, nextAddress, cache.blockSize, memoryToPrefetchBuffer);
+            }
+        }
+    }
+
+    if (prefetchTime < 0) {
+        return false;
+    }
+
+    prefetcher->stats.useful++;
+    prefetcher->stats.totalLead += cache.stats.accesses - prefetchTime;
+
+    // the buffers hold what memory held, and writebacks of the block update both
+    loadCacheFromMemory(cache, state, blockAddress);
+    reportAction(cache, blockAddress, cache.blockSize, prefetchBufferToCache);
+
+    return true;
+}
+
+bool isInPrefetchBuffer(prefetcherStruct &prefetcher, int blockAddress) {
+    for (size_t i = 0; i < prefetcher.buffer.size(); i++) {
+        if (prefetcher.buffer[i].isValid && prefetcher.buffer[i].blockAddress == blockAddress) {
+            return true;
+        }
+    }
+
+    for (size_t i = 0; i < prefetcher.streams.size(); i++) {
+        for (size_t j = 0; j < prefetcher.streams[i].size(); j++) {
+            if (prefetcher.streams[i][j].blockAddress == blockAddress) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void allocateStream(cacheStruct &cache, int blockAddress) {
+    prefetcherStruct *prefetcher = cache.prefetcher;
+    size_t oldest = 0;
+
+    for (size_t i = 1; i < prefetcher->streams.size(); i++) {
+        if (prefetcher->streamLastUse[i] < prefetcher->streamLastUse[oldest]) {
+            oldest = i;
+        }
+    }
+
+    std::deque<prefetchEntryStruct> &stream = prefetcher->streams[oldest];
+    prefetcher->stats.unusedEvicted += stream.size();
+    stream.clear();
+    prefetcher->streamLastUse[oldest] = cache.stats.accesses;
+
+    for (int i = 0; i < prefetcher->degree; i++) {
+        int nextAddress = blockAddress + (prefetcher->distance + i) * cache.blockSize;
+
+        if (nextAddress >= NUMMEMORY) {
+            break;
+        }
+
+        prefetchEntryStruct entry = {nextAddress, true, cache.stats.accesses};
+        stream.push_back(entry);
+        prefetcher->stats.issued++;
+        reportAction(cache, nextAddress, cache.blockSize, memoryToPrefetchBuffer);
+    }
+}
+
+// ##########################################################################################
+// # Accuracy is the share of prefetches that got used, coverage the share of would-be      #
+// # misses they removed, and the lead is how many accesses early the average useful one    #
+// # arrived. Prefetches still sitting unused at the end count against accuracy only.       #
+// ##########################################################################################
+
+void printPrefetchStats(cacheStruct &cache) {
+    prefetchStatsStruct &stats = cache.prefetcher->stats;
+    double accuracy = stats.issued == 0 ? 0.0 : (double) stats.useful / stats.issued;
+    long long wouldBeMisses = stats.useful + stats.demandMisses;
+    double coverage = wouldBeMisses == 0 ? 0.0 : (double) stats.useful / wouldBeMisses;
+    double lead = stats.useful == 0 ? 0.0 : (double) stats.totalLead / stats.useful;
+
+    printf("prefetches issued %lld, useful %lld, redundant %lld, evicted unused %lld\n", stats.issued,
+           stats.useful, stats.redundant, stats.unusedEvicted);
+    printf("accuracy %.4f, coverage %.4f, average lead %.2f accesses\n", accuracy, coverage, lead);
+}
+
+//// ########################################################################################################
+//// #          WRITE POLICY: Write-through, no-write-allocate and a coalescing write buffer to memory      #
+//// ########################################################################################################
+
+void initializeWriteBuffer(writeBufferStruct &writeBuffer, int numOfEntries) {
+    writeBuffer.numOfEntries = numOfEntries;
+    writeBuffer.entries.clear();
+    writeBuffer.wordsCoalesced = 0;
+}
+
+// ##########################################################################################
+// # Every write headed for memory (dirty evictions, write-through stores, store misses     #
+// # that don't allocate) comes through here. Memory itself is always updated on the spot;  #
+// # the buffer only decides when the words count as traffic. A write into a block already  #
+// # buffered merges with it, otherwise it takes a new entry, draining the oldest if full.  #
+// ##########################################################################################
+
+void sendToMemory(cacheStruct &cache, int address, int size, enum actionType type) {
+    writeBufferStruct *writeBuffer = cache.writeBuffer;
+
+    if (writeBuffer == NULL) {
+        reportAction(cache, address, size, type);
+        return;
+    }
+
+    if (type == processorToMemory) {
+        reportAction(cache, address, size, processorToWriteBuffer);
+    } else if (type == victimCacheToMemory) {
+        reportAction(cache, address, size, victimCacheToWriteBuffer);
+    } else {
+        reportAction(cache, address, size, cacheToWriteBuffer);
+    }
+
+    int blockAddress = address - (address % cache.blockSize);
+    writeBufferEntryStruct *entry = NULL;
+
+    for (size_t i = 0; i < writeBuffer->entries.size(); i++) {
+        if (writeBuffer->entries[i].blockAddress == blockAddress) {
+            entry = &writeBuffer->entries[i];
+        }
+    }
+
+    if (entry == NULL) {
+        drainWriteBuffer(cache, writeBuffer->numOfEntries - 1);
+
+        writeBufferEntryStruct newEntry;
+        newEntry.blockAddress = blockAddress;
+        newEntry.isWordValid.assign(cache.blockSize, false);
+        writeBuffer->entries.push_back(newEntry);
+        entry = &writeBuffer->entries.back();
+    }
+
+    for (int i = address - blockAddress; i < address - blockAddress + size; i++) {
+        if (entry->isWordValid[i]) {
+            writeBuffer->wordsCoalesced++;
+        }
+        entry->isWordValid[i] = true;
+    }
+}
+
+// ##########################################################################################
+// # Drains the oldest entries until no more than numOfEntriesLeft remain. Each run of      #
+// # written words in an entry goes to memory as one transfer.                              #
+// ##########################################################################################
+
+void drainWriteBuffer(cacheStruct &cache, size_t numOfEntriesLeft) {
+    writeBufferStruct *writeBuffer = cache.writeBuffer;
+
+    while (writeBuffer->entries.size() > numOfEntriesLeft) {
+        writeBufferEntryStruct &entry = writeBuffer->entries.front();
+
+        for (int i = 0; i < cache.blockSize; i++) {
+            if (entry.isWordValid[i]) {
+                int runStart = i;
+                while (i + 1 < cache.blockSize && entry.isWordValid[i + 1]) {
+                    i++;
+                }
+                reportAction(cache, entry.blockAddress + runStart, i - runStart + 1, writeBufferToMemory);
+            }
+        }
+
+        writeBuffer->entries.pop_front();
+    }
+}
+
+void printTraffic(cacheStruct &cache) {
+    printf("memory traffic: %lld words read, %lld words written, %lld writebacks", cache.stats.wordsFromMemory,
+           cache.stats.wordsToMemory, cache.stats.writebacks);
+
+    if (cache.writeBuffer != NULL) {
+        printf(", %lld words coalesced in the write buffer", cache.writeBuffer->wordsCoalesced);
+    }
+
+    printf("\n");
+}
+
+//// ########################################################################################################
+//// #        DETAILED STATS: Why each miss happened, where in the cache, and how far apart reuses are      #
+//// ########################################################################################################
+
+void initializeDetailedStats(detailedStatsStruct &detailedStats, cacheStruct &cache, bool isJson) {
+    setStatsStruct emptySet = {0, 0, 0, 0};
+
+    detailedStats.compulsoryMisses = 0;
+    detailedStats.capacityMisses = 0;
+    detailedStats.conflictMisses = 0;
+    detailedStats.firstUses = 0;
+    detailedStats.shadow.clock = 0;
+    detailedStats.shadow.tree.assign(64, 0);
+    detailedStats.shadow.lastAccess.clear();
+    detailedStats.sets.assign(cache.numOfSets, emptySet);
+    detailedStats.reuseHistogram.clear();
+    detailedStats.isJson = isJson;
+}
+
+// ##########################################################################################
+// # The classic three Cs: a miss on a block never seen before is compulsory, one a fully-  #
+// # associative LRU cache of the same size would also take is capacity, and the rest are   #
+// # conflict misses that more associativity would have removed.                            #
+// ##########################################################################################
+
+void recordDetailedStats(cacheStruct &cache, int address, bool wasHit) {
+    detailedStatsStruct *detailedStats = cache.detailedStats;
+
+    if (detailedStats == NULL) {
+        return;
+    }
+
+    int distance = getStackDistance(detailedStats->shadow, address / cache.blockSize);
+    setStatsStruct &set = detailedStats->sets[getSetOffset(cache, address)];
+
+    if (distance < 0) {
+        detailedStats->firstUses++;
+    } else {
+        size_t bucket = 0;
+        while ((1 << bucket) <= distance) {
+            bucket++;
+        }
+        if (detailedStats->reuseHistogram.size() <= bucket) {
+            detailedStats->reuseHistogram.resize(bucket + 1, 0);
+        }
+        detailedStats->reuseHistogram[bucket]++;
+    }
+
+    if (wasHit) {
+        set.hits++;
+        return;
+    }
+
+    set.misses++;
+
+    if (distance < 0) {
+        detailedStats->compulsoryMisses++;
+    } else if (distance >= cache.numOfSets * cache.blocksPerSet) {
+        detailedStats->capacityMisses++;
+    } else {
+        detailedStats->conflictMisses++;
+    }
+}
+
+void recordEviction(cacheStruct &cache, blockStruct &block) {
+    if (cache.detailedStats == NULL) {
+        return;
+    }
+
+    setStatsStruct &set = cache.detailedStats->sets[block.setIndex];
+    set.evictions++;
+    if (block.isDirty) {
+        set.dirtyEvictions++;
+    }
+}
+
+void printDetailedStats(cacheStruct &cache) {
+    detailedStatsStruct &detailedStats = *cache.detailedStats;
+    long long evictions = 0, dirtyEvictions = 0;
+
+    for (size_t i = 0; i < detailedStats.sets.size(); i++) {
+        evictions += detailedStats.sets[i].evictions;
+        dirtyEvictions += detailedStats.sets[i].dirtyEvictions;
+    }
+
+    printf("accesses %lld, hits %lld, misses %lld\n", cache.stats.accesses, cache.stats.hits, cache.stats.misses);
+    printf("misses: %lld compulsory, %lld capacity, %lld conflict\n", detailedStats.compulsoryMisses,
+           detailedStats.capacityMisses, detailedStats.conflictMisses);
+    printf("evictions %lld, dirty evictions %lld\n", evictions, dirtyEvictions);
+
+    printf("%8s %10s %10s %10s %10s\n", "set", "hits", "misses", "evictions", "dirty");
+    for (size_t i = 0; i < detailedStats.sets.size(); i++) {
+        setStatsStruct &set = detailedStats.sets[i];
+        printf("%8d %10lld %10lld %10lld %10lld\n", (int) i, set.hits, set.misses, set.evictions,
+               set.dirtyEvictions);
+    }
+
+    printf("%17s %10s\n", "reuse distance", "accesses");
+    printf("%17s %10lld\n", "first use", detailedStats.firstUses);
+    for (size_t i = 0; i < detailedStats.reuseHistogram.size(); i++) {
+        int low = i == 0 ? 0 : 1 << (i - 1), high = (1 << i) - 1;
+        char range[32];
+        snprintf(range, sizeof(range), "%d-%d", low, high);
+        printf("%17s %10lld\n", range, detailedStats.reuseHistogram[i]);
+    }
+}
+
+void printDetailedStatsJson(cacheStruct &cache) {
+    detailedStatsStruct &detailedStats = *cache.detailedStats;
+
+    printf("{\n");
+    printf("  \"accesses\": %lld, \"hits\": %lld, \"misses\": %lld,\n", cache.stats.accesses, cache.stats.hits,
+           cache.stats.misses);
+    printf("  \"compulsoryMisses\": %lld, \"capacityMisses\": %lld, \"conflictMisses\": %lld,\n",
+           detailedStats.compulsoryMisses, detailedStats.capacityMisses, detailedStats.conflictMisses);
+
+    printf("  \"sets\": [\n");
+    for (size_t i = 0; i < detailedStats.sets.size(); i++) {
+        setStatsStruct &set = detailedStats.sets[i];
+        printf("    {\"set\": %d, \"hits\": %lld, \"misses\": %lld, \"evictions\": %lld, \"dirtyEvictions\": %lld}%s\n",
+               (int) i, set.hits, set.misses, set.evictions, set.dirtyEvictions,
+               i + 1 < detailedStats.sets.size() ? "," : "");
+    }
+    printf("  ],\n");
+
+    printf("  \"reuseDistance\": {\"firstUse\": %lld, \"buckets\": [\n", detailedStats.firstUses);
+    for (size_t i = 0; i < detailedStats.reuseHistogram.size(); i++) {
+        int low = i == 0 ? 0 : 1 << (i - 1), high = (1 << i) - 1;
+        printf("    {\"min\": %d, \"max\": %d, \"accesses\": %lld}%s\n", low, high,
+               detailedStats.reuseHistogram[i], i + 1 < detailedStats.reuseHistogram.size() ? "," : "");
+    }
+    printf("  ]}\n");
+    printf("}\n");
+}
+
+//// ########################################################################################################
+//// #        EVENT LOG: Transfers recorded as binary records and written out by a background thread        #
+//// ########################################################################################################
+
+void openEventLog(eventLogStruct &eventLog, optionsType &options) {
+    eventLog.file = fopen(options.eventLogFileName, "wb");
+    if (eventLog.file == NULL) {
+        printf("error: can't open file %s", options.eventLogFileName);
+        perror("fopen");
+        exit(1);
+    }
+    fwrite(EVENTLOGMAGIC, 1, strlen(EVENTLOGMAGIC), eventLog.file);
+
+    eventLog.ring.resize(EVENTLOGCAPACITY);
+    eventLog.head = 0;
+    eventLog.tail = 0;
+    eventLog.isDone = false;
+    eventLog.onlyMisses = options.onlyMissEvents;
+    eventLog.onlyWritebacks = options.onlyWritebackEvents;
+    eventLog.lowAddress = options.eventAddresses.min;
+    eventLog.highAddress = options.eventAddresses.max;
+
+    eventLog.writer = std::thread(runEventWriter, std::ref(eventLog));
+}
+
+// ##########################################################################################
+// # The only cost to the simulation is the filter and one store into the ring; it waits    #
+// # only if the writer has fallen a whole ring behind.                                     #
+// ##########################################################################################
+
+void logEvent(eventLogStruct &eventLog, int address, int size, enum actionType type) {
+    if (eventLog.onlyMisses && type != memoryToCache && type != prefetchBufferToCache && type != victimCacheToCache
+        && type != missCacheToCache) {
+        return;
+    }
+    if (eventLog.onlyWritebacks && type != cacheToMemory && type != cacheToWriteBuffer && type != victimCacheToMemory
+        && type != victimCacheToWriteBuffer) {
+        return;
+    }
+    if (address > eventLog.highAddress || address + size - 1 < eventLog.lowAddress) {
+        return;
+    }
+
+    size_t head = eventLog.head.load(std::memory_order_relaxed);
+
+    while (head - eventLog.tail.load(std::memory_order_acquire) == eventLog.ring.size()) {
+        std::this_thread::yield();
+    }
+
+    eventStruct &event = eventLog.ring[head % eventLog.ring.size()];
+    event.address = address;
+    event.size = size;
+    event.type = type;
+
+    eventLog.head.store(head + 1, std::memory_order_release);
+}
+
+void runEventWriter(eventLogStruct &eventLog) {
+    while (true) {
+        bool isDone = eventLog.isDone.load(std::memory_order_acquire);
+        size_t tail = eventLog.tail.load(std::memory_order_relaxed);
+        size_t head = eventLog.head.load(std::memory_order_acquire);
+
+        if (tail == head) {
+            if (isDone) {
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+
+        // write out up to the end of the ring in one go
+        size_t start = tail % eventLog.ring.size();
+        size_t count = std::min(head - tail, eventLog.ring.size() - start);
+        fwrite(&eventLog.ring[start], sizeof(eventStruct), count, eventLog.file);
+
+        eventLog.tail.store(tail + count, std::memory_order_release);
+    }
+}
+
+void closeEventLog(eventLogStruct &eventLog) {
+    eventLog.isDone.store(true, std::memory_order_release);
+    eventLog.writer.join();
+    fclose(eventLog.file);
+}
+
+void formatEventLog(char *fileName) {
+    char magic[8];
+    eventStruct event;
+    FILE *filePtr = fopen(fileName, "rb");
+
+    if (filePtr == NULL) {
+        printf("error: can't open file %s", fileName);
+        perror("fopen");
+        exit(1);
+    }
+
+    if (fread(magic, 1, strlen(EVENTLOGMAGIC), filePtr) != strlen(EVENTLOGMAGIC)
+        || memcmp(magic, EVENTLOGMAGIC, strlen(EVENTLOGMAGIC)) != 0) {
+        printf("error: %s is not an event log\n", fileName);
+        exit(1);
+    }
+
+    while (fread(&event, sizeof(eventStruct), 1, filePtr) == 1) {
+        printAction(event.address, event.size, (enum actionType) event.type);
+    }
+
+    fclose(filePtr);
+}
+
+//// ########################################################################################################
+//// #        VICTIM CACHE: A few fully-associative blocks beside the cache to soak up conflict misses      #
+//// ########################################################################################################
+
+void initializeVictimCache(victimCacheStruct &victimCache, int numOfEntries, bool isMissCache, int blockSize) {
+    victimEntryStruct emptyEntry;
+    emptyEntry.blockAddress = -1;
+    emptyEntry.isValid = false;
+    emptyEntry.isDirty = false;
+    emptyEntry.lastUse = 0;
+    emptyEntry.lines.assign(blockSize, 0);
+
+    victimCache.isMissCache = isMissCache;
+    victimCache.entries.assign(numOfEntries, emptyEntry);
+    victimCache.hits = 0;
+}
+
+victimEntryStruct *findVictimEntry(cacheStruct &cache, int address) {
+    if (cache.victimCache == NULL) {
+        return NULL;
+    }
+
+    int blockAddress = address - (address % cache.blockSize);
+
+    for (size_t i = 0; i < cache.victimCache->entries.size(); i++) {
+        victimEntryStruct &entry = cache.victimCache->entries[i];
+        if (entry.isValid && entry.blockAddress == blockAddress) {
+            return &entry;
+        }
+    }
+
+    return NULL;
+}
+
+victimEntryStruct &getOldestVictimEntry(victimCacheStruct &victimCache) {
+    size_t oldest = 0;
+
+    for (size_t i = 0; i < victimCache.entries.size(); i++) {
+        if (!victimCache.entries[i].isValid) {
+            return victimCache.entries[i];
+        }
+        if (victimCache.entries[i].lastUse < victimCache.entries[oldest].lastUse) {
+            oldest = i;
+        }
+    }
+
+    return victimCache.entries[oldest];
+}
+
+// ##########################################################################################
+// # On a cache miss: if the victim cache has the block, it and the block the cache evicts  #
+// # to make room trade places, dirty bits and all. A miss cache just refills the cache     #
+// # from its copy (which can be read from memory, since writebacks keep memory current).   #
+// ##########################################################################################
+
+bool takeFromVictimCache(cacheStruct &cache, stateType &state, int address) {
+    victimEntryStruct *entry = findVictimEntry(cache, address);
+
+    if (entry == NULL) {
+        return false;
+    }
+
+    int blockAddress = address - (address % cache.blockSize);
+    cache.victimCache->hits++;
+
+    if (cache.victimCache->isMissCache) {
+        entry->lastUse = cache.stats.accesses;
+        loadCacheFromMemory(cache, state, address);
+        reportAction(cache, blockAddress, cache.blockSize, missCacheToCache);
+        return true;
+    }
+
+    // free the entry first so the block evicted to make room lands in it
+    std::vector<int> lines = entry->lines;
+    bool isDirty = entry->isDirty;
+    entry->isValid = false;
+
+    loadCacheFromMemory(cache, state, address);
+
+    blockStruct *block = getCacheBlock(cache, address);
+    for (int i = 0; i < cache.blockSize && !cache.isTagOnly; i++) {
+        block->lines[i] = lines[i];
+    }
+    block->isDirty = isDirty;
+
+    reportAction(cache, blockAddress, cache.blockSize, victimCacheToCache);
+    return true;
+}
+
+void moveToVictimCache(cacheStruct &cache, stateType &state, blockStruct &block, int oldAddress) {
+    victimEntryStruct &entry = getOldestVictimEntry(*cache.victimCache);
+
+    if (entry.isValid && entry.isDirty) {
+        for (int i = 0; i < cache.blockSize && !cache.isTagOnly; i++) {
+            state.mem[entry.blockAddress + i] = entry.lines[i];
+        }
+        sendToMemory(cache, entry.blockAddress, cache.blockSize, victimCacheToMemory);
+        cache.stats.writebacks++;
+    } else if (entry.isValid) {
+        reportAction(cache, entry.blockAddress, cache.blockSize, victimCacheToNowhere);
+    }
+
+    entry.blockAddress = oldAddress;
+    entry.isValid = true;
+    entry.isDirty = block.isDirty;
+    entry.lastUse = cache.stats.accesses;
+    for (int i = 0; i < cache.blockSize && !cache.isTagOnly; i++) {
+        entry.lines[i] = block.lines[i];
+    }
+
+    reportAction(cache, oldAddress, cache.blockSize, cacheToVictimCache);
+}
+
+void copyToMissCache(cacheStruct &cache, int address) {
+    if (cache.victimCache == NULL || !cache.victimCache->isMissCache) {
+        return;
+    }
+
+    victimEntryStruct &entry = getOldestVictimEntry(*cache.victimCache);
+    entry.blockAddress = address - (address % cache.blockSize);
+    entry.isValid = true;
+    entry.isDirty = false;
+    entry.lastUse = cache.stats.accesses;
+}
+
+void printVictimCacheStats(cacheStruct &cache) {
+    victimCacheStruct &victimCache = *cache.victimCache;
+    double recovered = cache.stats.misses == 0 ? 0.0 : (double) victimCache.hits / cache.stats.misses;
+
+    printf("%s cache: %lld of %lld misses recovered (%.4f)\n", victimCache.isMissCache ? "miss" : "victim",
+           victimCache.hits, cache.stats.misses, recovered);
+}
+
+//// ########################################################################################################
+//// #        SECTORS: One tag over several sectors, each fetched and written back only when it's used      #
+//// ########################################################################################################
+
+void initializeSectors(sectorStruct &sectors, int numOfSectors, int blockSize) {
+    if (numOfSectors > blockSize) {
+        printf("error: can't split a block of %d words into %d sectors\n", blockSize, numOfSectors);
+        exit(1);
+    }
+
+    sectors.numOfSectors = numOfSectors;
+    sectors.sectorSize = blockSize / numOfSectors;
+    sectors.sectorMisses = 0;
+    sectors.wordsFetched = 0;
+    sectors.wordsWrittenBack = 0;
+    sectors.blockWordsFetched = 0;
+    sectors.blockWordsWrittenBack = 0;
+}
+
+unsigned long long getSectorBit(cacheStruct &cache, int address) {
+    return 1ULL << (getBlockOffset(cache, address) / cache.sectors->sectorSize);
+}
+
+// What a miss brings in: the whole block, or just the sector.
+int getFillSize(cacheStruct &cache) {
+    return cache.sectors == NULL ? cache.blockSize : cache.sectors->sectorSize;
+}
+
+// Each dirty sector goes to memory as its own transfer; the clean ones are left behind.
+void writeBackSectors(cacheStruct &cache, stateStruct &state, blockStruct &block, int oldAddress) {
+    sectorStruct &sectors = *cache.sectors;
+
+    for (int i = 0; i < sectors.numOfSectors; i++) {
+        if ((block.dirtySectors & (1ULL << i)) == 0) {
+            continue;
+        }
+
+        int sectorAddress = oldAddress + i * sectors.sectorSize;
+        if (block.lines != NULL) {
+            for (int j = 0; j < sectors.sectorSize; j++) {
+                state.mem[sectorAddress + j] = block.lines[i * sectors.sectorSize + j];
+            }
+        }
+        sendToMemory(cache, sectorAddress, sectors.sectorSize, cacheToMemory);
+        sectors.wordsWrittenBack += sectors.sectorSize;
+    }
+
+    sectors.blockWordsWrittenBack += cache.blockSize;
+    block.isDirty = false;
+    block.dirtySectors = 0;
+}
+
+void printSectorStats(cacheStruct &cache) {
+    sectorStruct &sectors = *cache.sectors;
+    long long words = sectors.wordsFetched + sectors.wordsWrittenBack;
+    long long blockWords = sectors.blockWordsFetched + sectors.blockWordsWrittenBack;
+    double saved = blockWords == 0 ? 0.0 : (double) (blockWords - words) / blockWords;
+
+    printf("sectors: %d per block, %d words each; %lld of %lld misses found the block but not the sector\n",
+           sectors.numOfSectors, sectors.sectorSize, sectors.sectorMisses, cache.stats.misses);
+    printf("sector traffic: %lld words fetched and %lld written back, against %lld and %lld for whole blocks "
+           "(%lld words saved, %.4f)\n", sectors.wordsFetched, sectors.wordsWrittenBack, sectors.blockWordsFetched,
+           sectors.blockWordsWrittenBack, blockWords - words, saved);
+}
+
+//// ########################################################################################################
+//// #        VIRTUAL MEMORY: TLBs in front of the cache, and a page table in memory behind them            #
+//// ########################################################################################################
+
+// ##########################################################################################
+// # The page table is two levels deep and sits in the top pages of memory. The page number #
+// # splits in two: the high half picks an entry in the root table, which holds the address #
+// # of a leaf table, and the low half picks the leaf entry, which holds the frame. Entries #
+// # are (value << 1) | 1, and 0 means unmapped. Every page maps to itself, so the program  #
+// # image stays where it was loaded, apart from the pages holding the tables, which are    #
+// # left unmapped so nothing but a walk can touch them.                                    #
+// ##########################################################################################
+
+void initializeVirtualMemory(vmStruct &vm, stateType &state, optionsType &options) {
+    int addressBits = log2(NUMMEMORY);
+
+    if (options.pageSize < 4 || options.pageSize > NUMMEMORY / 4
+        || (options.pageSize & (options.pageSize - 1)) != 0) {
+        printf("error: the page size has to be a power of two from 4 to %d\n", NUMMEMORY / 4);
+        exit(1);
+    }
+
+    vm.pageSize = options.pageSize;
+    vm.pageBits = log2(vm.pageSize);
+    vm.leafBits = (addressBits - vm.pageBits) / 2;
+
+    int numOfRootEntries = 1 << (addressBits - vm.pageBits - vm.leafBits);
+    int numOfLeafEntries = 1 << vm.leafBits;
+    int tableWords = numOfRootEntries + numOfRootEntries * numOfLeafEntries;
+    int tablePages = (tableWords + vm.pageSize - 1) / vm.pageSize;
+
+    vm.rootTable = NUMMEMORY - tablePages * vm.pageSize;
+    if (state.numMemory > vm.rootTable) {
+        printf("error: the program runs into the page tables at %d\n", vm.rootTable);
+        exit(1);
+    }
+
+    for (int i = 0; i < numOfRootEntries; i++) {
+        int leafTable = vm.rootTable + numOfRootEntries + i * numOfLeafEntries;
+
+        state.mem[vm.rootTable + i] = (leafTable << 1) | 1;
+        for (int j = 0; j < numOfLeafEntries; j++) {
+            int page = (i << vm.leafBits) | j;
+            state.mem[leafTable + j] = (page << vm.pageBits) < vm.rootTable ? (page << 1) | 1 : 0;
+        }
+    }
+
+    initializeTLB(vm.itlb, options.itlbEntries, options.itlbWays);
+    initializeTLB(vm.dtlb, options.dtlbEntries, options.dtlbWays);
+    initializeTLB(vm.walkCache, options.walkCacheEntries, options.walkCacheEntries);
+    vm.walks = 0;
+    vm.walkReads = 0;
+    vm.walkMisses = 0;
+    vm.walkCycles = 0;
+}
+
+void initializeTLB(tlbStruct &tlb, int numOfEntries, int numOfWays) {
+    tlbEntryStruct emptyEntry = {false, 0, 0, 0};
+
+    if (numOfEntries < 0 || (numOfEntries > 0 && (numOfWays < 1 || numOfEntries % numOfWays != 0))) {
+        printf("error: bad tlb geometry %d entries, %d ways\n", numOfEntries, numOfWays);
+        exit(1);
+    }
+
+    tlb.numOfEntries = numOfEntries;
+    tlb.numOfWays = numOfWays;
+    tlb.entries.assign(numOfEntries, emptyEntry);
+    tlb.accesses = 0;
+    tlb.misses = 0;
+}
+
+// Returns what the tlb holds for key (a page number, or a root index in the walk cache), or -1 on a miss.
+int lookupTLB(tlbStruct &tlb, int key) {
+    int firstEntry = (key % (tlb.numOfEntries / tlb.numOfWays)) * tlb.numOfWays;
+
+    tlb.accesses++;
+    for (int i = firstEntry; i < firstEntry + tlb.numOfWays; i++) {
+        if (tlb.entries[i].isValid && tlb.entries[i].key == key) {
+            tlb.entries[i].lastUse = tlb.accesses;
+            return tlb.entries[i].value;
+        }
+    }
+
+    tlb.misses++;
+    return -1;
+}
+
+// Puts the translation in the first free way of its set, or over the least recently used one.
+void insertTLB(tlbStruct &tlb, int key, int value) {
+    int firstEntry = (key % (tlb.numOfEntries / tlb.numOfWays)) * tlb.numOfWays;
+    tlbEntryStruct *entry = &tlb.entries[firstEntry];
+
+    for (int i = firstEntry; i < firstEntry + tlb.numOfWays; i++) {
+        if (!tlb.entries[i].isValid) {
+            entry = &tlb.entries[i];
+            break;
+        } else if (tlb.entries[i].lastUse < entry->lastUse) {
+            entry = &tlb.entries[i];
+        }
+    }
+
+    entry->isValid = true;
+    entry->key = key;
+    entry->value = value;
+    entry->lastUse = tlb.accesses;
+}
+
+// Maps the address the program used to the one the cache sees. Without -vm they're the same.
+int translateAddress(cacheStruct &cache, stateType &state, int address, enum accessType type) {
+    if (cache.vm == NULL) {
+        return address;
+    }
+
+    vmStruct &vm = *cache.vm;
+    tlbStruct &tlb = type == instructionFetch ? vm.itlb : vm.dtlb;
+
+    if (address < 0 || address >= NUMMEMORY) {
+        printf("error: address %d is outside the address space\n", address);
+        exit(1);
+    }
+
+    int page = address >> vm.pageBits;
+    int frame = tlb.numOfEntries > 0 ? lookupTLB(tlb, page) : -1;
+
+    if (frame < 0) {
+        frame = walkPageTable(cache, state, address);
+        if (tlb.numOfEntries > 0) {
+            insertTLB(tlb, page, frame);
+        }
+    }
+
+    return (frame << vm.pageBits) | (address & (vm.pageSize - 1));
+}
+
+// ##########################################################################################
+// # A tlb miss reads the root entry and then the leaf entry through the cache, each one    #
+// # waiting for the one before. The walk cache keeps root entries, so a hit there skips    #
+// # straight to the leaf.                                                                  #
+// ##########################################################################################
+
+int walkPageTable(cacheStruct &cache, stateType &state, int address) {
+    vmStruct &vm = *cache.vm;
+    int page = address >> vm.pageBits;
+    int rootIndex = page >> vm.leafBits;
+    long long missesBefore = cache.stats.misses;
+    long long cycleBefore = cache.timing != NULL ? cache.timing->cycle : 0;
+
+    vm.walks++;
+
+    int leafTable = vm.walkCache.numOfEntries > 0 ? lookupTLB(vm.walkCache, rootIndex) : -1;
+    if (leafTable < 0) {
+        int rootEntry = readPageTable(cache, state, vm.rootTable + rootIndex);
+
+        if ((rootEntry & 1) == 0) {
+            printf("error: page fault at address %d\n", address);
+            exit(1);
+        }
+        leafTable = rootEntry >> 1;
+        if (vm.walkCache.numOfEntries > 0) {
+            insertTLB(vm.walkCache, rootIndex, leafTable);
+        }
+    }
+
+    int leafEntry = readPageTable(cache, state, leafTable + (page & ((1 << vm.leafBits) - 1)));
+    if ((leafEntry & 1) == 0) {
+        printf("error: page fault at address %d\n", address);
+        exit(1);
+    }
+
+    vm.walkMisses += cache.stats.misses - missesBefore;
+    if (cache.timing != NULL) {
+        vm.walkCycles += cache.timing->cycle - cycleBefore;
+    }
+
+    return leafEntry >> 1;
+}
+
+int readPageTable(cacheStruct &cache, stateType &state, int address) {
+    int entry = processorRead(cache, state, address, dataLoad);
+
+    cache.vm->walkReads++;
+    if (cache.timing != NULL) {
+        stallUntil(*cache.timing, cache.timing->lastReady);
+    }
+
+    return entry;
+}
+
+void printTLB(const char *name, tlbStruct &tlb) {
+    double missRate = tlb.accesses == 0 ? 0.0 : (double) tlb.misses / tlb.accesses;
+
+    printf("%s: %d entries, %d ways: %lld lookups, %lld misses (%.4f)\n", name, tlb.numOfEntries, tlb.numOfWays,
+           tlb.accesses, tlb.misses, missRate);
+}
+
+void printVirtualMemoryStats(cacheStruct &cache) {
+    vmStruct &vm = *cache.vm;
+
+    printf("virtual memory: %d-word pages, page tables at %d\n", vm.pageSize, vm.rootTable);
+    if (vm.itlb.numOfEntries > 0) {
+        printTLB("itlb", vm.itlb);
+    }
+    if (vm.dtlb.numOfEntries > 0) {
+        printTLB("dtlb", vm.dtlb);
+    }
+    if (vm.walkCache.numOfEntries > 0) {
+        printTLB("walk cache", vm.walkCache);
+    }
+
+    printf("page walks: %lld walks, %lld page-table reads, %lld of them cache misses", vm.walks, vm.walkReads,
+           vm.walkMisses);
+    if (cache.timing != NULL) {
+        printf(", %lld cycles", vm.walkCycles);
+    }
+    printf("\n");
+}
+
+//// ########################################################################################################
+//// #        MULTI-CORE: Private caches on a snooping bus, one host thread per core                        #
+//// ########################################################################################################
+
+void runMultiCore(stateType &memoryState, cacheStruct &cache, optionsType &options) {
+    multiCoreStruct multiCore;
+    busStruct &bus = multiCore.bus;
+    std::vector<int> startingPCs(1, 0);
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < options.coreImages.size(); i++) {
+        startingPCs.push_back(loadCoreImage(memoryState, options.coreImages[i]));
+    }
+    while ((int) startingPCs.size() < options.numOfCores) {
+        startingPCs.push_back(0);
+    }
+
+    bus.isMoesi = options.isMoesi;
+    bus.memoryState = &memoryState;
+    bus.reads = 0;
+    bus.readExclusives = 0;
+    bus.upgrades = 0;
+    bus.invalidations = 0;
+    bus.cacheToCacheTransfers = 0;
+    bus.snoopWritebacks = 0;
+
+    for (size_t i = 0; i < startingPCs.size(); i++) {
+        coreStruct core;
+        core.pc = startingPCs[i];
+        memset(core.reg, 0, sizeof(core.reg));
+        core.reg[NUMREGS - 1] = (int) i;
+        core.numOfInstructions = 0;
+
+        core.cache = new cacheStruct;
+        configureCache(*core.cache, cache.blockSize, cache.numOfSets, cache.blocksPerSet);
+        core.cache->policy = options.policy;
+        core.cache->isQuiet = true;
+        core.cache->isTagOnly = options.tagOnly;
+        core.cache->bus = &bus;
+        core.cache->coreNumber = (int) i;
+        initializeCacheBlocks(*core.cache);
+
+        multiCore.cores.push_back(core);
+        bus.caches.push_back(core.cache);
+        bus.cacheLocks.emplace_back();
+    }
+
+    multiCore.quantum = options.quantum;
+    multiCore.barrier.numOfCores = (int) multiCore.cores.size();
+    multiCore.barrier.numArrived = 0;
+    multiCore.barrier.generation = 0;
+
+    for (size_t i = 0; i < multiCore.cores.size(); i++) {
+        threads.push_back(std::thread(runCore, std::ref(multiCore), (int) i));
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+
+    printMultiCoreStats(multiCore);
+
+    for (size_t i = 0; i < multiCore.cores.size(); i++) {
+        delete multiCore.cores[i].cache;
+    }
+}
+
+// Loads "<address>:<file>" into the shared memory and returns the address the core starts from.
+int loadCoreImage(stateType &memoryState, char *coreImage) {
+    char line[MAXLINELENGTH];
+    char *fileName = strchr(coreImage, ':');
+    int address = atoi(coreImage);
+
+    if (fileName == NULL || address < 0 || address >= NUMMEMORY) {
+        printf("error: bad core image %s\n", coreImage);
+        exit(1);
+    }
+    fileName++;
+
+    FILE *filePtr = fopen(fileName, "r");
+    if (filePtr == NULL) {
+        printf("error: can't open file %s", fileName);
+        perror("fopen");
+        exit(1);
+    }
+
+    for (int i = address; fgets(line, MAXLINELENGTH, filePtr) != NULL; i++) {
+        if (i >= NUMMEMORY || sscanf(line, "%d", memoryState.mem + i) != 1) {
+            printf("error in reading address %d\n", i);
+            exit(1);
+        }
+        if (i + 1 > memoryState.numMemory) {
+            memoryState.numMemory = i + 1;
+        }
+    }
+    fclose(filePtr);
+
+    return address;
+}
+
+void runCore(multiCoreStruct &multiCore, int coreNumber) {
+    coreStruct &core = multiCore.cores[coreNumber];
+    int halted = 0;
+
+    while (!halted) {
+        for (int i = 0; i < multiCore.quantum && !halted; i++) {
+            halted = executeCoreInstruction(core);
+            core.numOfInstructions++;
+        }
+        waitForQuantum(multiCore.barrier, halted);
+    }
+}
+
+// executeInstruction for a core: a core's cache records nothing and has no timing, so every fetch, load and store
+// is just a read or write on the bus.
+int executeCoreInstruction(coreStruct &core) {
+    int instruction = coherentRead(*core.cache, core.pc);
+    int regA = getRegA(instruction), regB = getRegB(instruction);
+    int offset = convertNum(getOffset(instruction));
+    int halted = 0;
+
+    switch (getOpCode(instruction)) {
+        case ADD:
+            core.reg[getDestination(instruction)] = core.reg[regA] + core.reg[regB];
+            break;
+        case NAND:
+            core.reg[getDestination(instruction)] = ~(core.reg[regA] & core.reg[regB]);
+            break;
+        case LW:
+            core.reg[regB] = coherentRead(*core.cache, core.reg[regA] + offset);
+            break;
+        case SW:
+            coherentWrite(*core.cache, core.reg[regA] + offset, core.reg[regB]);
+            break;
+        case BEQ:
+            if (core.reg[regA] == core.reg[regB]) {
+                core.pc += offset;
+            }
+            break;
+        case JALR:
+            core.reg[regB] = core.pc + 1;
+            core.pc = core.reg[regA] - 1;
+            break;
+        case NOOP:
+            break;
+        case HALT:
+            halted = 1;
+            break;
+        default:
+            printf("error: opcode isn't recognized");
+            exit(1);
+    }
+
+    core.pc++;
+    return halted;
+}
+
+void waitForQuantum(quantumBarrierStruct &barrier, bool isLeaving) {
+    std::unique_lock<std::mutex> guard(barrier.lock);
+
+    if (isLeaving) {
+        barrier.numOfCores--;
+    } else {
+        barrier.numArrived++;
+    }
+
+    if (barrier.numArrived >= barrier.numOfCores) {
+        barrier.numArrived = 0;
+        barrier.generation++;
+        barrier.isReleased.notify_all();
+        return;
+    }
+
+    if (!isLeaving) {
+        long long generation = barrier.generation;
+        barrier.isReleased.wait(guard, [&barrier, generation] { return barrier.generation != generation; });
+    }
+}
+
+// ##########################################################################################
+// # A read hit only needs this core's cache. A miss goes on the bus as a read: a dirty     #
+// # copy elsewhere supplies the data, and the block comes in exclusive if nobody else has  #
+// # it, shared otherwise.                                                                  #
+// ##########################################################################################
+
+int coherentRead(cacheStruct &cache, int address) {
+    busStruct &bus = *cache.bus;
+    bool isOnBus = false;
+
+    bus.cacheLocks[cache.coreNumber].lock();
+    cache.stats.accesses++;
+    blockStruct *block = getCacheBlock(cache, address);
+
+    if (block == NULL) {
+        // only this core fills its own cache, so the block is still missing once it has the bus
+        bus.cacheLocks[cache.coreNumber].unlock();
+        acquireBus(bus);
+        isOnBus = true;
+        cache.stats.misses++;
+        block = fillOnBus(cache, address, false);
+    } else {
+        cache.stats.hits++;
+        updateLRU(cache, address);
+    }
+
+    markWordTouched(cache, *block, address);
+    int data = cache.isTagOnly ? bus.memoryState->mem[address] : block->lines[getBlockOffset(cache, address)];
+
+    if (isOnBus) {
+        releaseBus(bus);
+    } else {
+        bus.cacheLocks[cache.coreNumber].unlock();
+    }
+
+    return data;
+}
+
+// ##########################################################################################
+// # Writing a modified or exclusive block needs nobody else. A shared or owned block has   #
+// # to invalidate the other copies first (an upgrade), and a miss reads the block for      #
+// # ownership, which invalidates them as part of the fill. Either way it ends up modified. #
+// ##########################################################################################
+
+void coherentWrite(cacheStruct &cache, int address, int data) {
+    busStruct &bus = *cache.bus;
+    bool isOnBus = false;
+
+    bus.cacheLocks[cache.coreNumber].lock();
+    cache.stats.accesses++;
+    blockStruct *block = getCacheBlock(cache, address);
+
+    if (block == NULL || block->coherence == sharedState || block->coherence == ownedState) {
+        bus.cacheLocks[cache.coreNumber].unlock();
+        acquireBus(bus);
+        isOnBus = true;
+
+        // another core's write may have invalidated the block while this one waited for the bus
+        block = getCacheBlock(cache, address);
+        if (block != NULL) {
+            bus.upgrades++;
+            invalidateCopies(bus, cache.coreNumber, address);
+        }
+    }
+
+    if (block == NULL) {
+        cache.stats.misses++;
+        block = fillOnBus(cache, address, true);
+    } else {
+        cache.stats.hits++;
+        updateLRU(cache, address);
+    }
+
+    if (cache.isTagOnly) {
+        bus.memoryState->mem[address] = data;
+    } else {
+        block->lines[getBlockOffset(cache, address)] = data;
+    }
+    setCoherence(*block, modifiedState);
+    markWordTouched(cache, *block, address);
+
+    if (isOnBus) {
+        releaseBus(bus);
+    } else {
+        bus.cacheLocks[cache.coreNumber].unlock();
+    }
+}
+
+// ##########################################################################################
+// # Snoops the other caches and then fills the block. A modified copy answering a read     #
+// # supplies the data and drops to shared, writing back to memory under MESI or keeping    #
+// # the dirty data as the owner under MOESI. Memory is brought up to date either way so    #
+// # the fill can read it, but under MOESI that isn't counted as a writeback. A read for    #
+// # ownership invalidates every copy.                                                      #
+// ##########################################################################################
+
+blockStruct *fillOnBus(cacheStruct &cache, int address, bool isForWrite) {
+    busStruct &bus = *cache.bus;
+    int blockAddress = address - (address % cache.blockSize);
+    bool isShared = false, wasSupplied = false;
+
+    if (isForWrite) {
+        bus.readExclusives++;
+    } else {
+        bus.reads++;
+    }
+
+    for (size_t i = 0; i < bus.caches.size(); i++) {
+        cacheStruct &other = *bus.caches[i];
+        blockStruct *copy = (int) i == cache.coreNumber ? NULL : getCacheBlock(other, address);
+
+        if (copy == NULL) {
+            continue;
+        }
+
+        isShared = true;
+        if (copy->isDirty) {
+            enum coherenceState coherence = copy->coherence;
+
+            sendDirtyCacheToMemory(*copy, *bus.memoryState, blockAddress, cache.blockSize);
+            bus.cacheToCacheTransfers++;
+            wasSupplied = true;
+
+            if (!isForWrite && !bus.isMoesi) {
+                reportAction(other, blockAddress, cache.blockSize, cacheToMemory);
+                other.stats.writebacks++;
+                bus.snoopWritebacks++;
+                coherence = sharedState;
+            } else if (!isForWrite) {
+                coherence = ownedState;
+            }
+            setCoherence(*copy, coherence);
+        } else if (!isForWrite) {
+            setCoherence(*copy, sharedState);
+        }
+    }
+
+    if (isForWrite) {
+        invalidateCopies(bus, cache.coreNumber, address);
+    }
+
+    loadCacheFromMemory(cache, *bus.memoryState, address);
+    if (!wasSupplied) {
+        reportAction(cache, blockAddress, cache.blockSize, memoryToCache);
+    }
+
+    blockStruct *block = getCacheBlock(cache, address);
+    memset(block->touchedWords, 0, sizeof(block->touchedWords));
+    setCoherence(*block, isForWrite ? modifiedState : (isShared ? sharedState : exclusiveState));
+
+    return block;
+}
+
+// Drops every other core's copy of the block, noting which of them never used the word being written.
+void invalidateCopies(busStruct &bus, int coreNumber, int address) {
+    for (size_t i = 0; i < bus.caches.size(); i++) {
+        cacheStruct &other = *bus.caches[i];
+        blockStruct *copy = (int) i == coreNumber ? NULL : getCacheBlock(other, address);
+
+        if (copy == NULL) {
+            continue;
+        }
+
+        int blockAddress = address - (address % other.blockSize);
+        int blockOffset = getBlockOffset(other, address);
+        hotspotStruct &hotspot = bus.hotspots[blockAddress];
+
+        hotspot.invalidations++;
+        if ((copy->touchedWords[blockOffset / 64] & (1ULL << (blockOffset % 64))) == 0) {
+            hotspot.falseSharing++;
+        }
+        bus.invalidations++;
+
+        // a dirty copy already handed its data over in fillOnBus, or is being overwritten by its owner's upgrade
+        setBlockTag(other, *copy, -1);
+        setCoherence(*copy, invalidState);
+    }
+}
+
+// Keeps the valid and dirty bits the rest of the cache goes by in step with the coherence state.
+void setCoherence(blockStruct &block, enum coherenceState coherence) {
+    block.coherence = coherence;
+    block.isValid = coherence != invalidState;
+    block.isDirty = coherence == modifiedState || coherence == ownedState;
+}
+
+void markWordTouched(cacheStruct &cache, blockStruct &block, int address) {
+    int blockOffset = getBlockOffset(cache, address);
+    block.touchedWords[blockOffset / 64] |= 1ULL << (blockOffset % 64);
+}
+
+void acquireBus(busStruct &bus) {
+    bus.lock.lock();
+    for (size_t i = 0; i < bus.cacheLocks.size(); i++) {
+        bus.cacheLocks[i].lock();
+    }
+}
+
+void releaseBus(busStruct &bus) {
+    for (size_t i = bus.cacheLocks.size(); i > 0; i--) {
+        bus.cacheLocks[i - 1].unlock();
+    }
+    bus.lock.unlock();
+}
+
+void printMultiCoreStats(multiCoreStruct &multiCore) {
+    busStruct &bus = multiCore.bus;
+    std::vector<std::pair<int, hotspotStruct> > hotspots(bus.hotspots.begin(), bus.hotspots.end());
+
+    for (size_t i = 0; i < multiCore.cores.size(); i++) {
+        cacheStatsStruct &stats = multiCore.cores[i].cache->stats;
+        printf("core %d: %lld instructions, %lld accesses, %lld hits, %lld misses, %lld writebacks, "
+               "%lld words read, %lld words written\n", (int) i, multiCore.cores[i].numOfInstructions,
+               stats.accesses, stats.hits, stats.misses, stats.writebacks, stats.wordsFromMemory,
+               stats.wordsToMemory);
+    }
+
+    printf("bus (%s): %lld reads, %lld read-exclusives, %lld upgrades, %lld invalidations, "
+           "%lld cache-to-cache transfers, %lld snoop writebacks\n", bus.isMoesi ? "moesi" : "mesi", bus.reads,
+           bus.readExclusives, bus.upgrades, bus.invalidations, bus.cacheToCacheTransfers, bus.snoopWritebacks);
+
+    std::sort(hotspots.begin(), hotspots.end(),
+              [](const std::pair<int, hotspotStruct> &a, const std::pair<int, hotspotStruct> &b) {
+                  if (a.second.falseSharing != b.second.falseSharing) {
+                      return a.second.falseSharing > b.second.falseSharing;
+                  }
+                  if (a.second.invalidations != b.second.invalidations) {
+                      return a.second.invalidations > b.second.invalidations;
+                  }
+                  return a.first < b.first;
+              });
+
+    if (!hotspots.empty()) {
+        printf("invalidation hotspots (block address, invalidations, false sharing):\n");
+    }
+    for (size_t i = 0; i < hotspots.size() && i < 10; i++) {
+        printf("%8d %8lld %8lld\n", hotspots[i].first, hotspots[i].second.invalidations,
+               hotspots[i].second.falseSharing);
+    }
+}
+
+//// ########################################################################################################
+//// #        TIMING: Cycles, stalls and MSHRs on top of the hit/miss model                                 #
+//// ########################################################################################################
+
+void initializeTiming(timingStruct &timing, optionsType &options) {
+    timing.hitLatency = options.hitLatency;
+    timing.bufferLatency = options.bufferLatency;
+    timing.memoryLatency = options.memoryLatency;
+    timing.wordsPerCycle = options.wordsPerCycle;
+    timing.numOfMSHRs = options.numOfMSHRs;
+    timing.cycle = 0;
+    timing.channelFreeCycle = 0;
+    timing.mshrs.clear();
+    memset(timing.registerReady, 0, sizeof(timing.registerReady));
+    timing.accessStart = 0;
+    timing.pendingReady = -1;
+    timing.lastFillReady = -1;
+    timing.lastReady = 0;
+    timing.numOfInstructions = 0;
+    timing.accesses = 0;
+    timing.latencySum = 0;
+    timing.stallCycles = 0;
+    timing.mshrFullCycles = 0;
+    timing.hitsUnderMiss = 0;
+    timing.missesUnderMiss = 0;
+    timing.delayedHits = 0;
+    timing.slowHitCycles = 0;
+}
+
+// ##########################################################################################
+// # Called once the cache knows whether the access hits. Fills that have arrived give     #
+// # their MSHRs back; a miss with none free waits for the first one to come back.          #
+// ##########################################################################################
+
+void beginTimedAccess(cacheStruct &cache, int address, bool wasHit) {
+    if (cache.timing == NULL) {
+        return;
+    }
+
+    timingStruct &timing = *cache.timing;
+    int blockAddress = address - (address % cache.blockSize);
+
+    for (size_t i = 0; i < timing.mshrs.size();) {
+        if (timing.mshrs[i].readyCycle <= timing.cycle) {
+            timing.mshrs.erase(timing.mshrs.begin() + i);
+        } else {
+            i++;
+        }
+    }
+
+    timing.pendingReady = -1;
+    for (size_t i = 0; i < timing.mshrs.size(); i++) {
+        if (timing.mshrs[i].blockAddress == blockAddress) {
+            timing.pendingReady = timing.mshrs[i].readyCycle;
+        }
+    }
+
+    if (!wasHit && timing.pendingReady < 0 && (int) timing.mshrs.size() >= timing.numOfMSHRs) {
+        long long firstReady = timing.mshrs[0].readyCycle;
+        size_t first = 0;
+
+        for (size_t i = 1; i < timing.mshrs.size(); i++) {
+            if (timing.mshrs[i].readyCycle < firstReady) {
+                firstReady = timing.mshrs[i].readyCycle;
+                first = i;
+            }
+        }
+
+        timing.mshrFullCycles += firstReady - timing.cycle;
+        stallUntil(timing, firstReady);
+        timing.mshrs.erase(timing.mshrs.begin() + first);
+    }
+
+    if (timing.pendingReady < 0 && !timing.mshrs.empty()) {
+        if (wasHit) {
+            timing.hitsUnderMiss++;
+        } else {
+            timing.missesUnderMiss++;
+        }
+    }
+
+    timing.accessStart = timing.cycle;
+    timing.lastFillReady = -1;
+    timing.slowHitCycles = 0;
+}
+
+void endTimedAccess(cacheStruct &cache, bool wasHit, bool wasBufferHit) {
+    if (cache.timing == NULL) {
+        return;
+    }
+
+    timingStruct &timing = *cache.timing;
+    long long ready;
+
+    if (timing.lastFillReady >= 0) {
+        ready = timing.lastFillReady;
+    } else if (timing.pendingReady >= 0) {
+        ready = std::max(timing.pendingReady, timing.accessStart + timing.hitLatency + timing.slowHitCycles);
+        timing.delayedHits++;
+    } else if (wasHit) {
+        ready = timing.accessStart + timing.hitLatency + timing.slowHitCycles;
+    } else if (wasBufferHit) {
+        ready = timing.accessStart + timing.bufferLatency;
+    } else {
+        // a store written around the cache costs the processor no more than a hit
+        ready = timing.accessStart + timing.hitLatency;
+    }
+
+    timing.lastReady = ready;
+    timing.accesses++;
+    timing.latencySum += ready - timing.accessStart;
+}
+
+// Transfers queue for the memory channel; a read also holds an MSHR until its data is back, and
+// returns when that is (-1 for a write).
+long long timeMemoryTransfer(timingStruct &timing, int address, int size, bool isRead) {
+    long long start = std::max(timing.cycle, timing.channelFreeCycle);
+    long long transferCycles = (size + timing.wordsPerCycle - 1) / timing.wordsPerCycle;
+
+    timing.channelFreeCycle = start + transferCycles;
+
+    if (isRead) {
+        mshrStruct mshr;
+        mshr.blockAddress = address;
+        mshr.readyCycle = start + timing.memoryLatency + transferCycles;
+        timing.mshrs.push_back(mshr);
+        return mshr.readyCycle;
+    }
+
+    return -1;
+}
+
+// Before an instruction issues it waits out whatever of its fetch a hit wouldn't have hidden, and any load it
+// reads a register of. Anything it writes besides a load is ready right away.
+// (A load's register is ready at issue only until loadWord says when its data comes back.)
+void issueInstruction(timingStruct &timing, int instruction) {
+    const isaInstructionStruct &format = isaInstructions[getOpCode(instruction)];
+
+    stallUntil(timing, timing.lastReady - timing.hitLatency);
+    timing.numOfInstructions++;
+
+    if ((format.reads & READSREGA) != 0) {
+        stallUntil(timing, timing.registerReady[getRegA(instruction)]);
+    }
+    if ((format.reads & READSREGB) != 0) {
+        stallUntil(timing, timing.registerReady[getRegB(instruction)]);
+    }
+
+    if (format.writes == writesDestination) {
+        timing.registerReady[getDestination(instruction)] = 0;
+    } else if (format.writes == writesRegB) {
+        timing.registerReady[getRegB(instruction)] = 0;
+    }
+}
+
+void stallUntil(timingStruct &timing, long long readyCycle) {
+    if (readyCycle > timing.cycle) {
+        timing.stallCycles += readyCycle - timing.cycle;
+        timing.cycle = readyCycle;
+    }
+}
+
+void printTiming(timingStruct &timing) {
+    double amat = timing.accesses == 0 ? 0.0 : (double) timing.latencySum / timing.accesses;
+    double cpi = timing.numOfInstructions == 0 ? 0.0 : (double) timing.cycle / timing.numOfInstructions;
+
+    printf("timing: %lld cycles, %lld instructions (CPI %.4f), %lld stall cycles, AMAT %.4f cycles\n",
+           timing.cycle, timing.numOfInstructions, cpi, timing.stallCycles, amat);
+    printf("mshrs: %lld hits under miss, %lld misses under miss, %lld delayed hits, "
+           "%lld cycles waiting for a free mshr\n", timing.hitsUnderMiss, timing.missesUnderMiss,
+           timing.delayedHits, timing.mshrFullCycles);
+}
+
+//// ########################################################################################################
+//// #        BANKS: An address-interleaved, multi-ported L1 under a wide issue                             #
+//// ########################################################################################################
+
+// ##########################################################################################
+// # The instructions are issued in bundles of issueWidth, in order, and each bundle's      #
+// # loads and stores go to the L1 in the cycle it issues. Word address / interleave picks  #
+// # the bank. A bank takes as many accesses a cycle as it has ports, so a bundle sending   #
+// # more to one bank holds the issue until the last of them gets a port: a conflict, and   #
+// # the extra cycles are stalls. Fetches are left to the instruction side. The banking     #
+// # doesn't change what hits, so every combination of bank and port counts is judged on    #
+// # the same bundles in one pass, and -timing is left as it was.                           #
+// ##########################################################################################
+
+void initializeBanks(bankStruct &banks, optionsType &options) {
+    banks.issueWidth = options.issueWidth;
+    banks.interleave = options.bankInterleave;
+    banks.numOfInstructions = 0;
+    banks.numOfBundles = 0;
+    banks.numOfDataAccesses = 0;
+
+    for (size_t i = 0; i < options.bankCounts.size(); i++) {
+        for (size_t j = 0; j < options.portCounts.size(); j++) {
+            bankConfigStruct config;
+            config.numOfBanks = options.bankCounts[i];
+            config.numOfPorts = options.portCounts[j];
+            config.cycles = 0;
+            config.numOfConflicts = 0;
+            config.stallCycles = 0;
+            config.busyPorts.assign(config.numOfBanks, 0);
+            config.requests.assign(config.numOfBanks, 0);
+            banks.configs.push_back(config);
+        }
+    }
+}
+
+// Every instruction is fetched exactly once, so the fetches mark where the bundles start.
+void recordBankAccess(bankStruct &banks, int address, enum accessType type) {
+    if (type != instructionFetch) {
+        banks.dataAddresses.push_back(address);
+        banks.numOfDataAccesses++;
+    } else if (banks.numOfInstructions == banks.issueWidth) {
+        issueBundle(banks);
+        banks.numOfInstructions = 1;
+    } else {
+        banks.numOfInstructions++;
+    }
+}
+
+void issueBundle(bankStruct &banks) {
+    for (size_t i = 0; i < banks.configs.size(); i++) {
+        bankConfigStruct &config = banks.configs[i];
+        int mostRequests = 0;
+
+        for (size_t j = 0; j < banks.dataAddresses.size(); j++) {
+            int bank = (banks.dataAddresses[j] / banks.interleave) % config.numOfBanks;
+            mostRequests = std::max(mostRequests, ++config.requests[bank]);
+            config.busyPorts[bank]++;
+        }
+        for (size_t j = 0; j < banks.dataAddresses.size(); j++) {
+            config.requests[(banks.dataAddresses[j] / banks.interleave) % config.numOfBanks] = 0;
+        }
+
+        int cycles = std::max(1, (mostRequests + config.numOfPorts - 1) / config.numOfPorts);
+        config.cycles += cycles;
+        config.stallCycles += cycles - 1;
+        config.numOfConflicts += cycles > 1;
+    }
+
+    banks.numOfBundles++;
+    banks.dataAddresses.clear();
+}
+
+// Utilization is the share of a bank's port-cycles that were used.
+void printBankStats(bankStruct &banks) {
+    if (banks.numOfInstructions > 0) {
+        issueBundle(banks);
+        banks.numOfInstructions = 0;
+    }
+
+    printf("banks: %lld loads and stores in %lld bundles of %d instructions, %d word%s per bank\n",
+           banks.numOfDataAccesses, banks.numOfBundles, banks.issueWidth, banks.interleave,
+           banks.interleave == 1 ? "" : "s");
+
+    for (size_t i = 0; i < banks.configs.size(); i++) {
+        bankConfigStruct &config = banks.configs[i];
+        double portCycles = (double) config.cycles * config.numOfPorts;
+        long long busiest = *std::max_element(config.busyPorts.begin(), config.busyPorts.end());
+
+        printf("%d banks x %d ports: %lld cycles, %lld stall cycles, conflicts in %lld bundles (%.4f), "
+               "utilization %.4f, busiest bank %.4f\n", config.numOfBanks, config.numOfPorts, config.cycles,
+               config.stallCycles, config.numOfConflicts,
+               banks.numOfBundles == 0 ? 0.0 : (double) config.numOfConflicts / banks.numOfBundles,
+               portCycles == 0 ? 0.0 : banks.numOfDataAccesses / (portCycles * config.numOfBanks),
+               portCycles == 0 ? 0.0 : busiest / portCycles);
+
+        if (banks.configs.size() == 1) {
+            for (int bank = 0; bank < config.numOfBanks; bank++) {
+                printf("\tbank %d: %lld accesses, utilization %.4f\n", bank, config.busyPorts[bank],
+                       portCycles == 0 ? 0.0 : config.busyPorts[bank] / portCycles);
+            }
+        }
+    }
+}
+
+//// ########################################################################################################
+//// #        WAY PREDICTION: Guessing the way before the tags are compared, for a direct-mapped hit time   #
+//// ########################################################################################################
+
+// ##########################################################################################
+// # A predicted way is read straight away, as if the cache were direct-mapped. If the      #
+// # block turns out to be in another way, the hit takes extraLatency more cycles while     #
+// # the rest of the set is searched. Misses go to memory either way and aren't counted.    #
+// # The mru predictor guesses the way the set used last. The pc predictor keeps the way    #
+// # each pc's last access used in a table, with fetches and data accesses kept apart.      #
+// # Both learn from every access, misses included, once the block is in.                   #
+// ##########################################################################################
+
+void initializeWayPredictor(wayPredictorStruct &wayPredictor, cacheStruct &cache, optionsType &options) {
+    wayPredictor.kind = options.wayPredictionKind;
+    wayPredictor.mruWays.assign(cache.numOfSets, 0);
+    wayPredictor.pcWays.assign(options.wayPredictionKind == pcPrediction ? options.wayTableSize : 0, 0);
+    wayPredictor.extraLatency = 1;
+    wayPredictor.hitLatency = options.hitLatency;
+    wayPredictor.hits = 0;
+    wayPredictor.correct = 0;
+}
+
+int *getPredictedWay(cacheStruct &cache, stateType &state, int address, enum accessType type) {
+    wayPredictorStruct &wayPredictor = *cache.wayPredictor;
+
+    if (wayPredictor.kind == mruPrediction) {
+        return &wayPredictor.mruWays[getSetOffset(cache, address)];
+    }
+
+    unsigned int entry = 2 * (unsigned int) state.pc + (type != instructionFetch);
+    return &wayPredictor.pcWays[entry % wayPredictor.pcWays.size()];
+}
+
+// Called once the access knows whether it hit, before anything moves.
+void checkWayPrediction(cacheStruct &cache, stateType &state, int address, enum accessType type, bool wasHit) {
+    if (!wasHit) {
+        return;
+    }
+
+    wayPredictorStruct &wayPredictor = *cache.wayPredictor;
+    bool isCorrect = getCacheBlock(cache, address)->blockIndex == *getPredictedWay(cache, state, address, type);
+
+    wayPredictor.hits++;
+    wayPredictor.correct += isCorrect;
+    if (!isCorrect && cache.timing != NULL) {
+        cache.timing->slowHitCycles = wayPredictor.extraLatency;
+    }
+}
+
+void trainWayPredictor(cacheStruct &cache, stateType &state, int address, enum accessType type) {
+    blockStruct *block = getCacheBlock(cache, address);
+    if (block != NULL) {
+        cache.wayPredictor->mruWays[block->setIndex] = block->blockIndex;
+        *getPredictedWay(cache, state, address, type) = block->blockIndex;
+    }
+}
+
+void printWayPredictionStats(wayPredictorStruct &wayPredictor) {
+    double accuracy = wayPredictor.hits == 0 ? 0.0 : (double) wayPredictor.correct / wayPredictor.hits;
+
+    printf("way prediction (%s): %lld of %lld hits in the predicted way (%.4f), average hit latency %.4f cycles "
+           "against %d direct-mapped\n", wayPredictor.kind == mruPrediction ? "mru" : "pc", wayPredictor.correct,
+           wayPredictor.hits, accuracy,
+           wayPredictor.hitLatency + (1.0 - (wayPredictor.hits == 0 ? 1.0 : accuracy)) * wayPredictor.extraLatency,
+           wayPredictor.hitLatency);
+}
+
+//// ########################################################################################################
+//// #        SAMPLING: Estimate the miss rate from a subset of the sets or of the trace                    #
+//// ########################################################################################################
+
+// ##########################################################################################
+// # Sets don't interact, so the sampled sets are packed into a small cache of their own:   #
+// # an address keeps its tag and block offset and gets the sampled set's position as its   #
+// # set index. Time sampling leaves the cache alone for the skipped part of each period    #
+// # and only counts the measured part. The estimate is a ratio estimate over the sampled   #
+// # sets (or the measured intervals), with a 95% bound from how much they vary.            #
+// ##########################################################################################
+
+void runSampled(std::vector<accessStruct> &trace, cacheStruct &cache, optionsType &options) {
+    cacheStruct *sampleCache = new cacheStruct;
+    stateType *state = new stateType;
+    std::vector<int> sampleOf;
+    std::vector<sampleUnitStruct> sets, intervals;
+    sampleUnitStruct emptyUnit = {0, 0};
+    long long numOfSimulated = 0, numOfMeasured = 0;
+
+    if (cache.blockSize < 1 || cache.blockSize > 256 || (cache.blockSize & (cache.blockSize - 1)) != 0
+        || cache.numOfSets < 1 || (cache.numOfSets & (cache.numOfSets - 1)) != 0
+        || options.numOfSampledSets > cache.numOfSets) {
+        printf("error: unsupported cache geometry %d %d %d\n", cache.blockSize, cache.numOfSets,
+               cache.blocksPerSet);
+        exit(1);
+    }
+
+    setNumberOfBits(cache);
+    chooseSampledSets(cache, options, sampleOf);
+    int numOfSampledSets = options.numOfSampledSets > 0 ? options.numOfSampledSets : cache.numOfSets;
+
+    configureCache(*sampleCache, cache.blockSize, numOfSampledSets, cache.blocksPerSet);
+    sampleCache->policy = options.policy;
+    sampleCache->isWriteThrough = options.writePolicy.isWriteThrough;
+    sampleCache->isWriteAllocate = options.writePolicy.isWriteAllocate;
+    sampleCache->isQuiet = true;
+    sampleCache->isTagOnly = true;
+    checkCacheGeometry(*sampleCache);
+    initializeCacheBlocks(*sampleCache);
+    cacheEngineFunction engine = getCacheEngine(*sampleCache);
+
+    memset(state->mem, 0, sizeof(state->mem));
+    state->numMemory = 0;
+    sets.assign(numOfSampledSets, emptyUnit);
+
+    for (size_t i = 0; i < trace.size(); i++) {
+        bool isMeasured = true;
+
+        if (options.samplePeriod > 0) {
+            int position = (int) (i % options.samplePeriod);
+            int skipped = options.samplePeriod - options.sampleWarmup - options.sampleMeasure;
+
+            if (position < skipped) {
+                continue;
+            }
+            isMeasured = position >= skipped + options.sampleWarmup;
+            if (isMeasured && position == skipped + options.sampleWarmup) {
+                intervals.push_back(emptyUnit);
+            }
+        }
+
+        int sample = sampleOf[getSetOffset(cache, trace[i].address)];
+        if (sample < 0) {
+            continue;
+        }
+
+        int address = (getTag(cache, trace[i].address) << (sampleCache->setBits + sampleCache->blockBits))
+                      + (sample << sampleCache->blockBits) + getBlockOffset(cache, trace[i].address);
+        long long missesBefore = sampleCache->stats.misses;
+
+        accessStruct access = trace[i];
+        access.address = address;
+
+        if (engine != NULL) {
+            engine(*sampleCache, &access, 1);
+        } else {
+            state->pc = access.pc;
+            if (access.type == dataStore) {
+                processorWrite(*sampleCache, *state, address, 0);
+            } else {
+                processorRead(*sampleCache, *state, address, access.type);
+            }
+        }
+        numOfSimulated++;
+
+        if (isMeasured) {
+            long long misses = sampleCache->stats.misses - missesBefore;
+
+            numOfMeasured++;
+            sets[sample].accesses++;
+            sets[sample].misses += misses;
+            if (!intervals.empty()) {
+                intervals.back().accesses++;
+                intervals.back().misses += misses;
+            }
+        }
+    }
+
+    long long accesses = 0, misses = 0;
+    for (size_t i = 0; i < sets.size(); i++) {
+        accesses += sets[i].accesses;
+        misses += sets[i].misses;
+    }
+
+    double missRate = accesses == 0 ? 0.0 : (double) misses / accesses;
+
+    printf("sampled %d of %d sets, simulated %lld and measured %lld of %lld accesses\n", numOfSampledSets,
+           cache.numOfSets, numOfSimulated, numOfMeasured, (long long) trace.size());
+    printf("miss rate %.4f, about %.0f misses in the full trace\n", missRate, missRate * trace.size());
+
+    if (options.numOfSampledSets > 0) {
+        double error = getSampleError(sets, (double) numOfSampledSets / cache.numOfSets);
+        printf("95%% bound across sets: +/- %.4f (+/- %.0f misses)\n", error, error * trace.size());
+    }
+    if (options.samplePeriod > 0) {
+        double error = getSampleError(intervals, 0.0);
+        printf("95%% bound across %d intervals: +/- %.4f (+/- %.0f misses)\n", (int) intervals.size(), error,
+               error * trace.size());
+    }
+
+    delete state;
+    delete sampleCache;
+}
+
+// Every set not sampled maps to -1; the sampled ones, the numOfSampledSets with the lowest hashes, to 0, 1, ...
+void chooseSampledSets(cacheStruct &cache, optionsType &options, std::vector<int> &sampleOf) {
+    std::vector<std::pair<unsigned int, int> > hashes;
+
+    if (options.numOfSampledSets == 0) {
+        for (int set = 0; set < cache.numOfSets; set++) {
+            sampleOf.push_back(set);
+        }
+        return;
+    }
+
+    for (int set = 0; set < cache.numOfSets; set++) {
+        hashes.push_back(std::make_pair(hashSet(set, options.sampleSeed), set));
+    }
+    std::sort(hashes.begin(), hashes.end());
+
+    sampleOf.assign(cache.numOfSets, -1);
+    for (int i = 0; i < options.numOfSampledSets; i++) {
+        sampleOf[hashes[i].second] = i;
+    }
+}
+
+unsigned int hashSet(int set, unsigned int seed) {
+    unsigned int hash = (unsigned int) set * 0x9e3779b1u ^ seed * 0x85ebca6bu;
+    hash ^= hash >> 16;
+    hash *= 0x7feb352du;
+    hash ^= hash >> 15;
+    hash *= 0x846ca68bu;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+// ##########################################################################################
+// # 1.96 standard errors of the ratio estimate sum(misses) / sum(accesses) over the units, #
+// # with the finite population correction for the fraction of all units that were sampled. #
+// ##########################################################################################
+
+double getSampleError(std::vector<sampleUnitStruct> &units, double fraction) {
+    double accesses = 0.0, misses = 0.0, spread = 0.0;
+    int numOfUnits = (int) units.size();
+
+    if (numOfUnits < 2) {
+        return 0.0;
+    }
+
+    for (int i = 0; i < numOfUnits; i++) {
+        accesses += units[i].accesses;
+        misses += units[i].misses;
+    }
+    if (accesses == 0.0) {
+        return 0.0;
+    }
+
+    double ratio = misses / accesses;
+    for (int i = 0; i < numOfUnits; i++) {
+        double residual = units[i].misses - ratio * units[i].accesses;
+        spread += residual * residual;
+    }
+
+    double meanAccesses = accesses / numOfUnits;
+    double variance = spread / (numOfUnits - 1);
+    return 1.96 * sqrt((1.0 - fraction) * variance / numOfUnits) / meanAccesses;
+}
+
+//// ########################################################################################################
+//// #        TAG COMPARE: Searching a set's ways, with SIMD where the CPU has it                           #
+//// ########################################################################################################
+
+void setBlockTag(cacheStruct &cache, blockStruct &block, int tag) {
+    block.tag = tag;
+    cache.tags[block.setIndex * cache.blocksPerSet + block.blockIndex] = tag;
+}
+
+// ##########################################################################################
+// # NULL picks AVX2, or else SSE4, from 8 ways up if the CPU has them; below that the      #
+// # scalar loop wins (see -benchlookup). Asking for a kind the CPU lacks fails.            #
+// ##########################################################################################
+
+findWayFunction getFindWay(const char *name, int blocksPerSet) {
+#if defined(__x86_64__) || defined(__i386__)
+    bool hasAvx2 = __builtin_cpu_supports("avx2");
+    bool hasSse4 = __builtin_cpu_supports("sse4.2");
+
+    if (name == NULL) {
+        if (hasAvx2 && blocksPerSet >= 8) {
+            return findWayAvx2;
+        } else if (hasSse4 && blocksPerSet >= 8) {
+            return findWaySse4;
+        }
+        return findWayScalar;
+    } else if (strcmp(name, "avx2") == 0 && hasAvx2) {
+        return findWayAvx2;
+    } else if (strcmp(name, "sse4") == 0 && hasSse4) {
+        return findWaySse4;
+    }
+#else
+    if (name == NULL) {
+        return findWayScalar;
     }
+#endif
 
-    // partition the cache into sets and block-indices per set
-    // using integer division to combine all of the blocks (numSets * blocksPer) into categories
-    for (int i = 0; i < (cache.numOfSets * cache.blocksPerSet); i++) {
-        cache.blocks[i].setIndex = (i / cache.blocksPerSet);
-        cache.blocks[i].blockIndex = (i % cache.blocksPerSet);
+    if (strcmp(name, "scalar") == 0) {
+        return findWayScalar;
     }
 
+    printf("error: tag compare %s isn't available\n", name);
+    exit(1);
 }
 
-void setNumberOfBits(cacheStruct &cache) {
-    int numOfBlockBits = log2(cache.blockSize);
-    int numOfSetBits = log2(cache.numOfSets);
+int findWayScalar(const int *tags, int numOfWays, int tag) {
+    for (int way = 0; way < numOfWays; way++) {
+        if (tags[way] == tag) {
+            return way;
+        }
+    }
 
-    cache.blockBits = numOfBlockBits;
-    cache.setBits = numOfSetBits;
+    return -1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// Invalid blocks hold tag -1, which no address has, so a match means a valid block. Lanes past the last way
+// are masked off.
+__attribute__((target("sse4.2")))
+int findWaySse4(const int *tags, int numOfWays, int tag) {
+    __m128i key = _mm_set1_epi32(tag);
+
+    for (int way = 0; way < numOfWays; way += 4) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *) (tags + way));
+        unsigned int mask = (unsigned int) _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(chunk, key)));
+
+        if (numOfWays - way < 4) {
+            mask &= (1u << (numOfWays - way)) - 1;
+        }
+        if (mask != 0) {
+            return way + __builtin_ctz(mask);
+        }
+    }
+
+    return -1;
+}
+
+__attribute__((target("avx2")))
+int findWayAvx2(const int *tags, int numOfWays, int tag) {
+    __m256i key = _mm256_set1_epi32(tag);
+
+    for (int way = 0; way < numOfWays; way += 8) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *) (tags + way));
+        unsigned int mask = (unsigned int) _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(chunk, key)));
+
+        if (numOfWays - way < 8) {
+            mask &= (1u << (numOfWays - way)) - 1;
+        }
+        if (mask != 0) {
+            return way + __builtin_ctz(mask);
+        }
+    }
+
+    return -1;
+}
+
+#endif
+
+// ##########################################################################################
+// # "lrucache -benchlookup": fills a 256-block cache of each associativity and times       #
+// # getCacheBlock on a mix of hits and misses with each tag compare the CPU supports.      #
+// ##########################################################################################
+
+void benchmarkLookups() {
+    const int numOfAddresses = 4096, numOfRounds = 2000;
+    const char *names[] = {"scalar", "sse4", "avx2"};
+    int associativities[] = {1, 2, 4, 8, 16, 32, 64};
+    cacheStruct *cache = new cacheStruct;
+    stateType *state = new stateType;
+    std::vector<int> addresses;
+    unsigned int random = 1;
+
+    memset(state->mem, 0, sizeof(state->mem));
+    printf("million lookups per second\n");
+    printf("%6s %10s %10s %10s %8s\n", "ways", names[0], names[1], names[2], "hits");
+
+    for (size_t i = 0; i < sizeof(associativities) / sizeof(associativities[0]); i++) {
+        int blocksPerSet = associativities[i];
+
+        configureCache(*cache, 4, MAXNUMOFBLOCKS / blocksPerSet, blocksPerSet);
+        cache->isQuiet = true;
+        cache->isTagOnly = true;
+        initializeCacheBlocks(*cache);
+
+        // fill every block, then look up a mix where about half the addresses are resident
+        for (int address = 0; address < MAXNUMOFBLOCKS * 4; address += 4) {
+            processorRead(*cache, *state, address, dataLoad);
+        }
+        addresses.clear();
+        for (int j = 0; j < numOfAddresses; j++) {
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+            addresses.push_back((int) (random % (MAXNUMOFBLOCKS * 8)));
+        }
+
+        long long numOfHits = 0;
+        printf("%6d", blocksPerSet);
+        for (int kind = 0; kind < 3; kind++) {
+#if defined(__x86_64__) || defined(__i386__)
+            bool isSupported = kind == 0 || (kind == 1 ? __builtin_cpu_supports("sse4.2")
+                                                       : __builtin_cpu_supports("avx2"));
+#else
+            bool isSupported = kind == 0;
+#endif
+            if (!isSupported) {
+                printf(" %10s", "-");
+                continue;
+            }
+
+            cache->findWay = getFindWay(names[kind], blocksPerSet);
+            numOfHits = 0;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            for (int round = 0; round < numOfRounds; round++) {
+                for (int j = 0; j < numOfAddresses; j++) {
+                    numOfHits += getCacheBlock(*cache, addresses[j]) != NULL;
+                }
+            }
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            printf(" %10.1f", (double) numOfAddresses * numOfRounds / seconds / 1e6);
+        }
+        printf(" %7.1f%%\n", 100.0 * numOfHits / ((long long) numOfAddresses * numOfRounds));
+    }
+
+    delete state;
+    delete cache;
 }
 
 //// ########################################################################################################
-//// #                       CACHE FUNCTIONS: Get the tag, set offset, and block offset                     #
+//// #          CACHE ENGINES: The counting-only cache compiled for the geometries we run most              #
 //// ########################################################################################################
 
-int getBlockOffset(cacheStruct &cache, int address) {
-    return getBits(address, 0, cache.blockBits - 1);
+constexpr int getLog2(int number) {
+    return number <= 1 ? 0 : 1 + getLog2(number / 2);
 }
 
-int getSetOffset(cacheStruct &cache, int address) {
-    return getBits(address, cache.blockBits, cache.blockBits + cache.setBits - 1);
+// ##########################################################################################
+// # Does what processorRead/processorWrite do for a tag-only, quiet cache with nothing     #
+// # hung off it, step for step, so the counts come out the same. With the block size, the  #
+// # associativity and the policy fixed the shifts are constants and the way loops unroll.  #
+// # The set count stays a runtime mask: that's a single AND either way, and making it a    #
+// # parameter too would multiply the instantiations by nine.                               #
+// ##########################################################################################
+
+template <int BLOCKSIZE, int WAYS, enum replacementPolicy POLICY>
+void runCacheEngine(cacheStruct &cache, const accessStruct *accesses, size_t numOfAccesses) {
+    const int blockBits = getLog2(BLOCKSIZE);
+    const int tagShift = blockBits + cache.setBits;
+    const int setMask = cache.numOfSets - 1;
+
+    for (size_t i = 0; i < numOfAccesses; i++) {
+        int address = accesses[i].address;
+        int tag = address >> tagShift;
+        int firstBlock = ((address >> blockBits) & setMask) * WAYS;
+        blockStruct *blocks = &cache.blocks[firstBlock];
+        int *tags = &cache.tags[firstBlock];
+        bool isStore = accesses[i].type == dataStore;
+        bool isFill = false;
+        int way = -1;
+
+        for (int j = 0; j < WAYS; j++) {
+            if (tags[j] == tag) {
+                way = j;
+            }
+        }
+
+        cache.stats.accesses++;
+        if (way >= 0) {
+            cache.stats.hits++;
+        } else if (isStore && !cache.isWriteAllocate) {
+            cache.stats.misses++;
+            cache.stats.wordsToMemory++;
+            continue;
+        } else {
+            int highestLRU = 0;
+            bool isSetFull = true;
+
+            cache.stats.misses++;
+            for (int j = 0; j < WAYS; j++) {
+                blocks[j].LRU++;
+                highestLRU = std::max(highestLRU, blocks[j].LRU);
+                isSetFull = isSetFull && blocks[j].isValid;
+            }
+
+            int randomWay = -1;
+            if (POLICY == randomPolicy && isSetFull) {
+                randomWay = (int) (nextRandom(cache) % WAYS);
+            }
+
+            for (way = 0; way < WAYS - 1; way++) {
+                if (!blocks[way].isValid || (randomWay >= 0 ? way == randomWay : blocks[way].LRU >= highestLRU)) {
+                    break;
+                }
+            }
+
+            if (blocks[way].isValid && blocks[way].isDirty) {
+                cache.stats.writebacks++;
+                cache.stats.wordsToMemory += BLOCKSIZE;
+            }
+            blocks[way].isValid = true;
+            blocks[way].isDirty = false;
+            blocks[way].tag = tag;
+            blocks[way].LRU = 0;
+            tags[way] = tag;
+            cache.stats.wordsFromMemory += BLOCKSIZE;
+            isFill = true;
+        }
+
+        // a store that just filled its block leaves the ages as the fill set them
+        if (POLICY == lruPolicy && !(isStore && isFill)) {
+            for (int j = 0; j < WAYS; j++) {
+                blocks[j].LRU = j == way ? 0 : blocks[j].LRU + 1;
+            }
+        }
+
+        if (isStore) {
+            blocks[way].isDirty = !cache.isWriteThrough;
+            if (cache.isWriteThrough) {
+                cache.stats.wordsToMemory++;
+            }
+        }
+    }
 }
 
-int getTag(cacheStruct &cache, int address) {
-    return getBits(address, cache.setBits + cache.blockBits, 30);
+// The table for one block size and policy, counted down from 16 ways; the bottom of it says there is none.
+template <int BLOCKSIZE, enum replacementPolicy POLICY, int WAYS>
+struct cacheEngineTable {
+    static cacheEngineFunction find(int blocksPerSet) {
+        if (blocksPerSet == WAYS) {
+            return runCacheEngine<BLOCKSIZE, WAYS, POLICY>;
+        }
+        return cacheEngineTable<BLOCKSIZE, POLICY, WAYS - 1>::find(blocksPerSet);
+    }
+};
+
+template <int BLOCKSIZE, enum replacementPolicy POLICY>
+struct cacheEngineTable<BLOCKSIZE, POLICY, 0> {
+    static cacheEngineFunction find(int) {
+        return NULL;
+    }
+};
+
+template <int BLOCKSIZE>
+cacheEngineFunction findCacheEngine(enum replacementPolicy policy, int blocksPerSet) {
+    if (policy == lruPolicy) {
+        return cacheEngineTable<BLOCKSIZE, lruPolicy, 16>::find(blocksPerSet);
+    } else if (policy == fifoPolicy) {
+        return cacheEngineTable<BLOCKSIZE, fifoPolicy, 16>::find(blocksPerSet);
+    }
+    return cacheEngineTable<BLOCKSIZE, randomPolicy, 16>::find(blocksPerSet);
+}
+
+// ##########################################################################################
+// # Picks the compiled engine for the cache's geometry: blocks of 4, 8 or 16 words and 1   #
+// # to 16 ways, any power-of-two set count. NULL means go through processorRead/Write,     #
+// # which every other geometry does, as does any cache that prints, keeps data or has a    #
+// # buffer, prefetcher, recorder or stats of its own.                                      #
+// ##########################################################################################
+
+cacheEngineFunction getCacheEngine(cacheStruct &cache) {
+    if (!cache.isTagOnly || !cache.isQuiet || cache.isBypassed || cache.writeBuffer != NULL
+        || cache.victimCache != NULL || cache.prefetcher != NULL || cache.analysis != NULL
+        || cache.recordFile != NULL || cache.recordTrace != NULL || cache.detailedStats != NULL
+        || cache.eventLog != NULL || cache.sectors != NULL || cache.bus != NULL || cache.timing != NULL) {
+        return NULL;
+    }
+
+    if (cache.blockSize == 4) {
+        return findCacheEngine<4>(cache.policy, cache.blocksPerSet);
+    } else if (cache.blockSize == 8) {
+        return findCacheEngine<8>(cache.policy, cache.blocksPerSet);
+    } else if (cache.blockSize == 16) {
+        return findCacheEngine<16>(cache.policy, cache.blocksPerSet);
+    }
+    return NULL;
 }
 
 //// ########################################################################################################
-//// #                       CACHE FUNCTIONS: Load the dang data                                            #
+//// #        DEBUGGER: The cache's side of -debug, printing what each set holds                            #
 //// ########################################################################################################
 
-void loadCacheFromMemory(cacheStruct &cache, stateStruct &state, int address) {
-    int setOffset = getSetOffset(cache, address);
-    int tag = getTag(cache, address);
-    int bestBlockIndex = findBestBlock(cache, setOffset, tag, address, state);
-    int lineIndex = 0;
+// The -debug commands only the cache simulator has: "cache" prints every set, or just the one given, and "stats"
+// the counts so far.
+int inspectCache(void *context, const char *command, const char *argument) {
+    cacheStruct &cache = *(cacheStruct *) context;
+    int setIndex;
 
-    for (int i = 0; i < (cache.blocksPerSet * cache.numOfSets); i++) {
-        if (cache.blocks[i].setIndex == setOffset && cache.blocks[i].blockIndex == bestBlockIndex) {
-            for (int j = address; j < (address + cache.blockSize); j++) {
-                cache.blocks[i].lines[lineIndex] = state.mem[j];
-                lineIndex++;
+    if (strcmp(command, "help") == 0) {
+        printf("cache [<set>], stats          print the blocks in every set (or one), or the counts so far\n");
+    } else if (strcmp(command, "cache") == 0) {
+        if (sscanf(argument, "%d", &setIndex) != 1) {
+            for (int i = 0; i < cache.numOfSets; i++) {
+                printCacheSet(cache, i);
             }
+        } else if (setIndex >= 0 && setIndex < cache.numOfSets) {
+            printCacheSet(cache, setIndex);
+        } else {
+            printf("usage: cache [<set>], with sets 0 to %d\n", cache.numOfSets - 1);
         }
+    } else if (strcmp(command, "stats") == 0) {
+        printf("%lld accesses, %lld hits, %lld misses, %lld writebacks\n", cache.stats.accesses, cache.stats.hits,
+               cache.stats.misses, cache.stats.writebacks);
+    } else {
+        return 0;
     }
+    return 1;
+}
 
+// One line per way: its state, the block it holds, and its words unless the cache is tag-only.
+void printCacheSet(cacheStruct &cache, int setIndex) {
+    printf("\tset %d:\n", setIndex);
+
+    for (int way = 0; way < cache.blocksPerSet; way++) {
+        blockStruct &block = cache.blocks[setIndex * cache.blocksPerSet + way];
+
+        if (!block.isValid) {
+            printf("\t\tway %d invalid\n", way);
+            continue;
+        }
+
+        int address = getOldAddress(block, cache);
+        printf("\t\tway %d %s tag %d words %d-%d LRU %d", way, block.isDirty ? "dirty" : "clean", block.tag,
+               address, address + cache.blockSize - 1, block.LRU);
+        if (block.lines != NULL) {
+            printf(":");
+            for (int i = 0; i < cache.blockSize; i++) {
+                printf(" %d", block.lines[i]);
+            }
+        }
+        printf("\n");
+    }
 }
 
-int findBestBlock(cacheStruct &cache, int setOffset, int tag, int address, stateStruct &state) {
-    int highestLRU = 0;
+//// ########################################################################################################
+//// #        SERVER: A daemon that keeps programs loaded and machines allocated between runs               #
+//// ########################################################################################################
 
-    for (int i = 0; i < cache.blocksPerSet * cache.numOfSets; i++) {
-        if (cache.blocks[i].setIndex == setOffset) {
-            cache.blocks[i].LRU++;
-            if (cache.blocks[i].LRU > highestLRU) {
-                highestLRU = cache.blocks[i].LRU;
+// ##########################################################################################
+// # lrucache -serve=<socket> listens on a Unix domain socket with the machine-code files   #
+// # on its command line already read in as images 0, 1, ... Each of -workers threads owns  #
+// # one machine, allocated once, and takes connections off a queue; a connection sends     #
+// # requests one per line and gets a reply to each, so one client can run many programs    #
+// # without paying for a process, a 256 KB state or parsing the program each time:         #
+// #   load <machine-code file>   reads another image and replies with its number.          #
+// #   images                     lists the images.                                         #
+// #   run <image> functional [options]                                                     #
+// #   run <image> cache|timing <blockSize> <numOfSets> <blocksPerSet> [options]            #
+// #                              runs the image from pc 0, quietly and tag-only, and       #
+// #                              replies with the counts and the final pc, registers and   #
+// #                              memory (up to the image's length, as printState shows).   #
+// #                              timing adds the timing model's cycles and stall cycles.   #
+// #   quit                       closes the connection; shutdown stops the server.         #
+// # Run options: -policy=, -writethrough, -nowriteallocate, -writebuffer=, -victimcache=,  #
+// # -misscache=, the -timing latencies, -mem=<address>:<value> and -reg=<reg>:<value> to   #
+// # override the image before it starts, -limit=<n> to stop after n instructions (0 for the#
+// # most the server allows; every run has a limit, so one that never halts still ends), and#
+// # -binary for a runReplyStruct and the memory words instead of a line of JSON. Errors    #
+// # come back as {"error": ...}, or in binary as the message length and the message.       #
+// ##########################################################################################
+
+void runServer(int argc, char *argv[]) {
+    // the workers are never joined, so the server they share outlives this function
+    serverStruct &server = *new serverStruct;
+    struct sockaddr_un address;
+    char error[MAXLINELENGTH];
+    const char *socketName = argv[1] + 7;
+    int numOfWorkers = (int) std::thread::hardware_concurrency();
+
+    for (int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "-workers=", 9) == 0) {
+            numOfWorkers = atoi(argv[i] + 9);
+        } else {
+            server.images.emplace_back();
+            if (!loadImage(argv[i], server.images.back(), error, sizeof(error))) {
+                printf("error: %s\n", error);
+                exit(1);
             }
         }
     }
+    if (numOfWorkers < 1) {
+        numOfWorkers = 1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketName) >= sizeof(address.sun_path)) {
+        printf("error: socket path %s is too long\n", socketName);
+        exit(1);
+    }
+    strcpy(address.sun_path, socketName);
+
+    // a socket left behind by an earlier server would make bind fail
+    unlink(socketName);
+    server.listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server.listener < 0 || bind(server.listener, (struct sockaddr *) &address, sizeof(address)) != 0
+        || listen(server.listener, SOMAXCONN) != 0) {
+        printf("error: can't listen on %s", socketName);
+        perror("socket");
+        exit(1);
+    }
+
+    // a client that hangs up before its reply shouldn't take the server with it
+    signal(SIGPIPE, SIG_IGN);
+    server.isStopping = false;
+
+    for (int i = 0; i < numOfWorkers; i++) {
+        std::thread(runServerWorker, std::ref(server)).detach();
+    }
+
+    printf("serving %d images on %s with %d workers\n", (int) server.images.size(), socketName, numOfWorkers);
+    fflush(stdout);
+
+    while (!server.isStopping.load()) {
+        int connection = accept(server.listener, NULL, NULL);
+        if (connection < 0) {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> guard(server.connectionLock);
+        server.connections.push_back(connection);
+        server.hasConnection.notify_one();
+    }
+
+    // workers still in the middle of a connection go down with the process
+    close(server.listener);
+    unlink(socketName);
+}
+
+// Reads a machine-code file the way main does, but reports a bad one instead of exiting.
+bool loadImage(const char *fileName, imageStruct &image, char *error, size_t errorSize) {
+    char line[MAXLINELENGTH];
+    int word;
+    FILE *filePtr = fopen(fileName, "r");
+
+    if (filePtr == NULL) {
+        snprintf(error, errorSize, "can't open file %s: %s", fileName, strerror(errno));
+        return false;
+    }
+
+    image.words.clear();
+    while (fgets(line, MAXLINELENGTH, filePtr) != NULL) {
+        if (image.words.size() == NUMMEMORY || sscanf(line, "%d", &word) != 1) {
+            snprintf(error, errorSize, "error in reading address %d of %s", (int) image.words.size(), fileName);
+            fclose(filePtr);
+            return false;
+        }
+        image.words.push_back(word);
+    }
+    fclose(filePtr);
+
+    snprintf(image.fileName, sizeof(image.fileName), "%s", fileName);
+    return true;
+}
+
+void runServerWorker(serverStruct &server) {
+    // the machine is reused by every run this worker serves
+    serverInstanceStruct *instance = new serverInstanceStruct;
+
+    while (true) {
+        int connection;
+        {
+            std::unique_lock<std::mutex> guard(server.connectionLock);
+            server.hasConnection.wait(guard, [&server] { return !server.connections.empty(); });
+            connection = server.connections.front();
+            server.connections.pop_front();
+        }
+
+        serveConnection(server, *instance, connection);
+        close(connection);
+    }
+}
 
-    for (int i = 0; i < cache.blocksPerSet * cache.numOfSets; i++) {
-        if (cache.blocks[i].setIndex == setOffset) {
-            if (cache.blocks[i].isValid == false) {
-                cache.blocks[i].isValid = true;
-                cache.blocks[i].tag = tag;
-                cache.blocks[i].LRU = 0;
-                return cache.blocks[i].blockIndex;
-            } else if (cache.blocks[i].LRU >= highestLRU) {
-                int oldAddress = getOldAddress(cache.blocks[i], cache);
+void serveConnection(serverStruct &server, serverInstanceStruct &instance, int connection) {
+    char line[MAXREQUESTLENGTH];
+    char error[MAXLINELENGTH];
+    FILE *input = fdopen(dup(connection), "r");
+    FILE *output = fdopen(dup(connection), "w");
 
-                if (cache.blocks[i].isDirty) {
-                    sendDirtyCacheToMemory(cache.blocks[i], state, oldAddress, cache.blockSize);
-                    printAction(oldAddress, cache.blockSize, cacheToMemory);
+    while (input != NULL && output != NULL && fgets(line, sizeof(line), input) != NULL) {
+        bool isWhole = strchr(line, '\n') != NULL || feof(input);
+        char *arguments;
+        char *command = strtok_r(line, " \t\r\n", &arguments);
+
+        if (!isWhole) {
+            int character;
+            while ((character = fgetc(input)) != EOF && character != '\n') {
+            }
+            sendError(output, false, "request too long");
+        } else if (command == NULL) {
+            continue;
+        } else if (strcmp(command, "run") == 0) {
+            runRequestStruct request;
+            runReplyStruct reply;
+
+            if (!parseRunRequest(server, arguments, request, error, sizeof(error))) {
+                sendError(output, request.isBinary, error);
+            } else {
+                runRequest(server, instance, request, reply, connection, error, sizeof(error));
+                if (reply.status != 0) {
+                    sendError(output, request.isBinary, error);
                 } else {
-                    printAction(oldAddress, cache.blockSize, cacheToNowhere);
+                    sendRunReply(output, instance, request, reply);
                 }
+            }
+        } else if (strcmp(command, "load") == 0) {
+            char *fileName = strtok_r(NULL, " \t\r\n", &arguments);
+            imageStruct image;
+
+            if (fileName == NULL) {
+                sendError(output, false, "usage: load <machine-code file>");
+            } else if (!loadImage(fileName, image, error, sizeof(error))) {
+                sendError(output, false, error);
+            } else {
+                std::lock_guard<std::mutex> guard(server.imageLock);
+                server.images.push_back(std::move(image));
+                fprintf(output, "{\"image\": %d, \"words\": %d}\n", (int) server.images.size() - 1,
+                        (int) server.images.back().words.size());
+            }
+        } else if (strcmp(command, "images") == 0) {
+            std::lock_guard<std::mutex> guard(server.imageLock);
+            fprintf(output, "[");
+            for (size_t i = 0; i < server.images.size(); i++) {
+                fprintf(output, "%s{\"image\": %d, \"file\": ", i == 0 ? "" : ", ", (int) i);
+                printJsonString(output, server.images[i].fileName);
+                fprintf(output, ", \"words\": %d}", (int) server.images[i].words.size());
+            }
+            fprintf(output, "]\n");
+        } else if (strcmp(command, "quit") == 0) {
+            break;
+        } else if (strcmp(command, "shutdown") == 0) {
+            server.isStopping = true;
+            shutdown(server.listener, SHUT_RDWR);
+            break;
+        } else {
+            snprintf(error, sizeof(error), "unknown request %s", command);
+            sendError(output, false, error);
+        }
+
+        fflush(output);
+    }
+
+    if (input != NULL) {
+        fclose(input);
+    }
+    if (output != NULL) {
+        fclose(output);
+    }
+}
+
+// ##########################################################################################
+// # The options are checked here rather than by parseOptions, which exits on anything bad; #
+// # a server has to answer a bad request and carry on.                                     #
+// ##########################################################################################
 
-                cache.blocks[i].isValid = true;
-                cache.blocks[i].tag = tag;
-                cache.blocks[i].LRU = 0;
-                return cache.blocks[i].blockIndex;
+bool parseRunRequest(serverStruct &server, char *arguments, runRequestStruct &request, char *error, size_t errorSize) {
+    std::vector<char *> tokens;
+    char *next;
+    long long value, other;
+    int numOfImages;
+
+    for (char *token = strtok_r(arguments, " \t\r\n", &next); token != NULL; token = strtok_r(NULL, " \t\r\n", &next)) {
+        tokens.push_back(token);
+    }
+
+    // known first, so that even a bad request gets its error the way it asked
+    request.isBinary = false;
+    for (size_t i = 0; i < tokens.size(); i++) {
+        if (strcmp(tokens[i], "-binary") == 0) {
+            request.isBinary = true;
+        }
+    }
+
+    request.blockSize = 1;
+    request.numOfSets = 1;
+    request.blocksPerSet = 1;
+    request.limit = SERVERDEFAULTLIMIT;
+    request.options.policy = lruPolicy;
+    request.options.writePolicy.isWriteThrough = false;
+    request.options.writePolicy.isWriteAllocate = true;
+    request.options.writeBufferSize = 0;
+    request.options.victimCacheSize = 0;
+    request.options.isMissCache = false;
+    request.options.hitLatency = 1;
+    request.options.bufferLatency = 2;
+    request.options.memoryLatency = 100;
+    request.options.wordsPerCycle = 1;
+    request.options.numOfMSHRs = 4;
+
+    {
+        std::lock_guard<std::mutex> guard(server.imageLock);
+        numOfImages = (int) server.images.size();
+    }
+
+    if (tokens.size() < 2 || !parseRequestNumber(tokens[0], 0, numOfImages - 1, value)) {
+        snprintf(error, errorSize, "usage: run <image> functional|cache|timing [<blockSize> <numOfSets> "
+                                   "<blocksPerSet>] [options], with %d images loaded", numOfImages);
+        return false;
+    }
+    request.image = (int) value;
+
+    if (strcmp(tokens[1], "functional") == 0) {
+        request.model = functionalModel;
+    } else if (strcmp(tokens[1], "cache") == 0) {
+        request.model = cacheModel;
+    } else if (strcmp(tokens[1], "timing") == 0) {
+        request.model = timingModel;
+    } else {
+        snprintf(error, errorSize, "unknown model %s", tokens[1]);
+        return false;
+    }
+
+    size_t i = 2;
+    if (request.model != functionalModel) {
+        int *geometry[3] = {&request.blockSize, &request.numOfSets, &request.blocksPerSet};
+
+        for (int j = 0; j < 3; j++, i++) {
+            if (i >= tokens.size() || !parseRequestNumber(tokens[i], 1, MAXNUMOFBLOCKS, value)) {
+                snprintf(error, errorSize, "%s needs <blockSize> <numOfSets> <blocksPerSet>", tokens[1]);
+                return false;
             }
+            *geometry[j] = (int) value;
         }
     }
 
-    return -1;
+    for (; i < tokens.size(); i++) {
+        char *option = tokens[i];
+        char *colon = strchr(option, ':');
+        bool isGood = true;
+
+        if (strcmp(option, "-policy=lru") == 0) {
+            request.options.policy = lruPolicy;
+        } else if (strcmp(option, "-policy=fifo") == 0) {
+            request.options.policy = fifoPolicy;
+        } else if (strcmp(option, "-policy=random") == 0) {
+            request.options.policy = randomPolicy;
+        } else if (strcmp(option, "-writethrough") == 0) {
+            request.options.writePolicy.isWriteThrough = true;
+        } else if (strcmp(option, "-nowriteallocate") == 0) {
+            request.options.writePolicy.isWriteAllocate = false;
+        } else if (strncmp(option, "-writebuffer=", 13) == 0) {
+            isGood = parseRequestNumber(option + 13, 0, MAXNUMOFBLOCKS, value);
+            request.options.writeBufferSize = (int) value;
+        } else if (strncmp(option, "-victimcache=", 13) == 0 || strncmp(option, "-misscache=", 11) == 0) {
+            request.options.isMissCache = option[1] == 'm';
+            isGood = parseRequestNumber(strchr(option, '=') + 1, 0, MAXNUMOFBLOCKS, value);
+            request.options.victimCacheSize = (int) value;
+        } else if (strncmp(option, "-hitlatency=", 12) == 0) {
+            isGood = parseRequestNumber(option + 12, 1, INT_MAX, value);
+            request.options.hitLatency = (int) value;
+        } else if (strncmp(option, "-bufferlatency=", 15) == 0) {
+            isGood = parseRequestNumber(option + 15, 1, INT_MAX, value);
+            request.options.bufferLatency = (int) value;
+        } else if (strncmp(option, "-memlatency=", 12) == 0) {
+            isGood = parseRequestNumber(option + 12, 0, INT_MAX, value);
+            request.options.memoryLatency = (int) value;
+        } else if (strncmp(option, "-bandwidth=", 11) == 0) {
+            isGood = parseRequestNumber(option + 11, 1, INT_MAX, value);
+            request.options.wordsPerCycle = (int) value;
+        } else if (strncmp(option, "-mshrs=", 7) == 0) {
+            isGood = parseRequestNumber(option + 7, 1, INT_MAX, value);
+            request.options.numOfMSHRs = (int) value;
+        } else if ((strncmp(option, "-mem=", 5) == 0 || strncmp(option, "-reg=", 5) == 0) && colon != NULL) {
+            bool isMemory = option[1] == 'm';
+
+            *colon = '\0';
+            isGood = parseRequestNumber(option + 5, 0, isMemory ? NUMMEMORY - 1 : NUMREGS - 1, value)
+                     && parseRequestNumber(colon + 1, INT_MIN, INT_MAX, other);
+            *colon = ':';
+
+            memoryOverrideStruct override = {(int) value, (int) other};
+            (isMemory ? request.memory : request.registers).push_back(override);
+        } else if (strncmp(option, "-limit=", 7) == 0) {
+            isGood = parseRequestNumber(option + 7, 0, SERVERMAXLIMIT, request.limit);
+            if (request.limit == 0) {
+                request.limit = SERVERMAXLIMIT;
+            }
+        } else if (strcmp(option, "-binary") != 0) {
+            isGood = false;
+        }
+
+        if (!isGood) {
+            snprintf(error, errorSize, "bad option %s", option);
+            return false;
+        }
+    }
+
+    return true;
 }
 
-int getOldAddress(blockStruct &block, cacheStruct &cache) {
-    return (block.tag << (cache.setBits + cache.blockBits)) + (block.setIndex << cache.blockBits);
+// A whole decimal number from min to max.
+bool parseRequestNumber(const char *text, long long min, long long max, long long &value) {
+    char *end;
+
+    errno = 0;
+    value = strtoll(text, &end, 10);
+    return end != text && *end == '\0' && errno == 0 && value >= min && value <= max;
 }
 
-void sendDirtyCacheToMemory(blockStruct &block, stateStruct &state, int address, int blockSize) {
-    block.isDirty = false;
+// ##########################################################################################
+// # Resets the worker's machine to the image and the request's cache, then runs it the     #
+// # way runProgram does. The cache is always tag-only, so memory is current when it stops  #
+// # and the reply needn't flush anything. reply.status is the length of error, or 0. A run #
+// # whose client hangs up is stopped with an error no one reads, freeing the worker.       #
+// ##########################################################################################
 
-    int minus = address % blockSize;
-    int memAddress = address - minus;
+void runRequest(serverStruct &server, serverInstanceStruct &instance, runRequestStruct &request,
+                runReplyStruct &reply, int connection, char *error, size_t errorSize) {
+    stateType &state = instance.state;
+    cacheStruct &cache = instance.cache;
+    const char *fault = NULL;
+    imageStruct *image;
 
-    for (int i = 0; i < blockSize; i++) {
-        state.mem[memAddress] = block.lines[i];
-        memAddress++;
+    {
+        std::lock_guard<std::mutex> guard(server.imageLock);
+        image = &server.images[request.image];
+    }
+
+    memset(&reply, 0, sizeof(reply));
+    configureCache(cache, request.blockSize, request.numOfSets, request.blocksPerSet);
+    cache.isQuiet = true;
+
+    if (request.model == functionalModel) {
+        cache.isBypassed = true;
+    } else if (!isCacheGeometryValid(cache)) {
+        snprintf(error, errorSize, "unsupported cache geometry %d %d %d", cache.blockSize, cache.numOfSets,
+                 cache.blocksPerSet);
+        reply.status = (int) strlen(error);
+        return;
+    } else {
+        cache.policy = request.options.policy;
+        cache.isWriteThrough = request.options.writePolicy.isWriteThrough;
+        cache.isWriteAllocate = request.options.writePolicy.isWriteAllocate;
+        cache.isTagOnly = true;
+        initializeCacheBlocks(cache);
+
+        if (request.options.writeBufferSize > 0) {
+            initializeWriteBuffer(instance.writeBuffer, request.options.writeBufferSize);
+            cache.writeBuffer = &instance.writeBuffer;
+        }
+        if (request.options.victimCacheSize > 0) {
+            initializeVictimCache(instance.victimCache, request.options.victimCacheSize, request.options.isMissCache,
+                                  cache.blockSize);
+            cache.victimCache = &instance.victimCache;
+        }
+        if (request.model == timingModel) {
+            initializeTiming(instance.timing, request.options);
+            cache.timing = &instance.timing;
+        }
+    }
+
+    int numOfWords = (int) image->words.size();
+    memcpy(state.mem, image->words.data(), numOfWords * sizeof(int));
+    memset(state.mem + numOfWords, 0, (NUMMEMORY - numOfWords) * sizeof(int));
+    state.numMemory = numOfWords;
+    clearRegisters(&state);
+
+    for (size_t i = 0; i < request.memory.size(); i++) {
+        state.mem[request.memory[i].address] = request.memory[i].value;
+    }
+    for (size_t i = 0; i < request.registers.size(); i++) {
+        state.reg[request.registers[i].address] = request.registers[i].value;
+    }
+
+    long long numOfInstructions = 0;
+    int halted = 0;
+
+    while (!halted && numOfInstructions < request.limit) {
+        fault = getGuestFault(state);
+        if (fault == NULL && numOfInstructions % SERVERPOLLINTERVAL == SERVERPOLLINTERVAL - 1
+            && isClientGone(connection)) {
+            fault = "client hung up";
+        }
+        if (fault != NULL) {
+            snprintf(error, errorSize, "%s at pc %d after %lld instructions", fault, state.pc, numOfInstructions);
+            reply.status = (int) strlen(error);
+            return;
+        }
+
+        halted = executeInstruction(state, cache);
+        numOfInstructions++;
+    }
+
+    if (cache.writeBuffer != NULL) {
+        drainWriteBuffer(cache, 0);
+    }
+
+    reply.isHalted = halted;
+    reply.pc = state.pc;
+    memcpy(reply.reg, state.reg, sizeof(reply.reg));
+    reply.numOfWords = state.numMemory;
+    reply.numOfInstructions = numOfInstructions;
+    reply.stats = cache.stats;
+    if (cache.timing != NULL) {
+        reply.cycles = cache.timing->cycle;
+        reply.stallCycles = cache.timing->stallCycles;
     }
 }
 
-bool isCacheHit(cacheStruct &cache, int address) {
-    int tag = getTag(cache, address);
-    int setOffset = getSetOffset(cache, address);
+// Only a client that has closed its end entirely; one that just shut down writing still wants the reply.
+bool isClientGone(int connection) {
+    struct pollfd poller;
 
-    for (int i = 0; i < (cache.blocksPerSet * cache.numOfSets); i++) {
-        if (cache.blocks[i].tag == tag && cache.blocks[i].setIndex == setOffset) {
-            return true;
+    poller.fd = connection;
+    poller.events = 0;
+    poller.revents = 0;
+    return poll(&poller, 1, 0) > 0 && (poller.revents & (POLLHUP | POLLERR)) != 0;
+}
+
+// The command line trusts its program, but one run can't be allowed to take the server's other runs down with it.
+const char *getGuestFault(stateType &state) {
+    if (state.pc < 0 || state.pc >= NUMMEMORY) {
+        return "pc out of range";
+    }
+
+    int instruction = state.mem[state.pc];
+    int opCode = getOpCode(instruction);
+
+    if (opCode == LW || opCode == SW) {
+        int address = state.reg[getRegA(instruction)] + convertNum(getOffset(instruction));
+        if (address < 0 || address >= NUMMEMORY) {
+            return "address out of range";
         }
     }
+    return NULL;
+}
+
+void sendRunReply(FILE *output, serverInstanceStruct &instance, runRequestStruct &request, runReplyStruct &reply) {
+    stateType &state = instance.state;
+
+    if (request.isBinary) {
+        fwrite(&reply, sizeof(reply), 1, output);
+        fwrite(state.mem, sizeof(int), reply.numOfWords, output);
+        return;
+    }
 
-    return false;
+    fprintf(output, "{\"halted\": %s, \"instructions\": %lld, \"pc\": %d, \"reg\": [",
+            reply.isHalted ? "true" : "false", reply.numOfInstructions, reply.pc);
+    for (int i = 0; i < NUMREGS; i++) {
+        fprintf(output, "%s%d", i == 0 ? "" : ", ", reply.reg[i]);
+    }
+    fprintf(output, "], \"accesses\": %lld, \"hits\": %lld, \"misses\": %lld, \"writebacks\": %lld, "
+                    "\"wordsFromMemory\": %lld, \"wordsToMemory\": %lld",
+            reply.stats.accesses, reply.stats.hits, reply.stats.misses, reply.stats.writebacks,
+            reply.stats.wordsFromMemory, reply.stats.wordsToMemory);
+    if (request.model == timingModel) {
+        fprintf(output, ", \"cycles\": %lld, \"stallCycles\": %lld", reply.cycles, reply.stallCycles);
+    }
+    fprintf(output, ", \"mem\": [");
+    for (int i = 0; i < reply.numOfWords; i++) {
+        fprintf(output, "%s%d", i == 0 ? "" : ", ", state.mem[i]);
+    }
+    fprintf(output, "]}\n");
 }
 
-void updateLRU(cacheStruct &cache, int address) {
-    int tag = getTag(cache, address);
-    int setOffset = getSetOffset(cache, address);
+void sendError(FILE *output, bool isBinary, const char *error) {
+    if (isBinary) {
+        int length = (int) strlen(error);
+        fwrite(&length, sizeof(length), 1, output);
+        fwrite(error, 1, length, output);
+        return;
+    }
 
-    for (int i = 0; i < (cache.blocksPerSet * cache.numOfSets); i++) {
-        if (cache.blocks[i].tag == tag && cache.blocks[i].setIndex == setOffset) {
-            cache.blocks[i].LRU = 0;
-        } else {
-            cache.blocks[i].LRU++;
+    fprintf(output, "{\"error\": ");
+    printJsonString(output, error);
+    fprintf(output, "}\n");
+}
+
+void printJsonString(FILE *output, const char *text) {
+    fputc('"', output);
+    for (; *text != '\0'; text++) {
+        if (*text == '"' || *text == '\\') {
+            fputc('\\', output);
         }
+        fputc(*text, output);
     }
+    fputc('"', output);
 }